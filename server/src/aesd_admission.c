@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "aesd_admission.h"
+#include "aesd_log.h"
+#include "aesd_metrics.h"
+#include "aesd_slab.h"
+
+#define ADMISSION_BUCKETS       4096    // power of two
+
+struct sourceEntry
+{
+    unsigned char addr[16];
+    size_t count;                       // open connections from addr
+    struct sourceEntry *next;
+};
+
+static size_t maxConnections = 0;
+static size_t maxPerSource = 0;
+static size_t openConnections = 0;
+
+// Sources with at least one open connection; an entry goes when its last does
+static pthread_mutex_t sourceMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct sourceEntry *sources[ADMISSION_BUCKETS];
+static struct aesd_slab sourceSlab = AESD_SLAB_INITIALIZER(sizeof(struct sourceEntry), 64);
+
+void aesd_admission_set_limits(size_t connections, size_t perSource)
+{
+    maxConnections = connections;
+    maxPerSource = perSource;
+}
+
+/**
+ * Fills in the IPv6 form of the peer address; false for peers without one.
+ */
+static bool sourceAddress(const struct sockaddr *clientAddr, socklen_t clientLen, unsigned char *addr)
+{
+    sa_family_t family = clientLen >= sizeof(sa_family_t) ? clientAddr->sa_family : AF_UNSPEC;
+
+    if (family == AF_INET6)
+    {
+        memcpy(addr, &((const struct sockaddr_in6 *)clientAddr)->sin6_addr, 16);
+        return true;
+    }
+    if (family == AF_INET)
+    {
+        // The dual-stack listener reports IPv4 clients this way too
+        memset(addr, 0, 10);
+        addr[10] = 0xff;
+        addr[11] = 0xff;
+        memcpy(addr + 12, &((const struct sockaddr_in *)clientAddr)->sin_addr, 4);
+        return true;
+    }
+    return false;
+}
+
+static struct sourceEntry** sourceBucket(const unsigned char *addr)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 16; i++)
+    {
+        hash = (hash ^ addr[i]) * 16777619u;
+    }
+    return &sources[hash & (ADMISSION_BUCKETS - 1)];
+}
+
+/**
+ * Counts one more connection from @param addr unless it already has
+ * maxPerSource of them.
+ */
+static bool admitSource(const unsigned char *addr)
+{
+    bool admitted = true;
+
+    pthread_mutex_lock(&sourceMutex);
+    struct sourceEntry **bucket = sourceBucket(addr);
+    struct sourceEntry *entry = *bucket;
+    while (entry != NULL && memcmp(entry->addr, addr, 16) != 0)
+    {
+        entry = entry->next;
+    }
+
+    if (entry == NULL)
+    {
+        entry = aesd_slab_alloc(&sourceSlab);
+        if (entry == NULL)
+        {
+            admitted = false;
+        }
+        else
+        {
+            memcpy(entry->addr, addr, 16);
+            entry->count = 1;
+            entry->next = *bucket;
+            *bucket = entry;
+        }
+    }
+    else if (entry->count >= maxPerSource)
+    {
+        admitted = false;
+    }
+    else
+    {
+        entry->count++;
+    }
+    pthread_mutex_unlock(&sourceMutex);
+    return admitted;
+}
+
+static void releaseSource(const unsigned char *addr)
+{
+    pthread_mutex_lock(&sourceMutex);
+    struct sourceEntry **link = sourceBucket(addr);
+    while (*link != NULL && memcmp((*link)->addr, addr, 16) != 0)
+    {
+        link = &(*link)->next;
+    }
+
+    struct sourceEntry *entry = *link;
+    if (entry != NULL && --entry->count == 0)
+    {
+        *link = entry->next;
+        aesd_slab_free(&sourceSlab, entry);
+    }
+    pthread_mutex_unlock(&sourceMutex);
+}
+
+bool aesd_admission_admit(const struct sockaddr *clientAddr, socklen_t clientLen, struct aesd_admission_source *source)
+{
+    source->tracked = false;
+
+    size_t open = __atomic_add_fetch(&openConnections, 1, __ATOMIC_RELAXED);
+    if (maxConnections > 0 && open > maxConnections)
+    {
+        __atomic_sub_fetch(&openConnections, 1, __ATOMIC_RELAXED);
+        AESD_LOG(LOG_DEBUG, "Refusing connection, %zu connections open", maxConnections);
+        aesd_metrics_add(AESD_METRIC_REFUSED_TOTAL, 1);
+        return false;
+    }
+
+    if (maxPerSource > 0 && sourceAddress(clientAddr, clientLen, source->addr))
+    {
+        if (admitSource(source->addr) == false)
+        {
+            __atomic_sub_fetch(&openConnections, 1, __ATOMIC_RELAXED);
+            AESD_LOG(LOG_DEBUG, "Refusing connection, source has %zu connections open", maxPerSource);
+            aesd_metrics_add(AESD_METRIC_REFUSED_SOURCE, 1);
+            return false;
+        }
+        source->tracked = true;
+    }
+    return true;
+}
+
+void aesd_admission_release(struct aesd_admission_source *source)
+{
+    if (source->tracked)
+    {
+        releaseSource(source->addr);
+        source->tracked = false;
+    }
+    __atomic_sub_fetch(&openConnections, 1, __ATOMIC_RELAXED);
+}
+
+size_t aesd_admission_open_connections(void)
+{
+    return __atomic_load_n(&openConnections, __ATOMIC_RELAXED);
+}
+
+void aesd_admission_cleanup(void)
+{
+    pthread_mutex_lock(&sourceMutex);
+    memset(sources, 0, sizeof(sources));
+    pthread_mutex_unlock(&sourceMutex);
+    aesd_slab_destroy(&sourceSlab);
+}
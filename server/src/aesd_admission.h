@@ -0,0 +1,49 @@
+/*
+ * aesd_admission.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_ADMISSION_H
+#define AESD_ADMISSION_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+/**
+ * Where a connection came from, as far as the per-source limit is concerned.
+ */
+struct aesd_admission_source
+{
+    unsigned char addr[16];     // IPv6 address, IPv4 clients as IPv4-mapped addresses
+    bool tracked;               // counted against the per-source limit
+};
+
+/**
+ * Caps the connections open at once in total and from any one IP address; 0
+ * lifts a limit. Unix socket clients only count against the total.
+ */
+void aesd_admission_set_limits(size_t maxConnections, size_t maxPerSource);
+
+/**
+ * Decides whether the client at @param clientAddr may have one more
+ * connection and, if so, counts it in @param source. Every admitted connection
+ * is handed back with aesd_admission_release() when it closes.
+ */
+bool aesd_admission_admit(const struct sockaddr *clientAddr, socklen_t clientLen, struct aesd_admission_source *source);
+void aesd_admission_release(struct aesd_admission_source *source);
+
+/**
+ * Connections admitted and not released yet.
+ */
+size_t aesd_admission_open_connections(void);
+
+/**
+ * Returns the memory of the source table; every admitted connection must have
+ * been released.
+ */
+void aesd_admission_cleanup(void);
+
+#endif /* AESD_ADMISSION_H */
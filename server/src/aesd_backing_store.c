@@ -0,0 +1,949 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "aesd_backing_store.h"
+#include "aesd_compress.h"
+#include "aesd_log.h"
+#include "aesd_metrics.h"
+#include "aesd_thread.h"
+
+#define BACKING_STORE_CHUNK_SIZE    (64 * 1024)
+
+static pthread_mutex_t fileMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t fileLockedAtNs;         // written by the fileMutex holder only
+static int storeFd = -1;                // opened once, written by one thread, read positionally
+static bool storeIsFile = false;
+static size_t storeLength = 0;          // file backend: bytes written so far, committer only
+static enum aesd_backing_store_reply_path replyPath = AESD_REPLY_PATH_HISTORY;
+static struct aesd_history history;
+static bool historyReady = false;
+static int adoptedHistoryFd = -1;       // log handed over by the previous server process
+
+// Write-behind persistence of the log to the file backend
+static pthread_t persistThread;
+static bool persistThreadStarted = false;
+static atomic_bool persistStop = false;
+
+// Group commit of appends to a backend written through (the char device, or
+// the file when replies do not come from the log): appenders queue their
+// packet and wait, the committer writes whole batches with one writev()
+struct commitRequest
+{
+    const char *data;
+    size_t size;
+    size_t end;                         // store length right after data, once committed
+    bool done;
+    bool result;
+    struct commitRequest *next;
+};
+
+static pthread_t commitThread;
+static bool commitThreadStarted = false;
+static pthread_mutex_t commitMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commitCond = PTHREAD_COND_INITIALIZER;       // committer waits for requests
+static pthread_cond_t committedCond = PTHREAD_COND_INITIALIZER;    // appenders wait for their batch
+static struct commitRequest *commitHead = NULL;
+static struct commitRequest **commitTail = &commitHead;
+static size_t commitQueued = 0;
+static bool commitStop = false;
+static unsigned commitWindowUs = 0;
+static unsigned commitMaxBatch = AESD_BACKING_STORE_DEFAULT_BATCH;
+static uint64_t commitBatches = 0;
+static uint64_t commitPackets = 0;
+
+/**
+ * fileMutex with its wait and hold times recorded.
+ */
+static void lockFile(void)
+{
+    uint64_t start = aesd_metrics_now_ns();
+    pthread_mutex_lock(&fileMutex);
+    fileLockedAtNs = aesd_metrics_now_ns();
+    aesd_metrics_observe(AESD_METRIC_STORE_LOCK_WAIT, fileLockedAtNs - start);
+}
+
+static void unlockFile(void)
+{
+    uint64_t held = aesd_metrics_now_ns() - fileLockedAtNs;
+    pthread_mutex_unlock(&fileMutex);
+    aesd_metrics_observe(AESD_METRIC_STORE_LOCK_HOLD, held);
+}
+
+/**
+ * The char device keeps its own bounded history and moves its read position on
+ * AESDCHAR_IOCSEEKTO, so only the file backend can be mirrored in memory.
+ */
+static bool useHistory(void)
+{
+    return USE_AESD_CHAR_DEVICE == 0 && replyPath == AESD_REPLY_PATH_HISTORY;
+}
+
+/**
+ * Writes all of @param iov, resuming after short writes. Modifies @param iov.
+ */
+static bool writevAll(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads the store from byte @param offset on until its end or until @param
+ * limit bytes were read, without moving the shared file position.
+ */
+static bool readAt(off_t offset, size_t limit, struct aesd_temperary_buffer *buffer)
+{
+    while (limit > 0)
+    {
+        size_t chunk = limit < BACKING_STORE_CHUNK_SIZE ? limit : BACKING_STORE_CHUNK_SIZE;
+        char *bufferRead = aesd_temperary_buffer_reserve(buffer, chunk);
+        if (bufferRead == NULL)
+        {
+            return false;
+        }
+        ssize_t bytesRead = pread(storeFd, bufferRead, chunk, offset);
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        if (bytesRead == 0)
+        {
+            return true;
+        }
+        aesd_temperary_buffer_commit(buffer, bytesRead);
+        offset += bytesRead;
+        limit -= bytesRead;
+    }
+    return true;
+}
+
+/**
+ * Prepares @param reply with store bytes [@param start, @param end), @param end
+ * being SIZE_MAX for wherever the store ends now: the file is streamed later
+ * without the mutex, anything else is copied out right away. Called with
+ * fileMutex held.
+ */
+static bool prepareReply(size_t start, size_t end, struct aesd_backing_store_reply *reply)
+{
+    if (replyPath != AESD_REPLY_PATH_COPY && storeIsFile)
+    {
+        struct stat st;
+        if (end == SIZE_MAX)
+        {
+            if (fstat(storeFd, &st) < 0)
+            {
+                return false;
+            }
+            end = st.st_size;
+        }
+        reply->fd = storeFd;
+        reply->offset = start < end ? start : end;
+        reply->end = end;
+        reply->useSendfile = true;
+        reply->version = end;
+        return true;
+    }
+
+    size_t limit = end == SIZE_MAX ? SIZE_MAX : end - (start < end ? start : end);
+    bool result = readAt(start, limit, &reply->buffer);
+    reply->version = start + reply->buffer.size;
+    return result;
+}
+
+/**
+ * Prepares @param reply with bytes [@param from, @param end) of the store. The
+ * char device shifts offsets as it drops old entries, so it always replies in
+ * full. Called with fileMutex held.
+ */
+static bool storeReply(size_t from, size_t end, struct aesd_backing_store_reply *reply)
+{
+    if (USE_AESD_CHAR_DEVICE)
+    {
+        return prepareReply(0, SIZE_MAX, reply);
+    }
+    return prepareReply(from, end, reply);
+}
+
+/**
+ * Points @param reply at log bytes [@param from, @param version).
+ */
+static void historyReply(size_t from, size_t version, struct aesd_backing_store_reply *reply)
+{
+    from = from < version ? from : version;
+    aesd_history_cursor_init(&reply->history, &history, from, version);
+    reply->version = version;
+}
+
+/**
+ * Copies what the file backend holds from a previous run into the log.
+ */
+static bool loadHistory(void)
+{
+    char bufferRead[BACKING_STORE_CHUNK_SIZE];
+    off_t offset = 0;
+
+    while (1)
+    {
+        ssize_t bytesRead = pread(storeFd, bufferRead, sizeof(bufferRead), offset);
+        if (bytesRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            return bytesRead == 0;
+        }
+        if (aesd_history_append(&history, bufferRead, bytesRead) == 0)
+        {
+            return false;
+        }
+        offset += bytesRead;
+    }
+}
+
+/**
+ * Copies everything published to the log since the last pass into the file,
+ * so writers never touch the file themselves. During a hand over the old and
+ * the new server process both run one; they take turns on the same log.
+ */
+static void* persistHandler(void *arg)
+{
+    (void)arg; // Unused parameter
+
+    while (1)
+    {
+        // Read first, so an append or a stop after this point ends the wait
+        uint32_t sequence = aesd_history_sequence(&history);
+        if (aesd_history_persisted(&history) >= aesd_history_version(&history))
+        {
+            if (atomic_load(&persistStop))
+            {
+                break;
+            }
+            aesd_history_wait(&history, sequence);
+            continue;
+        }
+
+        if (aesd_history_persist(&history, storeFd) == false)
+        {
+            // The log stays authoritative; the file just misses this range
+            AESD_LOG(LOG_ERR, "Failed to persist the log to %s: %s", AESD_BACKING_STORE_PATH, strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Writes a batch of @param count requests with one writev() and records where
+ * each of them ends in the store.
+ */
+static bool commitBatch(struct commitRequest *batch, size_t count)
+{
+    static struct iovec iov[AESD_BACKING_STORE_MAX_BATCH];     // committer only
+    struct commitRequest *request = batch;
+
+    for (size_t i = 0; i < count; i++, request = request->next)
+    {
+        iov[i].iov_base = (void *)request->data;
+        iov[i].iov_len = request->size;
+    }
+
+    lockFile();
+    bool written = writevAll(storeFd, iov, count);
+    unlockFile();
+
+    if (written == false)
+    {
+        AESD_LOG(LOG_ERR, "Failed to write to %s: %s", AESD_BACKING_STORE_PATH, strerror(errno));
+        // Part of the batch may have made it, start over from the real length
+        struct stat st;
+        if (fstat(storeFd, &st) == 0)
+        {
+            storeLength = st.st_size;
+        }
+        return false;
+    }
+
+    // Only this committer appends, so the batch starts where the store ended;
+    // unless the server is handing over and its successor appends as well,
+    // but O_APPEND leaves the file position right behind this batch
+    off_t position = storeIsFile ? lseek(storeFd, 0, SEEK_CUR) : -1;
+    if (position >= 0)
+    {
+        size_t batchSize = 0;
+        for (request = batch; request != NULL; request = request->next)
+        {
+            batchSize += request->size;
+        }
+        storeLength = (size_t)position - batchSize;
+    }
+    for (request = batch; request != NULL; request = request->next)
+    {
+        storeLength += request->size;
+        request->end = storeLength;
+    }
+    return true;
+}
+
+static void* commitHandler(void *arg)
+{
+    (void)arg; // Unused parameter
+
+    pthread_mutex_lock(&commitMutex);
+    while (1)
+    {
+        if (commitQueued == 0)
+        {
+            if (commitStop)
+            {
+                break;
+            }
+            pthread_cond_wait(&commitCond, &commitMutex);
+            continue;
+        }
+
+        if (commitWindowUs > 0)
+        {
+            // Give other appenders the flush window to join the batch
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)commitWindowUs * 1000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            while (commitQueued < commitMaxBatch && commitStop == false &&
+                   pthread_cond_timedwait(&commitCond, &commitMutex, &deadline) == 0)
+            {
+            }
+        }
+
+        struct commitRequest *batch = commitHead;
+        struct commitRequest *last = batch;
+        size_t count = 1;
+        while (count < commitMaxBatch && last->next != NULL)
+        {
+            last = last->next;
+            count++;
+        }
+        commitHead = last->next;
+        if (commitHead == NULL)
+        {
+            commitTail = &commitHead;
+        }
+        last->next = NULL;
+        commitQueued -= count;
+        pthread_mutex_unlock(&commitMutex);
+
+        bool result = commitBatch(batch, count);
+
+        pthread_mutex_lock(&commitMutex);
+        commitBatches++;
+        commitPackets += count;
+        if (result)
+        {
+            aesd_metrics_add(AESD_METRIC_PACKETS_COMMITTED, count);
+        }
+        while (batch != NULL)
+        {
+            // The request lives on its appender's stack, do not touch it once done
+            struct commitRequest *next = batch->next;
+            batch->result = result;
+            batch->done = true;
+            batch = next;
+        }
+        pthread_cond_broadcast(&committedCond);
+    }
+    pthread_mutex_unlock(&commitMutex);
+    return NULL;
+}
+
+/**
+ * Queues @param size bytes of @param data for the committer and waits until
+ * they are written. Sets @param end to the store length right after them,
+ * SIZE_MAX when it is not known (the char device).
+ */
+static bool commitAppend(const char *data, size_t size, size_t *end)
+{
+    struct commitRequest request = { data, size, SIZE_MAX, false, false, NULL };
+
+    pthread_mutex_lock(&commitMutex);
+    *commitTail = &request;
+    commitTail = &request.next;
+    commitQueued++;
+    if (commitQueued == 1 || commitQueued >= commitMaxBatch)
+    {
+        pthread_cond_signal(&commitCond);
+    }
+    while (request.done == false)
+    {
+        pthread_cond_wait(&committedCond, &commitMutex);
+    }
+    pthread_mutex_unlock(&commitMutex);
+
+    *end = USE_AESD_CHAR_DEVICE ? SIZE_MAX : request.end;
+    return request.result;
+}
+
+bool aesd_backing_store_init(void)
+{
+    // One descriptor for the whole run: appends go through it, reads use
+    // positional I/O so they never disturb each other's file position
+    storeFd = open(AESD_BACKING_STORE_PATH, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (storeFd < 0)
+    {
+        AESD_LOG(LOG_ERR, "Failed to open %s: %s", AESD_BACKING_STORE_PATH, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(storeFd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        storeIsFile = true;
+        storeLength = st.st_size;
+    }
+
+    if (useHistory() == false)
+    {
+        if (adoptedHistoryFd >= 0)
+        {
+            close(adoptedHistoryFd);
+            adoptedHistoryFd = -1;
+        }
+        pthread_attr_t attr;
+        aesd_thread_attr_init(&attr);
+        int created = pthread_create(&commitThread, &attr, commitHandler, NULL);
+        pthread_attr_destroy(&attr);
+        if (created != 0)
+        {
+            return false;
+        }
+        commitThreadStarted = true;
+        return true;
+    }
+    if (adoptedHistoryFd >= 0)
+    {
+        // The previous process keeps the file up to date with this log
+        historyReady = aesd_history_attach(&history, adoptedHistoryFd);
+        adoptedHistoryFd = -1;
+        if (historyReady == false)
+        {
+            AESD_LOG(LOG_ERR, "Failed to map the handed over history");
+            return false;
+        }
+    }
+    else
+    {
+        if (aesd_history_init(&history) == false)
+        {
+            return false;
+        }
+        historyReady = true;
+        if (loadHistory() == false)
+        {
+            AESD_LOG(LOG_ERR, "Failed to load %s: %s", AESD_BACKING_STORE_PATH, strerror(errno));
+            return false;
+        }
+        aesd_history_mark_persisted(&history, aesd_history_version(&history));
+    }
+
+    pthread_attr_t attr;
+    aesd_thread_attr_init(&attr);
+    int created = pthread_create(&persistThread, &attr, persistHandler, NULL);
+    pthread_attr_destroy(&attr);
+    if (created != 0)
+    {
+        return false;
+    }
+    persistThreadStarted = true;
+    return true;
+}
+
+void aesd_backing_store_cleanup(void)
+{
+    if (commitThreadStarted)
+    {
+        // Every appender has returned by now, the queue is empty
+        pthread_mutex_lock(&commitMutex);
+        commitStop = true;
+        pthread_cond_signal(&commitCond);
+        pthread_mutex_unlock(&commitMutex);
+        pthread_join(commitThread, NULL);
+        commitThreadStarted = false;
+        if (commitBatches > 0)
+        {
+            AESD_LOG(LOG_INFO, "Group commit wrote %" PRIu64 " packets in %" PRIu64 " batches, %.1f per batch",
+                     commitPackets, commitBatches, (double)commitPackets / commitBatches);
+        }
+    }
+    if (persistThreadStarted)
+    {
+        // The persister drains what is left of the log before it exits
+        atomic_store(&persistStop, true);
+        aesd_history_wake(&history);
+        pthread_join(persistThread, NULL);
+        persistThreadStarted = false;
+    }
+    if (storeFd >= 0)
+    {
+        close(storeFd);
+        storeFd = -1;
+    }
+    if (historyReady)
+    {
+        aesd_history_destroy(&history);
+        historyReady = false;
+    }
+    aesd_compress_cleanup();
+}
+
+void aesd_backing_store_adopt_history(int fd)
+{
+    adoptedHistoryFd = fd;
+}
+
+int aesd_backing_store_history_fd(void)
+{
+    return historyReady ? aesd_history_fd(&history) : -1;
+}
+
+void aesd_backing_store_set_reply_path(enum aesd_backing_store_reply_path path)
+{
+    replyPath = path;
+}
+
+void aesd_backing_store_set_group_commit(unsigned windowUs, unsigned maxBatch)
+{
+    commitWindowUs = windowUs;
+    commitMaxBatch = maxBatch < 1 ? 1 : maxBatch > AESD_BACKING_STORE_MAX_BATCH ? AESD_BACKING_STORE_MAX_BATCH : maxBatch;
+}
+
+/**
+ * Appends to the log and hands the bytes to the persister. Returns the new log
+ * version, 0 on failure.
+ */
+static size_t appendToHistory(const char *data, size_t size)
+{
+    size_t version = aesd_history_append(&history, data, size);
+    if (version == 0)
+    {
+        AESD_LOG(LOG_ERR, "Failed to grow the in-memory history");
+        return 0;
+    }
+    aesd_metrics_add(AESD_METRIC_PACKETS_COMMITTED, 1);
+    return version;
+}
+
+bool aesd_backing_store_append_and_read(const char *data, size_t size, size_t from,
+                                        struct aesd_backing_store_reply *reply)
+{
+    bool result = false;
+
+    if (useHistory())
+    {
+        // Streamed without any lock; later appends do not touch these bytes
+        size_t version = appendToHistory(data, size);
+        historyReply(from, version, reply);
+        return version > 0;
+    }
+
+    size_t end;
+    if (commitAppend(data, size, &end) == false)
+    {
+        return false;
+    }
+
+    // Ends at this packet even when the rest of its batch follows it
+    lockFile();
+    result = storeReply(from, end, reply);
+    unlockFile();
+    return result;
+}
+
+bool aesd_backing_store_read(size_t from, struct aesd_backing_store_reply *reply)
+{
+    if (useHistory())
+    {
+        historyReply(from, aesd_history_version(&history), reply);
+        return true;
+    }
+
+    lockFile();
+    bool result = storeReply(from, SIZE_MAX, reply);
+    unlockFile();
+    return result;
+}
+
+bool aesd_backing_store_seek_and_read(const struct aesd_seekto *command, struct aesd_backing_store_reply *reply)
+{
+    bool result = false;
+
+    lockFile();
+
+    // The driver reports the new position only through the file position,
+    // which nothing else relies on
+    off_t start = -1;
+    if (ioctl(storeFd, AESDCHAR_IOCSEEKTO, command) < 0 || (start = lseek(storeFd, 0, SEEK_CUR)) < 0)
+    {
+        AESD_LOG(LOG_ERR, "AESDCHAR_IOCSEEKTO %u,%u failed", command->write_cmd, command->write_cmd_offset);
+    }
+    else
+    {
+        result = prepareReply(start, SIZE_MAX, reply);
+    }
+
+    unlockFile();
+    return result;
+}
+
+bool aesd_backing_store_append(const char *data, size_t size)
+{
+    if (useHistory())
+    {
+        return appendToHistory(data, size) > 0;
+    }
+
+    size_t end;
+    return commitAppend(data, size, &end);
+}
+
+void aesd_backing_store_reply_init(struct aesd_backing_store_reply *reply)
+{
+    memset(reply, 0, sizeof(*reply));
+    reply->fd = -1;
+    aesd_temperary_buffer_init(&reply->buffer);
+}
+
+/**
+ * Sends what is left in reply->buffer. Returns false on a socket error and sets
+ * @param blocked when the socket stopped accepting data.
+ */
+static bool sendBuffered(struct aesd_backing_store_reply *reply, int sockFd, bool *blocked)
+{
+    *blocked = false;
+    while (reply->bufferSent < reply->buffer.size)
+    {
+        ssize_t sent = send(sockFd, reply->buffer.buffptr + reply->bufferSent,
+                            reply->buffer.size - reply->bufferSent, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                *blocked = true;
+                return true;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        reply->bufferSent += sent;
+    }
+    return true;
+}
+
+/**
+ * Sends what is left of reply->prefix, corked with the history behind it.
+ * Returns false on a socket error and sets @param blocked when the socket
+ * stopped accepting data.
+ */
+static bool sendPrefix(struct aesd_backing_store_reply *reply, int sockFd, bool *blocked)
+{
+    *blocked = false;
+    while (reply->prefixSent < reply->prefixSize)
+    {
+        int flags = MSG_NOSIGNAL | (aesd_backing_store_reply_length(reply) > 0 ? MSG_MORE : 0);
+        ssize_t sent = send(sockFd, reply->prefix + reply->prefixSent, reply->prefixSize - reply->prefixSent, flags);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                *blocked = true;
+                return true;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        reply->prefixSent += sent;
+    }
+    return true;
+}
+
+bool aesd_backing_store_reply_send(struct aesd_backing_store_reply *reply, int sockFd)
+{
+    bool blocked;
+
+    if (sendPrefix(reply, sockFd, &blocked) == false)
+    {
+        return false;
+    }
+    if (blocked)
+    {
+        return true;
+    }
+    if (sendBuffered(reply, sockFd, &blocked) == false)
+    {
+        return false;
+    }
+    if (blocked == false && aesd_history_cursor_done(&reply->history) == false)
+    {
+        return aesd_history_cursor_send(&reply->history, sockFd);
+    }
+    if (blocked || reply->fd < 0)
+    {
+        return true;
+    }
+
+    while (reply->offset < reply->end)
+    {
+        if (reply->useSendfile)
+        {
+            ssize_t sent = sendfile(sockFd, reply->fd, &reply->offset, reply->end - reply->offset);
+            if (sent < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    return true;
+                }
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EINVAL || errno == ENOSYS)
+                {
+                    // The file system cannot splice this file, copy it instead
+                    reply->useSendfile = false;
+                    continue;
+                }
+                return false;
+            }
+            if (sent == 0)
+            {
+                // File got shorter than when the reply was taken
+                if (reply->prefixSize > 0)
+                {
+                    return false;
+                }
+                reply->end = reply->offset;
+            }
+            continue;
+        }
+
+        char bufferSend[BACKING_STORE_CHUNK_SIZE];
+        size_t chunk = reply->end - reply->offset < (off_t)sizeof(bufferSend) ? (size_t)(reply->end - reply->offset) : sizeof(bufferSend);
+        ssize_t bytesRead = pread(reply->fd, bufferSend, chunk, reply->offset);
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        if (bytesRead == 0)
+        {
+            if (reply->prefixSize > 0)
+            {
+                return false;
+            }
+            reply->end = reply->offset;
+            break;
+        }
+        reply->offset += bytesRead;
+
+        ssize_t sent = send(sockFd, bufferSend, bytesRead, MSG_NOSIGNAL);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            return false;
+        }
+        if (sent < bytesRead)
+        {
+            // Keep the unsent tail until the socket is writable again
+            sent = sent < 0 ? 0 : sent;
+            aesd_temperary_buffer_reset(&reply->buffer);
+            reply->bufferSent = 0;
+            return aesd_temperary_buffer_add(&reply->buffer, bufferSend + sent, bytesRead - sent);
+        }
+    }
+
+    return true;
+}
+
+bool aesd_backing_store_reply_done(const struct aesd_backing_store_reply *reply)
+{
+    if (reply->prefixSent < reply->prefixSize)
+    {
+        return false;
+    }
+    if (reply->bufferSent < reply->buffer.size || aesd_history_cursor_done(&reply->history) == false)
+    {
+        return false;
+    }
+    return reply->fd < 0 || reply->offset >= reply->end;
+}
+
+size_t aesd_backing_store_reply_length(const struct aesd_backing_store_reply *reply)
+{
+    size_t length = (reply->buffer.size - reply->bufferSent) + (reply->history.end - reply->history.offset);
+
+    if (reply->fd >= 0 && reply->offset < reply->end)
+    {
+        length += reply->end - reply->offset;
+    }
+    return length;
+}
+
+void aesd_backing_store_reply_set_prefix(struct aesd_backing_store_reply *reply, const void *data, size_t size)
+{
+    size = size < sizeof(reply->prefix) ? size : sizeof(reply->prefix);
+    memcpy(reply->prefix, data, size);
+    reply->prefixSize = size;
+    reply->prefixSent = 0;
+}
+
+bool aesd_backing_store_reply_compress(struct aesd_backing_store_reply *reply,
+                                       struct aesd_temperary_buffer *scratch)
+{
+    // The char device renumbers its bytes as it drops old entries, so only the
+    // file backend's blocks can be cached
+    const bool cacheable = USE_AESD_CHAR_DEVICE == 0;
+    struct aesd_temperary_buffer raw;
+    size_t start;
+
+    if (aesd_history_cursor_done(&reply->history) == false)
+    {
+        struct aesd_history_cursor *cursor = &reply->history;
+        bool result = aesd_compress_append(&reply->buffer, cursor->data + cursor->offset,
+                                           cursor->end - cursor->offset, cursor->offset, cacheable);
+        cursor->offset = cursor->end;
+        return result;
+    }
+
+    if (reply->fd >= 0)
+    {
+        // Compressed replies cannot be spliced from the file, the bytes are
+        // read into the reply's own storage first
+        raw = reply->buffer;
+        raw.size = 0;
+        if (reply->offset < reply->end && readAt(reply->offset, reply->end - reply->offset, &raw) == false)
+        {
+            reply->buffer = raw;
+            return false;
+        }
+        start = reply->offset;
+        reply->fd = -1;
+        reply->offset = reply->end;
+    }
+    else
+    {
+        raw = reply->buffer;
+        start = reply->version - raw.size;
+    }
+
+    reply->buffer = *scratch;
+    reply->buffer.size = 0;
+    bool result = aesd_compress_append(&reply->buffer, raw.buffptr, raw.size, start, cacheable);
+
+    *scratch = raw;
+    aesd_temperary_buffer_reset(scratch);
+    return result;
+}
+
+int aesd_backing_store_reply_iovecs(const struct aesd_backing_store_reply *reply, struct iovec *iov, int max)
+{
+    int count = 0;
+
+    if (max > count && reply->prefixSent < reply->prefixSize)
+    {
+        iov[count].iov_base = (void *)(reply->prefix + reply->prefixSent);
+        iov[count].iov_len = reply->prefixSize - reply->prefixSent;
+        count++;
+    }
+    if (max > count && reply->bufferSent < reply->buffer.size)
+    {
+        iov[count].iov_base = reply->buffer.buffptr + reply->bufferSent;
+        iov[count].iov_len = reply->buffer.size - reply->bufferSent;
+        count++;
+    }
+    return count + aesd_history_cursor_iovecs(&reply->history, iov + count, max - count);
+}
+
+void aesd_backing_store_reply_advance(struct aesd_backing_store_reply *reply, size_t size)
+{
+    size_t prefixLeft = reply->prefixSize - reply->prefixSent;
+    size_t fromPrefix = size < prefixLeft ? size : prefixLeft;
+
+    reply->prefixSent += fromPrefix;
+    size -= fromPrefix;
+
+    size_t buffered = reply->buffer.size - reply->bufferSent;
+    size_t fromBuffer = size < buffered ? size : buffered;
+
+    reply->bufferSent += fromBuffer;
+    aesd_history_cursor_advance(&reply->history, size - fromBuffer);
+}
+
+void aesd_backing_store_reply_release(struct aesd_backing_store_reply *reply)
+{
+    aesd_temperary_buffer_clean(&reply->buffer);
+    aesd_backing_store_reply_init(reply);
+}
+
+void aesd_backing_store_reply_init_scratch(struct aesd_backing_store_reply *reply,
+                                           struct aesd_temperary_buffer *scratch)
+{
+    aesd_backing_store_reply_init(reply);
+    reply->buffer = *scratch;
+    reply->buffer.size = 0;
+    aesd_temperary_buffer_init(scratch);
+}
+
+void aesd_backing_store_reply_recycle(struct aesd_backing_store_reply *reply,
+                                      struct aesd_temperary_buffer *scratch)
+{
+    if (scratch->buffptr == NULL)
+    {
+        *scratch = reply->buffer;
+        aesd_temperary_buffer_reset(scratch);
+        aesd_temperary_buffer_init(&reply->buffer);
+    }
+    aesd_backing_store_reply_release(reply);
+}
@@ -0,0 +1,183 @@
+/*
+ * aesd_backing_store.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_BACKING_STORE_H
+#define AESD_BACKING_STORE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "aesd_ioctl.h"
+#include "aesd_history.h"
+#include "aesd_temperaty_buffer.h"
+
+#ifndef USE_AESD_CHAR_DEVICE
+#define USE_AESD_CHAR_DEVICE    1
+#endif
+
+#if USE_AESD_CHAR_DEVICE
+#define AESD_BACKING_STORE_PATH "/dev/aesdchar"
+#else
+#define AESD_BACKING_STORE_PATH "/var/tmp/aesdsocketdata"
+#endif
+
+#define AESD_BACKING_STORE_DEFAULT_BATCH    64
+#define AESD_BACKING_STORE_MAX_BATCH        1024    // IOV_MAX
+#define AESD_BACKING_STORE_PREFIX_MAX       16
+
+enum aesd_backing_store_reply_path
+{
+    AESD_REPLY_PATH_HISTORY,    // versioned in-memory log, regular files only
+    AESD_REPLY_PATH_SENDFILE,   // sendfile() from the file
+    AESD_REPLY_PATH_COPY,       // snapshot copied into memory under the store mutex
+};
+
+/**
+ * A reply in flight. The file backend keeps its history resident in an
+ * append-only in-memory log and only writes the file behind it, so a reply is
+ * just the log version taken right after the append and is streamed without
+ * any lock. The sendfile() path streams the file up to the length it had when
+ * the reply was taken. Anything else (the char device) is snapshotted into
+ * memory under the store mutex, because the driver does not tolerate a read
+ * racing a write.
+ */
+struct aesd_backing_store_reply
+{
+    unsigned char prefix[AESD_BACKING_STORE_PREFIX_MAX];   // sent ahead of the history, e.g. a frame header
+    size_t prefixSize;
+    size_t prefixSent;
+    int fd;                                 // store descriptor (not owned) when streamed from the file, else -1
+    off_t offset;                           // next byte of fd to send
+    off_t end;                              // file length when the reply was taken
+    bool useSendfile;                       // cleared once sendfile() reports it cannot handle fd
+    struct aesd_temperary_buffer buffer;    // snapshot, or staging area of the copy fallback
+    size_t bufferSent;
+    struct aesd_history_cursor history;     // range of the in-memory log to send
+    size_t version;                         // store length the reply ends at
+};
+
+/**
+ * Sets up the in-memory log, fills it with what the file backend already holds
+ * and starts the thread persisting new appends to the file. Backends written
+ * through instead get the group committer. Must run before any other call;
+ * aesd_backing_store_cleanup() flushes the log to the file.
+ */
+bool aesd_backing_store_init(void);
+void aesd_backing_store_cleanup(void);
+
+/**
+ * Makes aesd_backing_store_init() map the log a previous server process hands
+ * over as @param fd instead of loading the file into a new one.
+ */
+void aesd_backing_store_adopt_history(int fd);
+
+/**
+ * Descriptor of the in-memory log to hand over to another server process, -1
+ * when the store keeps none.
+ */
+int aesd_backing_store_history_fd(void);
+
+/**
+ * Selects where replies are served from. AESD_REPLY_PATH_HISTORY (default)
+ * falls back to the snapshot for the char device.
+ */
+void aesd_backing_store_set_reply_path(enum aesd_backing_store_reply_path path);
+
+/**
+ * Tunes the group commit of backends written through (the char device, and
+ * the file unless replies come from the log). Appends from all connections
+ * are queued and written @param maxBatch at a time with one writev(); an
+ * append returns once its batch is written. The committer waits up to
+ * @param windowUs microseconds for a batch to fill, 0 writes whatever queued
+ * up while the previous batch was being written.
+ */
+void aesd_backing_store_set_group_commit(unsigned windowUs, unsigned maxBatch);
+
+/**
+ * Appends @param size bytes of @param data to the backing store and prepares
+ * @param reply to send back the history from byte @param from on (0 for the
+ * whole history). The char device always replies with the whole history.
+ */
+bool aesd_backing_store_append_and_read(const char *data, size_t size, size_t from,
+                                        struct aesd_backing_store_reply *reply);
+
+/**
+ * Prepares @param reply to send the history from byte @param from on without
+ * appending anything.
+ */
+bool aesd_backing_store_read(size_t from, struct aesd_backing_store_reply *reply);
+
+/**
+ * Issues AESDCHAR_IOCSEEKTO with @param command and prepares @param reply to send
+ * everything from the new file position up to the end of the store.
+ */
+bool aesd_backing_store_seek_and_read(const struct aesd_seekto *command, struct aesd_backing_store_reply *reply);
+
+/**
+ * Appends a line produced by the server itself (timestamps).
+ */
+bool aesd_backing_store_append(const char *data, size_t size);
+
+void aesd_backing_store_reply_init(struct aesd_backing_store_reply *reply);
+
+/**
+ * Writes as much of @param reply to the non-blocking @param sockFd as it accepts.
+ * Returns false on a socket or file error.
+ */
+bool aesd_backing_store_reply_send(struct aesd_backing_store_reply *reply, int sockFd);
+bool aesd_backing_store_reply_done(const struct aesd_backing_store_reply *reply);
+
+/**
+ * Number of history bytes @param reply has left to send, not counting the
+ * prefix.
+ */
+size_t aesd_backing_store_reply_length(const struct aesd_backing_store_reply *reply);
+
+/**
+ * Sends @param size bytes of @param data (at most AESD_BACKING_STORE_PREFIX_MAX)
+ * ahead of the history. Must be called before anything of @param reply was
+ * sent; the reply then fails rather than ending short of the length announced.
+ */
+void aesd_backing_store_reply_set_prefix(struct aesd_backing_store_reply *reply, const void *data, size_t size);
+
+/**
+ * Replaces the history @param reply carries with its compressed blocks (see
+ * aesd_compress.h), held in memory like a copied reply. The blocks go into
+ * the storage of @param scratch, which gets back the storage the history was
+ * copied into, reset; the two trade places from one reply to the next. Must be
+ * called before anything of @param reply was sent or a prefix was set.
+ */
+bool aesd_backing_store_reply_compress(struct aesd_backing_store_reply *reply,
+                                       struct aesd_temperary_buffer *scratch);
+
+/**
+ * For callers doing their own I/O: describes up to @param max pieces of what
+ * is left of an in-memory @param reply (history or snapshot, not a file
+ * streamed with sendfile()) in @param iov and returns how many were filled in.
+ * aesd_backing_store_reply_advance() consumes what was transferred.
+ */
+int aesd_backing_store_reply_iovecs(const struct aesd_backing_store_reply *reply, struct iovec *iov, int max);
+void aesd_backing_store_reply_advance(struct aesd_backing_store_reply *reply, size_t size);
+void aesd_backing_store_reply_release(struct aesd_backing_store_reply *reply);
+
+/**
+ * Like aesd_backing_store_reply_init(), but a reply copied out of the store
+ * goes into the storage of @param scratch instead of a fresh allocation.
+ * @param scratch is left empty until aesd_backing_store_reply_recycle().
+ */
+void aesd_backing_store_reply_init_scratch(struct aesd_backing_store_reply *reply,
+                                           struct aesd_temperary_buffer *scratch);
+
+/**
+ * Releases @param reply, handing its copy storage back to @param scratch, reset
+ * rather than freed, when @param scratch holds none.
+ */
+void aesd_backing_store_reply_recycle(struct aesd_backing_store_reply *reply,
+                                      struct aesd_temperary_buffer *scratch);
+
+#endif /* AESD_BACKING_STORE_H */
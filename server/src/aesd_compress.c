@@ -0,0 +1,193 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesd_compress.h"
+#include "aesd_frame.h"
+#include "aesd_history.h"
+#include "aesd_lz.h"
+#include "aesd_metrics.h"
+
+#define CACHE_CHUNK_BLOCKS      1024
+#define CACHE_CHUNKS            (AESD_HISTORY_MAX_SIZE / AESD_COMPRESS_BLOCK_SIZE / CACHE_CHUNK_BLOCKS)
+
+_Static_assert(AESD_COMPRESS_BLOCK_SIZE <= AESD_LZ_MAX_INPUT, "blocks must fit the codec");
+
+/**
+ * A whole block as it goes on the wire, header included.
+ */
+struct cachedBlock
+{
+    size_t size;
+    unsigned char data[];
+};
+
+// Blocks by their index in the history, in chunks allocated on first use.
+// Entries are published once and stay until aesd_compress_cleanup(), so
+// readers copy them without a lock
+typedef _Atomic(struct cachedBlock *) cacheSlot;
+static _Atomic(cacheSlot *) cacheChunks[CACHE_CHUNKS];
+static atomic_size_t cachedBytes;
+
+/**
+ * Appends one block made of the @param size bytes at @param data to @param out.
+ */
+static bool appendBlock(struct aesd_temperary_buffer *out, const char *data, size_t size)
+{
+    unsigned char *block = (unsigned char *)aesd_temperary_buffer_reserve(out, AESD_COMPRESS_BLOCK_HEADER_SIZE +
+                                                                               AESD_LZ_BOUND(size));
+    if (block == NULL)
+    {
+        return false;
+    }
+
+    unsigned char *payload = block + AESD_COMPRESS_BLOCK_HEADER_SIZE;
+    size_t stored = aesd_lz_compress(data, size, payload);
+    uint32_t storedField = (uint32_t)stored;
+    if (stored >= size)
+    {
+        // Incompressible, keep the raw bytes rather than grow them
+        memcpy(payload, data, size);
+        stored = size;
+        storedField = (uint32_t)size | AESD_COMPRESS_STORED;
+    }
+    aesd_frame_put_u32(block, (uint32_t)size);
+    aesd_frame_put_u32(block + sizeof(uint32_t), storedField);
+    aesd_temperary_buffer_commit(out, AESD_COMPRESS_BLOCK_HEADER_SIZE + stored);
+
+    aesd_metrics_add(AESD_METRIC_COMPRESS_BLOCKS, 1);
+    return true;
+}
+
+/**
+ * Slot of block @param index, allocating its chunk if needed; NULL beyond the
+ * largest history or when out of memory.
+ */
+static cacheSlot* cacheSlotFor(size_t index)
+{
+    if (index / CACHE_CHUNK_BLOCKS >= CACHE_CHUNKS)
+    {
+        return NULL;
+    }
+
+    _Atomic(cacheSlot *) *chunkSlot = &cacheChunks[index / CACHE_CHUNK_BLOCKS];
+    cacheSlot *chunk = atomic_load_explicit(chunkSlot, memory_order_acquire);
+    if (chunk == NULL)
+    {
+        cacheSlot *fresh = calloc(CACHE_CHUNK_BLOCKS, sizeof(cacheSlot));
+        if (fresh == NULL)
+        {
+            return NULL;
+        }
+        if (atomic_compare_exchange_strong_explicit(chunkSlot, &chunk, fresh, memory_order_acq_rel,
+                                                    memory_order_acquire))
+        {
+            chunk = fresh;
+        }
+        else
+        {
+            free(fresh);
+        }
+    }
+    return &chunk[index % CACHE_CHUNK_BLOCKS];
+}
+
+/**
+ * Appends whole block @param index, made of the AESD_COMPRESS_BLOCK_SIZE bytes
+ * at @param data, from the cache, compressing and caching it on a miss.
+ */
+static bool appendCachedBlock(struct aesd_temperary_buffer *out, const char *data, size_t index)
+{
+    cacheSlot *slot = cacheSlotFor(index);
+    struct cachedBlock *cached = slot != NULL ? atomic_load_explicit(slot, memory_order_acquire) : NULL;
+
+    if (cached != NULL)
+    {
+        aesd_metrics_add(AESD_METRIC_COMPRESS_CACHE_HITS, 1);
+        return aesd_temperary_buffer_add(out, (const char *)cached->data, cached->size);
+    }
+
+    size_t start = out->size;
+    if (appendBlock(out, data, AESD_COMPRESS_BLOCK_SIZE) == false)
+    {
+        return false;
+    }
+    size_t size = out->size - start;
+    if (slot == NULL || atomic_load_explicit(&cachedBytes, memory_order_relaxed) + size > AESD_COMPRESS_CACHE_MAX)
+    {
+        return true;
+    }
+
+    cached = malloc(sizeof(*cached) + size);
+    if (cached == NULL)
+    {
+        return true;
+    }
+    cached->size = size;
+    memcpy(cached->data, out->buffptr + start, size);
+
+    // Another reply may have compressed the same block meanwhile
+    struct cachedBlock *expected = NULL;
+    if (atomic_compare_exchange_strong_explicit(slot, &expected, cached, memory_order_release, memory_order_relaxed))
+    {
+        atomic_fetch_add_explicit(&cachedBytes, size, memory_order_relaxed);
+    }
+    else
+    {
+        free(cached);
+    }
+    return true;
+}
+
+bool aesd_compress_append(struct aesd_temperary_buffer *out, const char *data, size_t size, size_t offset,
+                          bool cacheable)
+{
+    size_t before = out->size;
+
+    aesd_metrics_add(AESD_METRIC_COMPRESS_IN, size);
+    while (size > 0)
+    {
+        size_t blockOffset = offset % AESD_COMPRESS_BLOCK_SIZE;
+        size_t length = AESD_COMPRESS_BLOCK_SIZE - blockOffset;
+        bool result;
+
+        length = length < size ? length : size;
+        if (cacheable && length == AESD_COMPRESS_BLOCK_SIZE)
+        {
+            result = appendCachedBlock(out, data, offset / AESD_COMPRESS_BLOCK_SIZE);
+        }
+        else
+        {
+            // The part of a block before a delta starts or after the history ends
+            result = appendBlock(out, data, length);
+        }
+        if (result == false)
+        {
+            return false;
+        }
+        data += length;
+        offset += length;
+        size -= length;
+    }
+    aesd_metrics_add(AESD_METRIC_COMPRESS_OUT, out->size - before);
+    return true;
+}
+
+void aesd_compress_cleanup(void)
+{
+    for (size_t i = 0; i < CACHE_CHUNKS; i++)
+    {
+        cacheSlot *chunk = atomic_exchange(&cacheChunks[i], NULL);
+        if (chunk == NULL)
+        {
+            continue;
+        }
+        for (size_t j = 0; j < CACHE_CHUNK_BLOCKS; j++)
+        {
+            free(atomic_load_explicit(&chunk[j], memory_order_relaxed));
+        }
+        free(chunk);
+    }
+    atomic_store(&cachedBytes, 0);
+}
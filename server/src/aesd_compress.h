@@ -0,0 +1,53 @@
+/*
+ * aesd_compress.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_COMPRESS_H
+#define AESD_COMPRESS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "aesd_temperaty_buffer.h"
+
+/**
+ * Compressed replies, which a connection asks for with "AESDCHAR_COMPRESS:1"
+ * or an AESD_FRAME_COMPRESS frame. The history a reply carries is cut into
+ * blocks of at most AESD_COMPRESS_BLOCK_SIZE bytes, each compressed on its own
+ * with aesd_lz and sent as:
+ *   uint32_t rawLength     bytes the block decompresses to
+ *   uint32_t storedLength  payload bytes following, AESD_COMPRESS_STORED set
+ *                          when the payload is the raw bytes themselves
+ * Both fields are in network byte order. On newline framing every reply starts
+ * with AESD_COMPRESS_HEADER_SIZE bytes, the uint32_t length of the history it
+ * carries and the uint32_t length of the blocks behind it; frames carry the
+ * blocks as their payload with AESD_FRAME_FLAG_COMPRESSED set.
+ *
+ * Blocks are cut at fixed offsets of the file backend's history, which never
+ * changes below its end, so a whole block is compressed once and every later
+ * reply copies it from a cache.
+ */
+#define AESD_COMPRESS_BLOCK_SIZE        (32 * 1024)
+#define AESD_COMPRESS_BLOCK_HEADER_SIZE 8
+#define AESD_COMPRESS_HEADER_SIZE       8
+#define AESD_COMPRESS_STORED            0x80000000u
+#define AESD_COMPRESS_CACHE_MAX         (64 * 1024 * 1024)  // compressed bytes kept at most
+
+/**
+ * Appends the blocks of the @param size bytes at @param data to @param out.
+ * @param offset is where @param data starts in the store; with @param
+ * cacheable the bytes at an offset never change, so whole blocks come from
+ * the cache. Returns false when out of memory.
+ */
+bool aesd_compress_append(struct aesd_temperary_buffer *out, const char *data, size_t size, size_t offset,
+                          bool cacheable);
+
+/**
+ * Drops the cached blocks; nothing may be compressing any more.
+ */
+void aesd_compress_cleanup(void);
+
+#endif /* AESD_COMPRESS_H */
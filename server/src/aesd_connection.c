@@ -0,0 +1,1063 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "aesd_backing_store.h"
+#include "aesd_compress.h"
+#include "aesd_connection.h"
+#include "aesd_frame.h"
+#include "aesd_log.h"
+#include "aesd_metrics.h"
+#include "aesd_slab.h"
+#include "aesd_tuning.h"
+
+#define BUFFER_SIZE             512
+#define IDLE_CHECK_MIN_MS       10
+#define IDLE_CHECK_MAX_MS       1000
+
+static size_t highWater = AESD_CONNECTION_DEFAULT_HIGH_WATER;
+static uint64_t idleTimeoutNs = 0;
+static size_t maxPacket = 0;
+
+// Connections and their queue entries are carved from slabs instead of the heap
+static struct aesd_slab connectionSlab = AESD_SLAB_INITIALIZER(sizeof(struct aesd_connection), 64);
+static struct aesd_slab replySlab = AESD_SLAB_INITIALIZER(sizeof(struct aesd_connection_reply), 256);
+
+static void formatClientName(const struct sockaddr *clientAddr, socklen_t clientLen, char *name);
+static bool parseDecimal(const char **cursor, const char *end, uint32_t *value);
+static bool negotiateFraming(struct aesd_connection *connection);
+static bool packetTooLong(struct aesd_connection *connection, size_t size);
+static bool nextPacket(struct aesd_connection *connection, const char **packet, size_t *size);
+static bool nextFrame(struct aesd_connection *connection, struct aesd_frame_header *header, const char **payload);
+static size_t pendingFrameBytes(const struct aesd_connection *connection);
+static void compactPackets(struct aesd_connection *connection);
+static enum aesd_connection_state processPendingPackets(struct aesd_connection *connection, bool sendReplies);
+static enum aesd_connection_state sendReply(struct aesd_connection *connection);
+static void queueReply(struct aesd_connection *connection, struct aesd_backing_store_reply *reply);
+static void nextReply(struct aesd_connection *connection);
+static bool processPacket(struct aesd_connection *connection, const char *packet, size_t size,
+                          struct aesd_backing_store_reply *reply);
+static bool processFrame(struct aesd_connection *connection, const struct aesd_frame_header *header,
+                         const char *payload, struct aesd_backing_store_reply *reply);
+static bool compressReply(struct aesd_connection *connection, struct aesd_backing_store_reply *reply);
+
+bool checkForNullCharInString(const char *str, const ssize_t len)
+{
+    if (str == NULL || len <= 0)
+    {
+        AESD_LOG(LOG_WARNING, "Received NULL string or invalid length");
+        return true;
+    }
+    const char *nullChar = memchr(str, '\0', len);
+    if (nullChar != NULL)
+    {
+        AESD_LOG(LOG_WARNING, "String contains null character at position %td", nullChar - str);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Parses the decimal number at @param *cursor without reading past @param end
+ * and moves @param *cursor behind it. Fails when there is no digit or the value
+ * does not fit in 32 bits.
+ */
+static bool parseDecimal(const char **cursor, const char *end, uint32_t *value)
+{
+    const char *position = *cursor;
+    uint64_t result = 0;
+
+    while (position < end && *position >= '0' && *position <= '9')
+    {
+        result = result * 10 + (uint64_t)(*position - '0');
+        if (result > UINT32_MAX)
+        {
+            return false;
+        }
+        position++;
+    }
+
+    if (position == *cursor)
+    {
+        return false;
+    }
+
+    *value = (uint32_t)result;
+    *cursor = position;
+    return true;
+}
+
+/**
+ * Recognises a whole "AESDCHAR_IOCSEEKTO:x,y" line in the @param size bytes at
+ * @param buffer, which need not be NUL terminated. Every byte is looked at
+ * once, so pipelined lines cost time linear in what was received.
+ */
+bool checkForCommandInString(const char *buffer, size_t size, struct aesd_seekto *command)
+{
+    if (buffer == NULL || size == 0)
+    {
+        AESD_LOG(LOG_WARNING, "Received NULL string or invalid length");
+        return false;
+    }
+
+    const size_t prefixLen = sizeof(SEEK_CMD_PREFIX) - 1;
+
+    if (size < prefixLen || memcmp(buffer, SEEK_CMD_PREFIX, prefixLen) != 0)
+    {
+        return false;
+    }
+
+    const char *cursor = buffer + prefixLen;
+    const char *end = buffer + size;
+
+    // Tolerate the line terminator the client used
+    if (end > cursor && end[-1] == '\n')
+    {
+        end--;
+    }
+    if (end > cursor && end[-1] == '\r')
+    {
+        end--;
+    }
+
+    uint32_t commandValue;
+    if (parseDecimal(&cursor, end, &commandValue) == false)
+    {
+        AESD_LOG(LOG_WARNING, "Invalid command format");
+        return false;
+    }
+
+    if (cursor == end || *cursor != ',')
+    {
+        AESD_LOG(LOG_WARNING, "Command second argument not found in string");
+        return false;
+    }
+    cursor++; // Move past the comma
+
+    uint32_t offsetValue;
+    if (parseDecimal(&cursor, end, &offsetValue) == false || cursor != end)
+    {
+        AESD_LOG(LOG_WARNING, "Invalid offset format");
+        return false;
+    }
+
+    command->write_cmd = commandValue;
+    command->write_cmd_offset = offsetValue;
+
+    AESD_LOG(LOG_DEBUG, "Command found: write_cmd=%u, write_cmd_offset=%u", commandValue, offsetValue);
+
+    return true;
+}
+
+/**
+ * Recognises a "<@param prefix>0" or "<@param prefix>1" line switching a reply
+ * mode named @param mode in the logs.
+ */
+static bool checkForSwitchCommand(const char *buffer, size_t size, const char *prefix, const char *mode,
+                                  bool *enabled)
+{
+    const size_t prefixLen = strlen(prefix);
+
+    if (buffer == NULL || size <= prefixLen || memcmp(buffer, prefix, prefixLen) != 0)
+    {
+        return false;
+    }
+
+    // Tolerate the line terminator the client used, nothing else may follow
+    if (size > prefixLen && buffer[size - 1] == '\n')
+    {
+        size--;
+    }
+    if (size > prefixLen && buffer[size - 1] == '\r')
+    {
+        size--;
+    }
+    if (size != prefixLen + 1 || (buffer[prefixLen] != '0' && buffer[prefixLen] != '1'))
+    {
+        AESD_LOG(LOG_WARNING, "Invalid %s command argument", mode);
+        return false;
+    }
+
+    *enabled = buffer[prefixLen] == '1';
+    AESD_LOG(LOG_DEBUG, "Command found: %s replies %s", mode, *enabled ? "on" : "off");
+
+    return true;
+}
+
+bool checkForDeltaCommandInString(const char *buffer, size_t size, bool *enabled)
+{
+    return checkForSwitchCommand(buffer, size, DELTA_CMD_PREFIX, "delta", enabled);
+}
+
+bool checkForCompressCommandInString(const char *buffer, size_t size, bool *enabled)
+{
+    return checkForSwitchCommand(buffer, size, COMPRESS_CMD_PREFIX, "compressed", enabled);
+}
+
+void aesd_connection_set_high_water(size_t bytes)
+{
+    highWater = bytes;
+}
+
+void aesd_connection_set_idle_timeout(unsigned ms)
+{
+    idleTimeoutNs = (uint64_t)ms * 1000000ull;
+}
+
+void aesd_connection_set_max_packet(size_t bytes)
+{
+    maxPacket = bytes;
+}
+
+int aesd_connection_idle_check_interval(void)
+{
+    if (idleTimeoutNs == 0)
+    {
+        return -1;
+    }
+    // A connection outlives the timeout by at most a quarter of it
+    uint64_t ms = idleTimeoutNs / 4000000ull;
+    return ms < IDLE_CHECK_MIN_MS ? IDLE_CHECK_MIN_MS : ms > IDLE_CHECK_MAX_MS ? IDLE_CHECK_MAX_MS : (int)ms;
+}
+
+int aesd_connection_idle_wait_ms(const struct aesd_connection *connection, uint64_t nowNs)
+{
+    if (idleTimeoutNs == 0)
+    {
+        return -1;
+    }
+    uint64_t deadline = connection->activeAtNs + idleTimeoutNs;
+    return nowNs >= deadline ? 0 : (int)((deadline - nowNs + 999999) / 1000000);
+}
+
+enum aesd_connection_state aesd_connection_check_idle(struct aesd_connection *connection, uint64_t nowNs)
+{
+    if (idleTimeoutNs == 0 || connection->state == AESD_CONNECTION_CLOSED ||
+        nowNs < connection->activeAtNs + idleTimeoutNs)
+    {
+        return connection->state;
+    }
+
+    AESD_LOG(LOG_INFO, "Closing idle connection from %s", connection->clientName);
+    aesd_metrics_add(AESD_METRIC_IDLE_TIMEOUTS, 1);
+    connection->state = AESD_CONNECTION_CLOSED;
+    return connection->state;
+}
+
+/**
+ * Writes the peer address into @param name with inet_ntop(), which unlike
+ * inet_ntoa() keeps no static buffer. IPv4 clients of the dual-stack listener
+ * show up as plain IPv4 addresses.
+ */
+static void formatClientName(const struct sockaddr *clientAddr, socklen_t clientLen, char *name)
+{
+    sa_family_t family = clientLen >= sizeof(sa_family_t) ? clientAddr->sa_family : AF_UNSPEC;
+
+    if (family == AF_INET)
+    {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)clientAddr)->sin_addr, name, AESD_CONNECTION_NAME_SIZE);
+    }
+    else if (family == AF_INET6)
+    {
+        const struct in6_addr *addr = &((const struct sockaddr_in6 *)clientAddr)->sin6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(addr))
+        {
+            inet_ntop(AF_INET, &addr->s6_addr[12], name, AESD_CONNECTION_NAME_SIZE);
+        }
+        else
+        {
+            inet_ntop(AF_INET6, addr, name, AESD_CONNECTION_NAME_SIZE);
+        }
+    }
+    else if (family == AF_UNIX)
+    {
+        strcpy(name, "unix socket");
+    }
+    else
+    {
+        strcpy(name, "unknown");
+    }
+}
+
+bool aesd_connection_reserve(size_t count)
+{
+    return aesd_slab_reserve(&connectionSlab, count);
+}
+
+struct aesd_connection* aesd_connection_create(int sockFd, const struct sockaddr *clientAddr, socklen_t clientLen)
+{
+    struct aesd_admission_source source;
+    if (aesd_admission_admit(clientAddr, clientLen, &source) == false)
+    {
+        // A reset tells the client at once and leaves no TIME_WAIT behind
+        struct linger reset = { .l_onoff = 1, .l_linger = 0 };
+        setsockopt(sockFd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        errno = ECONNREFUSED;
+        return NULL;
+    }
+
+    struct aesd_connection *connection = aesd_slab_alloc(&connectionSlab);
+    if (connection == NULL)
+    {
+        aesd_admission_release(&source);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(connection, 0, sizeof(*connection));
+
+    connection->sockFd = sockFd;
+    connection->source = source;
+    formatClientName(clientAddr, clientLen, connection->clientName);
+    sa_family_t family = clientLen >= sizeof(sa_family_t) ? clientAddr->sa_family : AF_UNSPEC;
+    connection->tcp = family == AF_INET || family == AF_INET6;
+    aesd_tuning_apply_connection(sockFd, family);
+    AESD_LOG(LOG_INFO, "Accepted connection from %s, fd %d", connection->clientName, sockFd);
+    connection->state = AESD_CONNECTION_RECEIVING;
+    connection->acceptedAtNs = aesd_metrics_now_ns();
+    connection->activeAtNs = connection->acceptedAtNs;
+    aesd_metrics_add(AESD_METRIC_ACCEPTS, 1);
+
+    aesd_temperary_buffer_init(&connection->bufferString);
+    aesd_temperary_buffer_init(&connection->scratch);
+    aesd_temperary_buffer_init(&connection->compressScratch);
+    aesd_backing_store_reply_init(&connection->reply);
+
+    return connection;
+}
+
+void aesd_connection_destroy(struct aesd_connection *connection)
+{
+    if (connection == NULL)
+    {
+        return;
+    }
+    aesd_temperary_buffer_clean(&connection->bufferString);
+    aesd_temperary_buffer_clean(&connection->scratch);
+    aesd_temperary_buffer_clean(&connection->compressScratch);
+    aesd_backing_store_reply_release(&connection->reply);
+    while (connection->queueHead != NULL)
+    {
+        struct aesd_connection_reply *queued = connection->queueHead;
+        connection->queueHead = queued->next;
+        aesd_backing_store_reply_release(&queued->reply);
+        aesd_slab_free(&replySlab, queued);
+    }
+    while (connection->spareReplies != NULL)
+    {
+        struct aesd_connection_reply *spare = connection->spareReplies;
+        connection->spareReplies = spare->next;
+        aesd_slab_free(&replySlab, spare);
+    }
+    if (connection->sockFd > 0)
+    {
+        close(connection->sockFd);
+    }
+    aesd_admission_release(&connection->source);
+    aesd_slab_free(&connectionSlab, connection);
+    aesd_metrics_add(AESD_METRIC_CLOSES, 1);
+}
+
+void aesd_connection_cleanup(void)
+{
+    aesd_slab_destroy(&replySlab);
+    aesd_slab_destroy(&connectionSlab);
+    aesd_admission_cleanup();
+}
+
+enum aesd_connection_state aesd_connection_on_readable(struct aesd_connection *connection)
+{
+    struct aesd_temperary_buffer *bufferString = &connection->bufferString;
+
+    if (aesd_connection_wants_read(connection) == false)
+    {
+        return connection->state;
+    }
+
+    compactPackets(connection);
+
+    // Receive straight into the packet buffer; it grows geometrically and keeps
+    // its storage between packets, so a large packet costs amortized O(n). A
+    // frame announces its length, so room for all of it is made up front
+    size_t wanted = pendingFrameBytes(connection);
+    char *buffer = aesd_temperary_buffer_reserve(bufferString, wanted > BUFFER_SIZE ? wanted : BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        AESD_LOG(LOG_ERR, "Failed to grow temporary buffer");
+        connection->state = AESD_CONNECTION_CLOSED;
+        return connection->state;
+    }
+
+    size_t room = bufferString->capacity - bufferString->size;
+    ssize_t recvLen = recv(connection->sockFd, buffer, room, 0);
+    if (recvLen < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            return connection->state;
+        }
+        AESD_LOG(LOG_ERR, "Failed to receive data from %s: %s", connection->clientName, strerror(errno));
+        connection->state = AESD_CONNECTION_CLOSED;
+        return connection->state;
+    }
+    else if (recvLen == 0)
+    {
+        AESD_LOG(LOG_INFO, "Closed connection from %s", connection->clientName);
+        connection->state = AESD_CONNECTION_CLOSED;
+        return connection->state;
+    }
+    aesd_temperary_buffer_commit(bufferString, recvLen);
+    connection->receivedAtNs = aesd_metrics_now_ns();
+    connection->activeAtNs = connection->receivedAtNs;
+    aesd_metrics_add(AESD_METRIC_BYTES_IN, recvLen);
+
+    AESD_LOG(LOG_DEBUG, "Received %zd bytes from %s", recvLen, connection->clientName);
+
+    if (connection->framing != AESD_FRAMING_FRAMES && checkForNullCharInString(buffer, recvLen))
+    {
+        AESD_LOG(LOG_DEBUG, "Received data contains null character");
+    }
+
+    return processPendingPackets(connection, true);
+}
+
+enum aesd_connection_state aesd_connection_on_received(struct aesd_connection *connection, const char *data, size_t size)
+{
+    if (connection->state == AESD_CONNECTION_CLOSED)
+    {
+        return connection->state;
+    }
+
+    compactPackets(connection);
+    if (aesd_temperary_buffer_add(&connection->bufferString, data, size) == false)
+    {
+        AESD_LOG(LOG_ERR, "Failed to grow temporary buffer");
+        connection->state = AESD_CONNECTION_CLOSED;
+        return connection->state;
+    }
+    connection->receivedAtNs = aesd_metrics_now_ns();
+    connection->activeAtNs = connection->receivedAtNs;
+    aesd_metrics_add(AESD_METRIC_BYTES_IN, size);
+
+    AESD_LOG(LOG_DEBUG, "Received %zu bytes from %s", size, connection->clientName);
+
+    if (connection->framing != AESD_FRAMING_FRAMES && checkForNullCharInString(data, size))
+    {
+        AESD_LOG(LOG_DEBUG, "Received data contains null character");
+    }
+
+    // Bytes arriving past the high-water mark wait for the queue to drain
+    return processPendingPackets(connection, false);
+}
+
+enum aesd_connection_state aesd_connection_on_sent(struct aesd_connection *connection, size_t size)
+{
+    if (connection->state != AESD_CONNECTION_REPLYING)
+    {
+        return connection->state;
+    }
+
+    aesd_backing_store_reply_advance(&connection->reply, size);
+    aesd_metrics_add(AESD_METRIC_BYTES_OUT, size);
+    if (size > 0)
+    {
+        connection->activeAtNs = aesd_metrics_now_ns();
+    }
+    if (aesd_backing_store_reply_done(&connection->reply) == false)
+    {
+        return connection->state;
+    }
+
+    nextReply(connection);
+    return processPendingPackets(connection, false);
+}
+
+enum aesd_connection_state aesd_connection_on_writable(struct aesd_connection *connection)
+{
+    if (connection->state != AESD_CONNECTION_REPLYING)
+    {
+        return connection->state;
+    }
+
+    if (sendReply(connection) == AESD_CONNECTION_CLOSED)
+    {
+        return connection->state;
+    }
+    // Packets left waiting while the queue was at its high-water mark
+    return processPendingPackets(connection, true);
+}
+
+/**
+ * Bytes @param reply still has to send, its prefix included.
+ */
+static size_t replyRemaining(const struct aesd_backing_store_reply *reply)
+{
+    return reply->prefixSize - reply->prefixSent + aesd_backing_store_reply_length(reply);
+}
+
+bool aesd_connection_wants_read(const struct aesd_connection *connection)
+{
+    if (connection->state != AESD_CONNECTION_REPLYING)
+    {
+        return connection->state == AESD_CONNECTION_RECEIVING;
+    }
+    return connection->queuedReplies < AESD_CONNECTION_MAX_QUEUED_REPLIES &&
+           connection->queuedBytes + replyRemaining(&connection->reply) < highWater;
+}
+
+/**
+ * Picks the framing from the first bytes of the connection: AESD_FRAME_MAGIC
+ * switches to frames, anything else keeps newline framing. Returns false while
+ * too few bytes arrived to tell.
+ */
+static bool negotiateFraming(struct aesd_connection *connection)
+{
+    struct aesd_temperary_buffer *bufferString = &connection->bufferString;
+
+    if (connection->framing != AESD_FRAMING_UNKNOWN)
+    {
+        return true;
+    }
+
+    size_t available = bufferString->size - connection->packetStart;
+    size_t compared = available < AESD_FRAME_MAGIC_SIZE ? available : AESD_FRAME_MAGIC_SIZE;
+    if (compared == 0)
+    {
+        return false;
+    }
+    if (memcmp(bufferString->buffptr + connection->packetStart, AESD_FRAME_MAGIC, compared) != 0)
+    {
+        connection->framing = AESD_FRAMING_LINES;
+        return true;
+    }
+    if (compared < AESD_FRAME_MAGIC_SIZE)
+    {
+        return false;
+    }
+
+    AESD_LOG(LOG_DEBUG, "Framed protocol selected by %s", connection->clientName);
+    connection->framing = AESD_FRAMING_FRAMES;
+    connection->packetStart += AESD_FRAME_MAGIC_SIZE;
+    connection->packetScanned = connection->packetStart;
+    return true;
+}
+
+/**
+ * Closes @param connection when a packet or frame payload of @param size bytes
+ * is over the configured limit.
+ */
+static bool packetTooLong(struct aesd_connection *connection, size_t size)
+{
+    if (maxPacket == 0 || size <= maxPacket)
+    {
+        return false;
+    }
+    AESD_LOG(LOG_WARNING, "Packet of %zu bytes from %s is over the %zu byte limit", size,
+             connection->clientName, maxPacket);
+    aesd_metrics_add(AESD_METRIC_OVERSIZED, 1);
+    connection->state = AESD_CONNECTION_CLOSED;
+    return true;
+}
+
+/**
+ * Takes the next complete frame off the buffer. A frame longer than
+ * AESD_FRAME_MAX_PAYLOAD or the packet limit closes the connection.
+ */
+static bool nextFrame(struct aesd_connection *connection, struct aesd_frame_header *header, const char **payload)
+{
+    struct aesd_temperary_buffer *bufferString = &connection->bufferString;
+    size_t available = bufferString->size - connection->packetStart;
+
+    if (available < AESD_FRAME_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    aesd_frame_decode((const unsigned char *)bufferString->buffptr + connection->packetStart, header);
+    if (header->length > AESD_FRAME_MAX_PAYLOAD)
+    {
+        AESD_LOG(LOG_WARNING, "Frame of %u bytes from %s is too long", header->length, connection->clientName);
+        connection->state = AESD_CONNECTION_CLOSED;
+        return false;
+    }
+    if (packetTooLong(connection, header->length))
+    {
+        return false;
+    }
+    if (available - AESD_FRAME_HEADER_SIZE < header->length)
+    {
+        return false;
+    }
+
+    *payload = bufferString->buffptr + connection->packetStart + AESD_FRAME_HEADER_SIZE;
+    connection->packetStart += AESD_FRAME_HEADER_SIZE + header->length;
+    connection->packetScanned = connection->packetStart;
+    return true;
+}
+
+/**
+ * Bytes still missing from the frame at the front of the buffer, 0 when its
+ * header has not arrived yet.
+ */
+static size_t pendingFrameBytes(const struct aesd_connection *connection)
+{
+    const struct aesd_temperary_buffer *bufferString = &connection->bufferString;
+    size_t available = bufferString->size - connection->packetStart;
+
+    if (connection->framing != AESD_FRAMING_FRAMES || available < AESD_FRAME_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    uint32_t length = aesd_frame_get_u32((const unsigned char *)bufferString->buffptr + connection->packetStart);
+    if (length > AESD_FRAME_MAX_PAYLOAD || (maxPacket > 0 && length > maxPacket) ||
+        available - AESD_FRAME_HEADER_SIZE >= length)
+    {
+        return 0;
+    }
+    return AESD_FRAME_HEADER_SIZE + length - available;
+}
+
+static bool nextPacket(struct aesd_connection *connection, const char **packet, size_t *size)
+{
+    struct aesd_temperary_buffer *bufferString = &connection->bufferString;
+
+    if (connection->packetScanned >= bufferString->size)
+    {
+        return false;
+    }
+
+    // Bytes before packetScanned were already searched for the terminator
+    const char *newline = memchr(bufferString->buffptr + connection->packetScanned, '\n',
+                                 bufferString->size - connection->packetScanned);
+    if (newline == NULL)
+    {
+        // A line already over the limit cannot get shorter; close it before it grows
+        connection->packetScanned = bufferString->size;
+        packetTooLong(connection, bufferString->size - connection->packetStart);
+        return false;
+    }
+
+    size_t end = newline - bufferString->buffptr + 1;
+    if (packetTooLong(connection, end - connection->packetStart))
+    {
+        return false;
+    }
+    *packet = bufferString->buffptr + connection->packetStart;
+    *size = end - connection->packetStart;
+    connection->packetStart = end;
+    connection->packetScanned = end;
+    return true;
+}
+
+static void compactPackets(struct aesd_connection *connection)
+{
+    struct aesd_temperary_buffer *bufferString = &connection->bufferString;
+
+    if (connection->packetStart == 0)
+    {
+        return;
+    }
+
+    if (connection->packetStart == bufferString->size)
+    {
+        aesd_temperary_buffer_reset(bufferString);
+    }
+    else
+    {
+        // Move the partial packet to the front, once per receive batch
+        size_t remaining = bufferString->size - connection->packetStart;
+        memmove(bufferString->buffptr, bufferString->buffptr + connection->packetStart, remaining);
+        bufferString->size = remaining;
+    }
+    connection->packetScanned -= connection->packetStart;
+    connection->packetStart = 0;
+}
+
+/**
+ * Handles complete packets and queues their replies until the output queue
+ * reaches the high-water mark. With @param sendReplies the queue is written to
+ * the socket as it grows; without, the caller sends the head reply and reports
+ * progress through aesd_connection_on_sent().
+ */
+static enum aesd_connection_state processPendingPackets(struct aesd_connection *connection, bool sendReplies)
+{
+    const char *packet;
+    size_t size;
+    struct aesd_frame_header header;
+    bool socketFull = false;
+
+    while (aesd_connection_wants_read(connection) && negotiateFraming(connection))
+    {
+        struct aesd_backing_store_reply reply;
+        bool frames = connection->framing == AESD_FRAMING_FRAMES;
+
+        if (frames ? nextFrame(connection, &header, &packet) == false
+                   : nextPacket(connection, &packet, &size) == false)
+        {
+            break;
+        }
+        aesd_backing_store_reply_init_scratch(&reply, &connection->scratch);
+        bool replied = frames ? processFrame(connection, &header, packet, &reply)
+                              : processPacket(connection, packet, size, &reply);
+
+        if (replied == false)
+        {
+            aesd_backing_store_reply_recycle(&reply, &connection->scratch);
+            continue;
+        }
+        queueReply(connection, &reply);
+
+        // Once the socket is full the rest waits for writability
+        if (sendReplies && socketFull == false && connection->state == AESD_CONNECTION_REPLYING)
+        {
+            socketFull = sendReply(connection) == AESD_CONNECTION_REPLYING;
+        }
+    }
+
+    if (connection->state != AESD_CONNECTION_CLOSED)
+    {
+        compactPackets(connection);
+    }
+    return connection->state;
+}
+
+/**
+ * Appends @param reply to the output queue, taking over what it holds.
+ */
+static void queueReply(struct aesd_connection *connection, struct aesd_backing_store_reply *reply)
+{
+    if (aesd_backing_store_reply_done(reply))
+    {
+        // Nothing to send, e.g. a delta reply with no new bytes
+        aesd_backing_store_reply_recycle(reply, &connection->scratch);
+        return;
+    }
+    aesd_metrics_observe(AESD_METRIC_REPLY_SIZE, replyRemaining(reply));
+
+    if (connection->state == AESD_CONNECTION_RECEIVING)
+    {
+        connection->reply = *reply;
+        connection->replyReceivedAtNs = connection->receivedAtNs;
+        connection->state = AESD_CONNECTION_REPLYING;
+        return;
+    }
+
+    struct aesd_connection_reply *queued = connection->spareReplies;
+    if (queued != NULL)
+    {
+        connection->spareReplies = queued->next;
+    }
+    else
+    {
+        queued = aesd_slab_alloc(&replySlab);
+    }
+    if (queued == NULL)
+    {
+        AESD_LOG(LOG_ERR, "Failed to queue reply for %s", connection->clientName);
+        aesd_backing_store_reply_recycle(reply, &connection->scratch);
+        connection->state = AESD_CONNECTION_CLOSED;
+        return;
+    }
+    queued->reply = *reply;
+    queued->length = replyRemaining(reply);
+    queued->receivedAtNs = connection->receivedAtNs;
+    queued->next = NULL;
+    if (connection->queueTail != NULL)
+    {
+        connection->queueTail->next = queued;
+    }
+    else
+    {
+        connection->queueHead = queued;
+    }
+    connection->queueTail = queued;
+    connection->queuedBytes += queued->length;
+    connection->queuedReplies++;
+}
+
+/**
+ * Drops the fully sent head reply and moves the next queued one up.
+ */
+static void nextReply(struct aesd_connection *connection)
+{
+    aesd_metrics_observe(AESD_METRIC_PACKET_LATENCY, aesd_metrics_now_ns() - connection->replyReceivedAtNs);
+    aesd_backing_store_reply_recycle(&connection->reply, &connection->scratch);
+
+    struct aesd_connection_reply *queued = connection->queueHead;
+    if (queued == NULL)
+    {
+        connection->state = AESD_CONNECTION_RECEIVING;
+        return;
+    }
+
+    connection->queueHead = queued->next;
+    if (connection->queueHead == NULL)
+    {
+        connection->queueTail = NULL;
+    }
+    connection->queuedBytes -= queued->length;
+    connection->queuedReplies--;
+    connection->reply = queued->reply;
+    connection->replyReceivedAtNs = queued->receivedAtNs;
+    queued->next = connection->spareReplies;
+    connection->spareReplies = queued;
+}
+
+static enum aesd_connection_state sendReply(struct aesd_connection *connection)
+{
+    // Several replies, or one read from the file in pieces, leave in full
+    // segments; only the last one is pushed out short
+    bool corked = connection->tcp && aesd_tuning_corks() &&
+                  (connection->queuedReplies > 0 || connection->reply.fd >= 0);
+    if (corked)
+    {
+        aesd_tuning_cork(connection->sockFd, true);
+    }
+
+    while (connection->state == AESD_CONNECTION_REPLYING)
+    {
+        size_t before = replyRemaining(&connection->reply);
+        if (aesd_backing_store_reply_send(&connection->reply, connection->sockFd) == false)
+        {
+            AESD_LOG(LOG_ERR, "Failed to send reply to %s: %s", connection->clientName, strerror(errno));
+            connection->state = AESD_CONNECTION_CLOSED;
+            break;
+        }
+
+        bool done = aesd_backing_store_reply_done(&connection->reply);
+        size_t sent = done ? before : before - replyRemaining(&connection->reply);
+        aesd_metrics_add(AESD_METRIC_BYTES_OUT, sent);
+        if (sent > 0)
+        {
+            connection->activeAtNs = aesd_metrics_now_ns();
+        }
+        if (done == false)
+        {
+            break;
+        }
+        nextReply(connection);
+    }
+
+    if (corked && connection->state != AESD_CONNECTION_CLOSED)
+    {
+        aesd_tuning_cork(connection->sockFd, false);
+    }
+    return connection->state;
+}
+
+/**
+ * Handles one newline-terminated packet and prepares its answer in @param reply.
+ * Returns false when the packet failed, which closes the connection.
+ */
+static bool processPacket(struct aesd_connection *connection, const char *packet, size_t size,
+                          struct aesd_backing_store_reply *reply)
+{
+    struct aesd_seekto command = {0};
+    bool deltaEnabled;
+    bool compressEnabled;
+    bool result;
+
+    connection->packetCount++;
+    aesd_metrics_add(AESD_METRIC_PACKETS, 1);
+    if (checkForCommandInString(packet, size, &command) == true)
+    {
+        result = aesd_backing_store_seek_and_read(&command, reply);
+    }
+    else if (checkForDeltaCommandInString(packet, size, &deltaEnabled) == true)
+    {
+        // Answered with everything the client has not seen in the new mode, so
+        // switching delta replies on starts from a full copy of the history
+        size_t from = deltaEnabled && connection->deltaReplies ? connection->lastSent : 0;
+        connection->deltaReplies = deltaEnabled;
+        result = aesd_backing_store_read(from, reply);
+    }
+    else if (checkForCompressCommandInString(packet, size, &compressEnabled) == true)
+    {
+        // Answered like a read, already in the new mode
+        size_t from = connection->deltaReplies ? connection->lastSent : 0;
+        connection->compressReplies = compressEnabled;
+        result = aesd_backing_store_read(from, reply);
+    }
+    else
+    {
+        AESD_LOG(LOG_DEBUG, "Writing to file (byte %zu): %.*s", size, (int)(size - 1), packet);
+
+        size_t from = connection->deltaReplies ? connection->lastSent : 0;
+        result = aesd_backing_store_append_and_read(packet, size, from, reply);
+    }
+
+    if (result == false || (connection->compressReplies && compressReply(connection, reply) == false))
+    {
+        connection->state = AESD_CONNECTION_CLOSED;
+        return false;
+    }
+    connection->lastSent = reply->version;
+    return true;
+}
+
+static bool frameLengthValid(const struct aesd_frame_header *header)
+{
+    switch (header->opcode)
+    {
+    case AESD_FRAME_WRITE:
+        return header->length > 0;
+    case AESD_FRAME_READ:
+        return header->length == 0;
+    case AESD_FRAME_SEEK:
+        return header->length == 2 * sizeof(uint32_t);
+    case AESD_FRAME_DELTA:
+    case AESD_FRAME_COMPRESS:
+        return header->length == 1;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Handles one frame and prepares its answer, header included, in @param reply.
+ * Returns false when no reply is due, because the frame asked for none or
+ * failed and closed the connection.
+ */
+static bool processFrame(struct aesd_connection *connection, const struct aesd_frame_header *header,
+                         const char *payload, struct aesd_backing_store_reply *reply)
+{
+    const bool replyWanted = (header->flags & AESD_FRAME_FLAG_NO_REPLY) == 0;
+    size_t from = connection->deltaReplies ? connection->lastSent : 0;
+    bool result = true;
+
+    connection->packetCount++;
+    aesd_metrics_add(AESD_METRIC_PACKETS, 1);
+    if (frameLengthValid(header) == false)
+    {
+        AESD_LOG(LOG_WARNING, "Invalid frame (opcode %u, %u bytes) from %s", header->opcode, header->length,
+                 connection->clientName);
+        connection->state = AESD_CONNECTION_CLOSED;
+        return false;
+    }
+
+    switch (header->opcode)
+    {
+    case AESD_FRAME_WRITE:
+        AESD_LOG(LOG_DEBUG, "Writing frame to file (byte %u)", header->length);
+        if (replyWanted)
+        {
+            result = aesd_backing_store_append_and_read(payload, header->length, from, reply);
+        }
+        else
+        {
+            result = aesd_backing_store_append(payload, header->length);
+        }
+        break;
+
+    case AESD_FRAME_READ:
+        result = replyWanted == false || aesd_backing_store_read(from, reply);
+        break;
+
+    case AESD_FRAME_SEEK:
+    {
+        struct aesd_seekto command;
+        command.write_cmd = aesd_frame_get_u32((const unsigned char *)payload);
+        command.write_cmd_offset = aesd_frame_get_u32((const unsigned char *)payload + sizeof(uint32_t));
+        // The seek only positions the reply, so without one there is nothing to do
+        result = replyWanted == false || aesd_backing_store_seek_and_read(&command, reply);
+        break;
+    }
+
+    case AESD_FRAME_DELTA:
+    {
+        if (payload[0] != 0 && payload[0] != 1)
+        {
+            AESD_LOG(LOG_WARNING, "Invalid delta frame argument");
+            connection->state = AESD_CONNECTION_CLOSED;
+            return false;
+        }
+        bool deltaEnabled = payload[0] == 1;
+        from = deltaEnabled && connection->deltaReplies ? connection->lastSent : 0;
+        connection->deltaReplies = deltaEnabled;
+        result = replyWanted == false || aesd_backing_store_read(from, reply);
+        break;
+    }
+
+    case AESD_FRAME_COMPRESS:
+        if (payload[0] != 0 && payload[0] != 1)
+        {
+            AESD_LOG(LOG_WARNING, "Invalid compress frame argument");
+            connection->state = AESD_CONNECTION_CLOSED;
+            return false;
+        }
+        connection->compressReplies = payload[0] == 1;
+        result = replyWanted == false || aesd_backing_store_read(from, reply);
+        break;
+    }
+
+    if (result == false)
+    {
+        connection->state = AESD_CONNECTION_CLOSED;
+        return false;
+    }
+    if (replyWanted == false)
+    {
+        return false;
+    }
+    if (connection->compressReplies && compressReply(connection, reply) == false)
+    {
+        connection->state = AESD_CONNECTION_CLOSED;
+        return false;
+    }
+
+    size_t length = aesd_backing_store_reply_length(reply);
+    if (length > UINT32_MAX)
+    {
+        AESD_LOG(LOG_ERR, "Reply of %zu bytes does not fit in a frame", length);
+        connection->state = AESD_CONNECTION_CLOSED;
+        return false;
+    }
+
+    unsigned char replyHeader[AESD_FRAME_HEADER_SIZE];
+    struct aesd_frame_header replyFields = {
+        .length = (uint32_t)length,
+        .opcode = header->opcode,
+        .flags = connection->compressReplies ? AESD_FRAME_FLAG_COMPRESSED : 0,
+    };
+    aesd_frame_encode(replyHeader, &replyFields);
+    aesd_backing_store_reply_set_prefix(reply, replyHeader, sizeof(replyHeader));
+
+    connection->lastSent = reply->version;
+    return true;
+}
+
+/**
+ * Replaces the history in @param reply with its compressed blocks. On newline
+ * framing they follow a header with both lengths, as nothing else tells the
+ * client where the reply ends; frames announce the length in their own header.
+ * A reply with nothing to send stays empty.
+ */
+static bool compressReply(struct aesd_connection *connection, struct aesd_backing_store_reply *reply)
+{
+    size_t rawLength = aesd_backing_store_reply_length(reply);
+
+    if (aesd_backing_store_reply_compress(reply, &connection->compressScratch) == false)
+    {
+        AESD_LOG(LOG_ERR, "Failed to compress reply to %s", connection->clientName);
+        return false;
+    }
+
+    size_t length = aesd_backing_store_reply_length(reply);
+    if (rawLength > UINT32_MAX || length > UINT32_MAX)
+    {
+        AESD_LOG(LOG_ERR, "Reply of %zu bytes does not fit in a compressed reply", rawLength);
+        return false;
+    }
+    if (connection->framing != AESD_FRAMING_FRAMES && length > 0)
+    {
+        unsigned char header[AESD_COMPRESS_HEADER_SIZE];
+        aesd_frame_put_u32(header, (uint32_t)rawLength);
+        aesd_frame_put_u32(header + sizeof(uint32_t), (uint32_t)length);
+        aesd_backing_store_reply_set_prefix(reply, header, sizeof(header));
+    }
+    return true;
+}
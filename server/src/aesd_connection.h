@@ -0,0 +1,174 @@
+/*
+ * aesd_connection.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_CONNECTION_H
+#define AESD_CONNECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "aesd_admission.h"
+#include "aesd_ioctl.h"
+#include "aesd_temperaty_buffer.h"
+#include "aesd_backing_store.h"
+
+#define SEEK_CMD_PREFIX         "AESDCHAR_IOCSEEKTO:"
+#define DELTA_CMD_PREFIX        "AESDCHAR_DELTA:"
+#define COMPRESS_CMD_PREFIX     "AESDCHAR_COMPRESS:"
+
+#define AESD_CONNECTION_DEFAULT_HIGH_WATER  (256 * 1024)
+#define AESD_CONNECTION_MAX_QUEUED_REPLIES  64
+#define AESD_CONNECTION_NAME_SIZE           INET6_ADDRSTRLEN
+
+enum aesd_connection_state
+{
+    AESD_CONNECTION_RECEIVING,  // waiting for the rest of a packet
+    AESD_CONNECTION_REPLYING,   // replies are queued for the socket
+    AESD_CONNECTION_CLOSED,     // peer closed or an error occurred, destroy it
+};
+
+enum aesd_connection_framing
+{
+    AESD_FRAMING_UNKNOWN,       // nothing received yet
+    AESD_FRAMING_LINES,         // newline terminated packets and text commands
+    AESD_FRAMING_FRAMES,        // length-prefixed frames, see aesd_frame.h
+};
+
+/**
+ * A reply waiting behind the one being sent.
+ */
+struct aesd_connection_reply
+{
+    struct aesd_backing_store_reply reply;
+    size_t length;                              // bytes it adds to the output queue
+    uint64_t receivedAtNs;                      // when its packet was received
+    struct aesd_connection_reply *next;
+};
+
+/**
+ * Per-connection state machine. The socket is non-blocking; whoever owns the
+ * connection (a client thread or an event loop) waits for readiness and calls
+ * aesd_connection_on_readable()/aesd_connection_on_writable(). Replies go to
+ * an output queue drained on writability, and packets keep being read and
+ * handled behind them until the queue reaches the high-water mark.
+ */
+struct aesd_connection
+{
+    int sockFd;
+    char clientName[AESD_CONNECTION_NAME_SIZE]; // peer address for the logs
+    bool tcp;                                   // takes the TCP socket options
+    struct aesd_admission_source source;        // what it counts against in admission control
+    enum aesd_connection_state state;
+    enum aesd_connection_framing framing;       // chosen by the first bytes the client sends
+    struct aesd_temperary_buffer bufferString;  // received bytes not yet handled as packets
+    size_t packetStart;                         // first byte of the next packet in bufferString
+    size_t packetScanned;                       // bytes before this offset hold no newline
+    struct aesd_backing_store_reply reply;      // head of the output queue, being sent
+    uint64_t replyReceivedAtNs;                 // when the packet of the head reply was received
+    struct aesd_connection_reply *queueHead;    // replies waiting behind it
+    struct aesd_connection_reply *queueTail;
+    size_t queuedBytes;                         // bytes of the waiting replies
+    size_t queuedReplies;
+    struct aesd_connection_reply *spareReplies; // sent queue entries kept for reuse
+    struct aesd_temperary_buffer scratch;       // copy reply storage, reset between replies
+    struct aesd_temperary_buffer compressScratch; // the other half of a reply while it is compressed
+    bool deltaReplies;                          // reply only with bytes not sent before
+    size_t lastSent;                            // store length covered by the last reply
+    bool compressReplies;                       // send replies as compressed blocks
+    uint64_t packetCount;                       // packets handled so far
+    uint64_t acceptedAtNs;                      // CLOCK_MONOTONIC time of accept()
+    uint64_t receivedAtNs;                      // CLOCK_MONOTONIC time of the last receive
+    uint64_t activeAtNs;                        // CLOCK_MONOTONIC time of the last progress either way
+    struct aesd_connection *next;               // owner's list of connections
+    struct aesd_connection *prev;
+};
+
+/**
+ * Sets how many reply bytes a connection may queue before the server stops
+ * reading from it; 0 reads nothing while a reply is in flight.
+ */
+void aesd_connection_set_high_water(size_t bytes);
+
+/**
+ * Closes connections that neither received nor sent a byte for @param ms
+ * milliseconds; 0 lets them idle forever.
+ */
+void aesd_connection_set_idle_timeout(unsigned ms);
+
+/**
+ * Closes connections sending a packet or frame payload longer than @param
+ * bytes; 0 leaves lines unbounded and frames capped at AESD_FRAME_MAX_PAYLOAD.
+ */
+void aesd_connection_set_max_packet(size_t bytes);
+
+/**
+ * Carves room for @param count connections up front, so accepting that many
+ * does not reach malloc().
+ */
+bool aesd_connection_reserve(size_t count);
+
+/**
+ * Wraps the accepted @param sockFd. @param clientAddr is what accept() filled
+ * in, an IPv4, IPv6 or unix socket address. Returns NULL with errno set to
+ * ECONNREFUSED when admission control turns the client away; closing the
+ * socket then resets the connection.
+ */
+struct aesd_connection* aesd_connection_create(int sockFd, const struct sockaddr *clientAddr, socklen_t clientLen);
+void aesd_connection_destroy(struct aesd_connection *connection);
+
+/**
+ * Returns the slabs connections and their queued replies were carved from to
+ * malloc(); no connection may be left.
+ */
+void aesd_connection_cleanup(void);
+
+enum aesd_connection_state aesd_connection_on_readable(struct aesd_connection *connection);
+enum aesd_connection_state aesd_connection_on_writable(struct aesd_connection *connection);
+
+/**
+ * False while the output queue is at its high-water mark (or the connection is
+ * closed): the owner should stop polling the socket for input until replies
+ * drain.
+ */
+bool aesd_connection_wants_read(const struct aesd_connection *connection);
+
+/**
+ * How often, in milliseconds, an owner multiplexing connections should call
+ * aesd_connection_check_idle() on each of them; -1 without an idle timeout.
+ */
+int aesd_connection_idle_check_interval(void);
+
+/**
+ * Milliseconds @param connection may still wait for the socket before it
+ * times out, or -1 without an idle timeout. @param nowNs is CLOCK_MONOTONIC.
+ */
+int aesd_connection_idle_wait_ms(const struct aesd_connection *connection, uint64_t nowNs);
+
+/**
+ * Closes @param connection if it made no progress within the idle timeout.
+ */
+enum aesd_connection_state aesd_connection_check_idle(struct aesd_connection *connection, uint64_t nowNs);
+
+/**
+ * Completion-based counterparts for engines that do the socket I/O themselves:
+ * hand over @param size received bytes of @param data, or report that @param
+ * size bytes of the reply (see aesd_backing_store_reply_iovecs()) were sent.
+ * Neither touches the socket.
+ */
+enum aesd_connection_state aesd_connection_on_received(struct aesd_connection *connection, const char *data, size_t size);
+enum aesd_connection_state aesd_connection_on_sent(struct aesd_connection *connection, size_t size);
+
+bool checkForNullCharInString(const char *str, const ssize_t len);
+bool checkForCommandInString(const char *buffer, size_t size, struct aesd_seekto *command);
+bool checkForDeltaCommandInString(const char *buffer, size_t size, bool *enabled);
+bool checkForCompressCommandInString(const char *buffer, size_t size, bool *enabled);
+
+#endif /* AESD_CONNECTION_H */
@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "aesd_event_loop.h"
+#include "aesd_log.h"
+#include "aesd_metrics.h"
+#include "aesd_thread.h"
+
+#define EVENT_LOOP_MAX_EVENTS   64
+
+// epoll_event.data.ptr tags for the internal descriptors
+static char wakeupTag;
+static char shutdownTag;
+static char listenerTag;
+static char drainTag;
+
+static uint32_t eventsFor(const struct aesd_connection *connection)
+{
+    uint32_t events = aesd_connection_wants_read(connection) ? EPOLLIN : 0;
+    return events | (connection->state == AESD_CONNECTION_REPLYING ? EPOLLOUT : 0);
+}
+
+static void listInsert(struct aesd_connection **head, struct aesd_connection *connection)
+{
+    connection->prev = NULL;
+    connection->next = *head;
+    if (*head != NULL)
+    {
+        (*head)->prev = connection;
+    }
+    *head = connection;
+}
+
+static void listRemove(struct aesd_connection **head, struct aesd_connection *connection)
+{
+    if (connection->prev != NULL)
+    {
+        connection->prev->next = connection->next;
+    }
+    else
+    {
+        *head = connection->next;
+    }
+    if (connection->next != NULL)
+    {
+        connection->next->prev = connection->prev;
+    }
+    connection->next = NULL;
+    connection->prev = NULL;
+}
+
+static void closeConnection(struct aesd_event_loop *loop, struct aesd_connection *connection)
+{
+    epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, connection->sockFd, NULL);
+    listRemove(&loop->connections, connection);
+    loop->connectionCount--;
+    aesd_connection_destroy(connection);
+}
+
+static void registerConnection(struct aesd_event_loop *loop, struct aesd_connection *connection)
+{
+    struct epoll_event event = {0};
+    event.events = eventsFor(connection);
+    event.data.ptr = connection;
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, connection->sockFd, &event) < 0)
+    {
+        AESD_LOG(LOG_ERR, "epoll_ctl add failed for fd %d: %s", connection->sockFd, strerror(errno));
+        aesd_connection_destroy(connection);
+        return;
+    }
+    listInsert(&loop->connections, connection);
+    loop->connectionCount++;
+}
+
+static void adoptPending(struct aesd_event_loop *loop)
+{
+    uint64_t counter;
+    ssize_t res = read(loop->wakeupFd, &counter, sizeof(counter));
+    (void)res; // Unused variable
+
+    pthread_mutex_lock(&loop->pendingMutex);
+    struct aesd_connection *pending = loop->pending;
+    loop->pending = NULL;
+    pthread_mutex_unlock(&loop->pendingMutex);
+
+    while (pending != NULL)
+    {
+        struct aesd_connection *connection = pending;
+        pending = pending->next;
+        registerConnection(loop, connection);
+    }
+}
+
+/**
+ * Drains the accept queue of the loop's listener.
+ */
+static void acceptPending(struct aesd_event_loop *loop)
+{
+    while (1)
+    {
+        struct sockaddr_storage clientAddr;
+        socklen_t clientLen = sizeof(clientAddr);
+        int sockFd = accept4(loop->listenFd, (struct sockaddr *)&clientAddr, &clientLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sockFd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                AESD_LOG(LOG_ERR, "accept failed: %s", strerror(errno));
+            }
+            return;
+        }
+        struct aesd_connection *connection = aesd_connection_create(sockFd, (struct sockaddr *)&clientAddr, clientLen);
+        if (connection == NULL)
+        {
+            if (errno != ECONNREFUSED)
+            {
+                AESD_LOG(LOG_ERR, "Failed to allocate client connection");
+            }
+            close(sockFd);
+            continue;
+        }
+        registerConnection(loop, connection);
+    }
+}
+
+static void handleConnection(struct aesd_event_loop *loop, struct aesd_connection *connection, uint32_t events)
+{
+    uint32_t before = eventsFor(connection);
+    enum aesd_connection_state after = connection->state;
+
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        // Let recv()/send() report the error or the orderly close
+        events |= before;
+    }
+    if (events & EPOLLIN)
+    {
+        after = aesd_connection_on_readable(connection);
+    }
+    if ((events & EPOLLOUT) && after == AESD_CONNECTION_REPLYING)
+    {
+        after = aesd_connection_on_writable(connection);
+    }
+
+    if (after == AESD_CONNECTION_CLOSED)
+    {
+        closeConnection(loop, connection);
+        return;
+    }
+
+    if (eventsFor(connection) != before)
+    {
+        struct epoll_event event = {0};
+        event.events = eventsFor(connection);
+        event.data.ptr = connection;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, connection->sockFd, &event) < 0)
+        {
+            AESD_LOG(LOG_ERR, "epoll_ctl mod failed for fd %d: %s", connection->sockFd, strerror(errno));
+            closeConnection(loop, connection);
+        }
+    }
+}
+
+/**
+ * Closes the connections that made no progress within the idle timeout.
+ */
+static void closeIdle(struct aesd_event_loop *loop, uint64_t nowNs)
+{
+    struct aesd_connection *connection = loop->connections;
+
+    while (connection != NULL)
+    {
+        struct aesd_connection *next = connection->next;
+        if (aesd_connection_check_idle(connection, nowNs) == AESD_CONNECTION_CLOSED)
+        {
+            closeConnection(loop, connection);
+        }
+        connection = next;
+    }
+}
+
+static void* eventLoopHandler(void *arg)
+{
+    struct aesd_event_loop *loop = (struct aesd_event_loop *)arg;
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    bool running = true;
+    int checkInterval = aesd_connection_idle_check_interval();
+    uint64_t nextCheckNs = aesd_metrics_now_ns() + (uint64_t)checkInterval * 1000000ull;
+
+    while (running)
+    {
+        int ready = epoll_wait(loop->epollFd, events, EVENT_LOOP_MAX_EVENTS, checkInterval);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            AESD_LOG(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            if (events[i].data.ptr == &shutdownTag)
+            {
+                running = false;
+            }
+            else if (events[i].data.ptr == &wakeupTag)
+            {
+                adoptPending(loop);
+            }
+            else if (events[i].data.ptr == &listenerTag)
+            {
+                if (atomic_load_explicit(&loop->drained, memory_order_relaxed) == false)
+                {
+                    acceptPending(loop);
+                }
+            }
+            else if (events[i].data.ptr == &drainTag)
+            {
+                // The listener lives on in the new server process
+                epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, loop->listenFd, NULL);
+                epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, loop->drainFd, NULL);
+                atomic_store(&loop->drained, true);
+            }
+            else
+            {
+                handleConnection(loop, (struct aesd_connection *)events[i].data.ptr, events[i].events);
+            }
+        }
+
+        // One pass over all connections per interval, however busy the loop is
+        if (checkInterval >= 0)
+        {
+            uint64_t now = aesd_metrics_now_ns();
+            if (now >= nextCheckNs)
+            {
+                closeIdle(loop, now);
+                nextCheckNs = now + (uint64_t)checkInterval * 1000000ull;
+            }
+        }
+    }
+
+    AESD_LOG(LOG_DEBUG, "Event loop terminating with %zu connections", loop->connectionCount);
+
+    while (loop->connections != NULL)
+    {
+        closeConnection(loop, loop->connections);
+    }
+
+    pthread_mutex_lock(&loop->pendingMutex);
+    while (loop->pending != NULL)
+    {
+        struct aesd_connection *connection = loop->pending;
+        loop->pending = connection->next;
+        aesd_connection_destroy(connection);
+    }
+    pthread_mutex_unlock(&loop->pendingMutex);
+
+    pthread_exit(NULL);
+}
+
+bool aesd_event_loop_drained(struct aesd_event_loop *loop)
+{
+    return loop->listenFd < 0 || atomic_load(&loop->drained);
+}
+
+bool aesd_event_loop_start(struct aesd_event_loop *loop, int shutdownFd, int listenFd, int drainFd, int cpu)
+{
+    memset(loop, 0, sizeof(*loop));
+    pthread_mutex_init(&loop->pendingMutex, NULL);
+    loop->shutdownFd = shutdownFd;
+    loop->listenFd = listenFd;
+    loop->drainFd = drainFd;
+
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epollFd < 0)
+    {
+        return false;
+    }
+
+    loop->wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wakeupFd < 0)
+    {
+        close(loop->epollFd);
+        return false;
+    }
+
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = &wakeupTag;
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeupFd, &event) < 0)
+    {
+        goto fail;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = &shutdownTag;
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->shutdownFd, &event) < 0)
+    {
+        goto fail;
+    }
+
+    if (listenFd >= 0)
+    {
+        event.events = EPOLLIN;
+        event.data.ptr = &listenerTag;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, listenFd, &event) < 0)
+        {
+            goto fail;
+        }
+
+        event.events = EPOLLIN;
+        event.data.ptr = &drainTag;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, drainFd, &event) < 0)
+        {
+            goto fail;
+        }
+    }
+
+    pthread_attr_t attr;
+    aesd_thread_attr_init(&attr);
+    if (cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    int created = pthread_create(&loop->thread, &attr, eventLoopHandler, loop);
+    pthread_attr_destroy(&attr);
+    if (created != 0)
+    {
+        goto fail;
+    }
+    loop->started = true;
+    return true;
+
+fail:
+    close(loop->wakeupFd);
+    close(loop->epollFd);
+    return false;
+}
+
+bool aesd_event_loop_add_connection(struct aesd_event_loop *loop, struct aesd_connection *connection)
+{
+    pthread_mutex_lock(&loop->pendingMutex);
+    connection->prev = NULL;
+    connection->next = loop->pending;
+    loop->pending = connection;
+    pthread_mutex_unlock(&loop->pendingMutex);
+
+    uint64_t one = 1;
+    return write(loop->wakeupFd, &one, sizeof(one)) == sizeof(one);
+}
+
+void aesd_event_loop_join(struct aesd_event_loop *loop)
+{
+    if (!loop->started)
+    {
+        return;
+    }
+    pthread_join(loop->thread, NULL);
+    close(loop->wakeupFd);
+    close(loop->epollFd);
+    pthread_mutex_destroy(&loop->pendingMutex);
+    loop->started = false;
+}
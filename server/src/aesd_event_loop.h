@@ -0,0 +1,53 @@
+/*
+ * aesd_event_loop.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_EVENT_LOOP_H
+#define AESD_EVENT_LOOP_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "aesd_connection.h"
+
+/**
+ * One epoll loop running on its own thread. The loop owns every connection
+ * handed to it: it drives the connection state machine on readiness and
+ * destroys the connection when it closes. A loop given its own listening
+ * socket accepts connections itself instead of being handed them.
+ */
+struct aesd_event_loop
+{
+    pthread_t thread;
+    bool started;
+    int epollFd;
+    int wakeupFd;                       // eventfd, signalled when pending is not empty
+    int shutdownFd;                     // read end of the server shutdown pipe
+    int listenFd;                       // non-blocking listener owned by this loop, or -1
+    int drainFd;                        // readable once the listener is handed over
+    atomic_bool drained;                // no longer accepting from listenFd
+    pthread_mutex_t pendingMutex;
+    struct aesd_connection *pending;    // handed over by the acceptor, not yet in epoll
+    struct aesd_connection *connections;
+    size_t connectionCount;
+};
+
+/**
+ * Starts @param loop. @param listenFd is a non-blocking listening socket the
+ * loop accepts from, or -1, until @param drainFd turns readable; the loop
+ * then keeps serving the connections it has. @param cpu pins the loop
+ * thread, or -1.
+ */
+bool aesd_event_loop_start(struct aesd_event_loop *loop, int shutdownFd, int listenFd, int drainFd, int cpu);
+/**
+ * True once @param loop accepts no more connections after the drain.
+ */
+bool aesd_event_loop_drained(struct aesd_event_loop *loop);
+bool aesd_event_loop_add_connection(struct aesd_event_loop *loop, struct aesd_connection *connection);
+void aesd_event_loop_join(struct aesd_event_loop *loop);
+
+#endif /* AESD_EVENT_LOOP_H */
@@ -0,0 +1,80 @@
+/*
+ * aesd_frame.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_FRAME_H
+#define AESD_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Length-prefixed binary protocol offered next to newline framing on the same
+ * port. A client opts in by sending AESD_FRAME_MAGIC as the very first bytes of
+ * the connection; from then on every request and every reply is a header
+ * followed by length bytes of payload. Text clients never start with a NUL, so
+ * they are told apart from the first byte.
+ *
+ * Header, all fields in network byte order:
+ *   uint32_t length    payload bytes following the header
+ *   uint8_t  opcode    enum aesd_frame_opcode, echoed in the reply
+ *   uint8_t  flags     AESD_FRAME_FLAG_*
+ *   uint16_t reserved  0
+ */
+#define AESD_FRAME_MAGIC            "\0AF1"
+#define AESD_FRAME_MAGIC_SIZE       (sizeof(AESD_FRAME_MAGIC) - 1)
+#define AESD_FRAME_HEADER_SIZE      8
+#define AESD_FRAME_MAX_PAYLOAD      (16 * 1024 * 1024)
+
+enum aesd_frame_opcode
+{
+    AESD_FRAME_WRITE = 1,       // payload appended as is, reply with the history
+    AESD_FRAME_READ  = 2,       // no payload, reply with the history
+    AESD_FRAME_SEEK  = 3,       // payload: uint32_t write_cmd, uint32_t write_cmd_offset
+    AESD_FRAME_DELTA = 4,       // payload: one byte, 1 turns delta replies on, 0 off
+    AESD_FRAME_COMPRESS = 5,    // payload: one byte, 1 turns compressed replies on, 0 off
+};
+
+#define AESD_FRAME_FLAG_NO_REPLY    0x01    // request only: skip the reply
+#define AESD_FRAME_FLAG_COMPRESSED  0x02    // reply only: payload is compressed, see aesd_compress.h
+
+struct aesd_frame_header
+{
+    uint32_t length;
+    uint8_t opcode;
+    uint8_t flags;
+};
+
+static inline uint32_t aesd_frame_get_u32(const unsigned char *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static inline void aesd_frame_put_u32(unsigned char *data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static inline void aesd_frame_decode(const unsigned char *data, struct aesd_frame_header *header)
+{
+    header->length = aesd_frame_get_u32(data);
+    header->opcode = data[4];
+    header->flags = data[5];
+}
+
+static inline void aesd_frame_encode(unsigned char *data, const struct aesd_frame_header *header)
+{
+    aesd_frame_put_u32(data, header->length);
+    data[4] = header->opcode;
+    data[5] = header->flags;
+    data[6] = 0;
+    data[7] = 0;
+}
+
+#endif /* AESD_FRAME_H */
@@ -0,0 +1,345 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "aesd_history.h"
+
+#define HISTORY_HEADER_SIZE     4096
+#define HISTORY_GROW_SIZE       (4 * 1024 * 1024)   // memfd growth step, also how often readers remap
+#define HISTORY_MAGIC           0x4145534cu
+
+struct aesd_history_shared
+{
+    uint32_t magic;
+    _Atomic uint32_t sequence;          // futex word, bumped by every append and wake
+    _Atomic uint32_t waiters;           // threads sleeping on sequence
+    pthread_mutex_t writerMutex;        // process-shared and robust, as are the ones below
+    pthread_mutex_t persistMutex;       // held while a process writes the log out
+    _Atomic size_t end;                 // published version: bytes readers may see
+    _Atomic size_t capacity;            // log bytes the memfd holds
+    _Atomic size_t persisted;           // log bytes already written out
+};
+
+_Static_assert(sizeof(struct aesd_history_shared) <= HISTORY_HEADER_SIZE, "history header does not fit");
+
+/**
+ * Locks a mutex in the header. A process that died holding it cannot have
+ * published anything half-written, so the log is taken over as it is.
+ */
+static void lockShared(pthread_mutex_t *mutex)
+{
+    if (pthread_mutex_lock(mutex) == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(mutex);
+    }
+}
+
+static void initShared(pthread_mutex_t *mutex)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/**
+ * Makes sure this process has the first @param size log bytes mapped, mapping
+ * everything the memfd holds while at it.
+ */
+static bool mapLog(struct aesd_history *history, size_t size)
+{
+    size_t wanted = HISTORY_HEADER_SIZE + size;
+    if (atomic_load_explicit(&history->mapped, memory_order_acquire) >= wanted)
+    {
+        return true;
+    }
+
+    bool mapped = true;
+    pthread_mutex_lock(&history->mapMutex);
+    size_t from = atomic_load_explicit(&history->mapped, memory_order_relaxed);
+    size_t to = HISTORY_HEADER_SIZE + atomic_load_explicit(&history->shared->capacity, memory_order_relaxed);
+    to = to > wanted ? to : wanted;
+    if (from < wanted)
+    {
+        void *at = mmap((char *)history->shared + from, to - from, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_FIXED, history->fd, from);
+        if (at == MAP_FAILED)
+        {
+            mapped = false;
+        }
+        else
+        {
+            atomic_store_explicit(&history->mapped, to, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&history->mapMutex);
+    return mapped;
+}
+
+/**
+ * Reserves the address range of the log and maps the header of @param fd at
+ * its start.
+ */
+static bool mapHeader(struct aesd_history *history, int fd)
+{
+    void *reserved = mmap(NULL, HISTORY_HEADER_SIZE + AESD_HISTORY_MAX_SIZE, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED)
+    {
+        return false;
+    }
+    if (mmap(reserved, HISTORY_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(reserved, HISTORY_HEADER_SIZE + AESD_HISTORY_MAX_SIZE);
+        return false;
+    }
+
+    history->fd = fd;
+    history->shared = reserved;
+    history->data = (char *)reserved + HISTORY_HEADER_SIZE;
+    atomic_init(&history->mapped, HISTORY_HEADER_SIZE);
+    pthread_mutex_init(&history->mapMutex, NULL);
+    return true;
+}
+
+bool aesd_history_init(struct aesd_history *history)
+{
+    int fd = memfd_create("aesd_history", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (ftruncate(fd, HISTORY_HEADER_SIZE) < 0 || mapHeader(history, fd) == false)
+    {
+        close(fd);
+        return false;
+    }
+
+    struct aesd_history_shared *shared = history->shared;
+    atomic_init(&shared->sequence, 0);
+    atomic_init(&shared->waiters, 0);
+    initShared(&shared->writerMutex);
+    initShared(&shared->persistMutex);
+    atomic_init(&shared->end, 0);
+    atomic_init(&shared->capacity, 0);
+    atomic_init(&shared->persisted, 0);
+    shared->magic = HISTORY_MAGIC;
+    return true;
+}
+
+bool aesd_history_attach(struct aesd_history *history, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < HISTORY_HEADER_SIZE || mapHeader(history, fd) == false)
+    {
+        close(fd);
+        return false;
+    }
+    if (history->shared->magic != HISTORY_MAGIC
+        || mapLog(history, atomic_load(&history->shared->end)) == false)
+    {
+        aesd_history_destroy(history);
+        return false;
+    }
+    return true;
+}
+
+void aesd_history_destroy(struct aesd_history *history)
+{
+    // The locks in the header may still be used by another process
+    munmap(history->shared, HISTORY_HEADER_SIZE + AESD_HISTORY_MAX_SIZE);
+    close(history->fd);
+    history->fd = -1;
+    history->shared = NULL;
+    history->data = NULL;
+    pthread_mutex_destroy(&history->mapMutex);
+}
+
+int aesd_history_fd(const struct aesd_history *history)
+{
+    return history->fd;
+}
+
+size_t aesd_history_append(struct aesd_history *history, const char *data, size_t size)
+{
+    struct aesd_history_shared *shared = history->shared;
+
+    lockShared(&shared->writerMutex);
+
+    size_t end = atomic_load_explicit(&shared->end, memory_order_relaxed);
+    if (size > AESD_HISTORY_MAX_SIZE - end)
+    {
+        pthread_mutex_unlock(&shared->writerMutex);
+        return 0;
+    }
+
+    // Grow the memfd first so a failed append publishes nothing
+    size_t capacity = atomic_load_explicit(&shared->capacity, memory_order_relaxed);
+    if (end + size > capacity)
+    {
+        size_t grown = (end + size + HISTORY_GROW_SIZE - 1) / HISTORY_GROW_SIZE * HISTORY_GROW_SIZE;
+        grown = grown < AESD_HISTORY_MAX_SIZE ? grown : AESD_HISTORY_MAX_SIZE;
+        if (ftruncate(history->fd, HISTORY_HEADER_SIZE + grown) < 0)
+        {
+            pthread_mutex_unlock(&shared->writerMutex);
+            return 0;
+        }
+        atomic_store_explicit(&shared->capacity, grown, memory_order_relaxed);
+    }
+    if (mapLog(history, end + size) == false)
+    {
+        pthread_mutex_unlock(&shared->writerMutex);
+        return 0;
+    }
+
+    memcpy(history->data + end, data, size);
+    end += size;
+    // Publishing the version releases the bytes written above
+    atomic_store_explicit(&shared->end, end, memory_order_seq_cst);
+
+    pthread_mutex_unlock(&shared->writerMutex);
+
+    atomic_fetch_add(&shared->sequence, 1);
+    if (atomic_load(&shared->waiters) > 0)
+    {
+        syscall(SYS_futex, (void *)&shared->sequence, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+    return end;
+}
+
+size_t aesd_history_version(struct aesd_history *history)
+{
+    size_t end = atomic_load_explicit(&history->shared->end, memory_order_acquire);
+
+    // Another process may have appended past what this one has mapped
+    if (mapLog(history, end) == false)
+    {
+        size_t mapped = atomic_load_explicit(&history->mapped, memory_order_acquire);
+        return mapped - HISTORY_HEADER_SIZE;
+    }
+    return end;
+}
+
+uint32_t aesd_history_sequence(struct aesd_history *history)
+{
+    return atomic_load(&history->shared->sequence);
+}
+
+void aesd_history_wait(struct aesd_history *history, uint32_t sequence)
+{
+    struct aesd_history_shared *shared = history->shared;
+
+    // Not a private futex: the appender may be another process
+    atomic_fetch_add(&shared->waiters, 1);
+    syscall(SYS_futex, (void *)&shared->sequence, FUTEX_WAIT, sequence, NULL, NULL, 0);
+    atomic_fetch_sub(&shared->waiters, 1);
+}
+
+void aesd_history_wake(struct aesd_history *history)
+{
+    atomic_fetch_add(&history->shared->sequence, 1);
+    syscall(SYS_futex, (void *)&history->shared->sequence, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+bool aesd_history_persist(struct aesd_history *history, int fd)
+{
+    struct aesd_history_shared *shared = history->shared;
+    bool written = true;
+
+    lockShared(&shared->persistMutex);
+    size_t from = atomic_load_explicit(&shared->persisted, memory_order_relaxed);
+    size_t version = aesd_history_version(history);
+    if (from < version)
+    {
+        struct aesd_history_cursor cursor;
+        aesd_history_cursor_init(&cursor, history, from, version);
+        written = aesd_history_cursor_write(&cursor, fd);
+        atomic_store_explicit(&shared->persisted, version, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shared->persistMutex);
+    return written;
+}
+
+size_t aesd_history_persisted(struct aesd_history *history)
+{
+    return atomic_load_explicit(&history->shared->persisted, memory_order_relaxed);
+}
+
+void aesd_history_mark_persisted(struct aesd_history *history, size_t version)
+{
+    atomic_store_explicit(&history->shared->persisted, version, memory_order_relaxed);
+}
+
+void aesd_history_cursor_init(struct aesd_history_cursor *cursor, struct aesd_history *history,
+                              size_t start, size_t end)
+{
+    cursor->data = history->data;
+    cursor->offset = start;
+    cursor->end = end;
+}
+
+int aesd_history_cursor_iovecs(const struct aesd_history_cursor *cursor, struct iovec *iov, int max)
+{
+    if (max < 1 || cursor->offset >= cursor->end)
+    {
+        return 0;
+    }
+    iov[0].iov_base = (void *)(cursor->data + cursor->offset);
+    iov[0].iov_len = cursor->end - cursor->offset;
+    return 1;
+}
+
+void aesd_history_cursor_advance(struct aesd_history_cursor *cursor, size_t size)
+{
+    cursor->offset += size;
+}
+
+bool aesd_history_cursor_send(struct aesd_history_cursor *cursor, int sockFd)
+{
+    while (cursor->offset < cursor->end)
+    {
+        ssize_t sent = send(sockFd, cursor->data + cursor->offset, cursor->end - cursor->offset, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        cursor->offset += sent;
+    }
+    return true;
+}
+
+bool aesd_history_cursor_write(struct aesd_history_cursor *cursor, int fd)
+{
+    while (cursor->offset < cursor->end)
+    {
+        ssize_t written = write(fd, cursor->data + cursor->offset, cursor->end - cursor->offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        cursor->offset += written;
+    }
+    return true;
+}
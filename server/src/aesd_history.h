@@ -0,0 +1,135 @@
+/*
+ * aesd_history.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_HISTORY_H
+#define AESD_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+// Address space reserved for the log, so it can grow without moving
+#define AESD_HISTORY_MAX_SIZE       ((size_t)1 << (sizeof(size_t) >= 8 ? 36 : 29))
+
+struct aesd_history_shared;
+
+/**
+ * Append-only log in a memfd, mapped at one contiguous range of addresses.
+ * Bytes are never moved or freed while the log is alive, so a reader only
+ * needs the published length (the version) to know which bytes are complete;
+ * it reads them without any lock while writers keep appending behind it.
+ *
+ * The memfd starts with a header holding the version and process-shared locks,
+ * so a server handing over to its successor passes it the descriptor and both
+ * keep appending to the same log while the old one drains.
+ */
+struct aesd_history
+{
+    int fd;
+    struct aesd_history_shared *shared;     // header at the start of the mapping
+    char *data;                             // first byte of the log
+    _Atomic size_t mapped;                  // bytes of the memfd this process has mapped
+    pthread_mutex_t mapMutex;               // serializes growing the mapping
+};
+
+/**
+ * A reader's view of bytes [offset, end) of the history.
+ */
+struct aesd_history_cursor
+{
+    const char *data;
+    size_t offset;
+    size_t end;
+};
+
+bool aesd_history_init(struct aesd_history *history);
+
+/**
+ * Maps the log another process created and handed over as @param fd, which
+ * @param history owns from then on.
+ */
+bool aesd_history_attach(struct aesd_history *history, int fd);
+void aesd_history_destroy(struct aesd_history *history);
+
+/**
+ * Descriptor of the memfd, to hand the log to another process.
+ */
+int aesd_history_fd(const struct aesd_history *history);
+
+/**
+ * Appends @param size bytes of @param data and publishes them. Returns the new
+ * version, or 0 when memory ran out (nothing is published in that case).
+ */
+size_t aesd_history_append(struct aesd_history *history, const char *data, size_t size);
+
+/**
+ * Current version, i.e. the number of bytes published so far.
+ */
+size_t aesd_history_version(struct aesd_history *history);
+
+/**
+ * Change counter for aesd_history_wait(), read before looking at the version.
+ */
+uint32_t aesd_history_sequence(struct aesd_history *history);
+
+/**
+ * Blocks until something is appended in any process, or aesd_history_wake()
+ * is called, after @param sequence was read.
+ */
+void aesd_history_wait(struct aesd_history *history, uint32_t sequence);
+void aesd_history_wake(struct aesd_history *history);
+
+/**
+ * Writes the bytes no process sharing the log has written to @param fd yet.
+ * Processes take turns, so each byte is written once. Returns false on a
+ * write error; those bytes are not retried.
+ */
+bool aesd_history_persist(struct aesd_history *history, int fd);
+
+/**
+ * Bytes written out so far, and marking the first @param version bytes as
+ * already there, e.g. when they were loaded from @param fd.
+ */
+size_t aesd_history_persisted(struct aesd_history *history);
+void aesd_history_mark_persisted(struct aesd_history *history, size_t version);
+
+/**
+ * Points @param cursor at bytes [@param start, @param end) of @param history.
+ * @param end must not be newer than a version the caller has observed.
+ */
+void aesd_history_cursor_init(struct aesd_history_cursor *cursor, struct aesd_history *history,
+                              size_t start, size_t end);
+
+/**
+ * Describes what is left of @param cursor in at most @param max entries of
+ * @param iov and returns how many were filled in, for callers doing their own
+ * I/O; aesd_history_cursor_advance() then consumes what was transferred.
+ */
+int aesd_history_cursor_iovecs(const struct aesd_history_cursor *cursor, struct iovec *iov, int max);
+void aesd_history_cursor_advance(struct aesd_history_cursor *cursor, size_t size);
+
+/**
+ * Writes as much of @param cursor to the non-blocking @param sockFd as it
+ * accepts. Returns false on a socket error.
+ */
+bool aesd_history_cursor_send(struct aesd_history_cursor *cursor, int sockFd);
+
+/**
+ * Writes all of @param cursor to the blocking @param fd. Returns false on a
+ * write error, with the cursor left at the first byte not written.
+ */
+bool aesd_history_cursor_write(struct aesd_history_cursor *cursor, int fd);
+
+static inline bool aesd_history_cursor_done(const struct aesd_history_cursor *cursor)
+{
+    return cursor->offset >= cursor->end;
+}
+
+#endif /* AESD_HISTORY_H */
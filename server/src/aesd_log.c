@@ -0,0 +1,237 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "aesd_log.h"
+#include "aesd_thread.h"
+
+#define LOG_RING_MASK           (AESD_LOG_RING_SIZE - 1)
+#define LOG_IDLE_WAIT_MS        100
+
+struct logRecord
+{
+    _Atomic size_t sequence;    // == position + 1 once the record at position is written
+    int level;
+    char message[AESD_LOG_MESSAGE_SIZE];
+};
+
+int aesdLogThreshold = LOG_INFO;
+
+static struct logRecord ring[AESD_LOG_RING_SIZE];
+static _Atomic size_t enqueuePosition;
+static size_t dequeuePosition;              // drain thread only
+static _Atomic size_t dropped;
+static atomic_bool ringReady;
+static pthread_once_t ringOnce = PTHREAD_ONCE_INIT;
+
+static pthread_t drainThread;
+static bool drainThreadStarted = false;
+static pthread_mutex_t drainMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drainCond = PTHREAD_COND_INITIALIZER;
+static atomic_bool drainSleeping;
+static bool drainStop = false;
+
+static void ringInit(void)
+{
+    for (size_t i = 0; i < AESD_LOG_RING_SIZE; i++)
+    {
+        atomic_init(&ring[i].sequence, i);
+    }
+    atomic_store(&ringReady, true);
+}
+
+void aesd_log_write(int level, const char *format, ...)
+{
+    if (atomic_load_explicit(&ringReady, memory_order_acquire) == false)
+    {
+        pthread_once(&ringOnce, ringInit);
+    }
+
+    // Claim a slot: bounded multi-producer queue with a sequence per slot
+    size_t position = atomic_load_explicit(&enqueuePosition, memory_order_relaxed);
+    struct logRecord *record;
+    while (1)
+    {
+        record = &ring[position & LOG_RING_MASK];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&enqueuePosition, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Ring full: the drain thread is behind, do not wait for it
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = atomic_load_explicit(&enqueuePosition, memory_order_relaxed);
+        }
+    }
+
+    int savedErrno = errno;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record->message, sizeof(record->message), format, args);
+    va_end(args);
+    record->level = level;
+    errno = savedErrno;
+
+    // Sequentially consistent with the drain thread's check of drainSleeping,
+    // so either it sees this record or we see it asleep
+    atomic_store(&record->sequence, position + 1);
+    if (atomic_load(&drainSleeping))
+    {
+        pthread_mutex_lock(&drainMutex);
+        pthread_cond_signal(&drainCond);
+        pthread_mutex_unlock(&drainMutex);
+    }
+}
+
+void aesd_log_set_threshold(int level)
+{
+    aesdLogThreshold = level;
+}
+
+bool aesd_log_parse_level(const char *name, int *level)
+{
+    static const struct
+    {
+        const char *name;
+        int level;
+    } levels[] = {
+        { "err", LOG_ERR },
+        { "warning", LOG_WARNING },
+        { "info", LOG_INFO },
+        { "debug", LOG_DEBUG },
+    };
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+    {
+        if (strcmp(name, levels[i].name) == 0)
+        {
+            *level = levels[i].level;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Writes out every record published so far. Returns how many there were.
+ */
+static size_t drainRing(void)
+{
+    size_t count = 0;
+
+    while (1)
+    {
+        struct logRecord *record = &ring[dequeuePosition & LOG_RING_MASK];
+        if (atomic_load(&record->sequence) != dequeuePosition + 1)
+        {
+            break;
+        }
+
+        syslog(record->level, "%s", record->message);
+        fputs(record->message, stdout);
+        fputc('\n', stdout);
+
+        atomic_store_explicit(&record->sequence, dequeuePosition + AESD_LOG_RING_SIZE, memory_order_release);
+        dequeuePosition++;
+        count++;
+    }
+
+    size_t lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost > 0)
+    {
+        syslog(LOG_WARNING, "Log ring full, dropped %zu records", lost);
+        printf("Log ring full, dropped %zu records\n", lost);
+    }
+    if (count > 0 || lost > 0)
+    {
+        fflush(stdout);
+    }
+    return count;
+}
+
+static void* drainHandler(void *arg)
+{
+    (void)arg; // Unused parameter
+
+    while (1)
+    {
+        if (drainRing() > 0)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&drainMutex);
+        atomic_store(&drainSleeping, true);
+        // Re-check after announcing the sleep; a producer that missed the flag
+        // has already published its record
+        struct logRecord *record = &ring[dequeuePosition & LOG_RING_MASK];
+        if (drainStop == false && atomic_load(&record->sequence) != dequeuePosition + 1)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&drainCond, &drainMutex, &deadline);
+        }
+        atomic_store(&drainSleeping, false);
+        bool stopping = drainStop;
+        pthread_mutex_unlock(&drainMutex);
+
+        if (stopping)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+bool aesd_log_start(void)
+{
+    pthread_once(&ringOnce, ringInit);
+    pthread_attr_t attr;
+    aesd_thread_attr_init(&attr);
+    int created = pthread_create(&drainThread, &attr, drainHandler, NULL);
+    pthread_attr_destroy(&attr);
+    if (created != 0)
+    {
+        return false;
+    }
+    drainThreadStarted = true;
+    return true;
+}
+
+void aesd_log_stop(void)
+{
+    pthread_once(&ringOnce, ringInit);
+    if (drainThreadStarted)
+    {
+        pthread_mutex_lock(&drainMutex);
+        drainStop = true;
+        pthread_cond_signal(&drainCond);
+        pthread_mutex_unlock(&drainMutex);
+        pthread_join(drainThread, NULL);
+        drainThreadStarted = false;
+    }
+    // Whatever was logged after the thread's last pass, or without a thread
+    drainRing();
+}
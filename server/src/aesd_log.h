@@ -0,0 +1,66 @@
+/*
+ * aesd_log.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_LOG_H
+#define AESD_LOG_H
+
+#include <stdbool.h>
+#include <syslog.h>
+
+/**
+ * Levels above this (syslog numbering, LOG_ERR..LOG_DEBUG) are compiled out.
+ */
+#ifndef AESD_LOG_COMPILE_LEVEL
+#define AESD_LOG_COMPILE_LEVEL  LOG_DEBUG
+#endif
+
+#define AESD_LOG_RING_SIZE      1024    // records, power of two
+#define AESD_LOG_MESSAGE_SIZE   248     // longer messages are truncated
+
+/**
+ * Runtime threshold, set once at startup with aesd_log_set_threshold().
+ */
+extern int aesdLogThreshold;
+
+/**
+ * Logs a printf-style message at @param level to stdout and syslog. A level
+ * that is disabled costs one branch; an enabled one formats the message into
+ * a lock-free ring that a background thread drains, so the caller never
+ * blocks on stdio or syslog. Records are dropped (and counted) when the ring
+ * is full.
+ */
+#define AESD_LOG(level, ...)                                                        \
+    do                                                                              \
+    {                                                                               \
+        if ((level) <= AESD_LOG_COMPILE_LEVEL && (level) <= aesdLogThreshold)       \
+        {                                                                           \
+            aesd_log_write((level), __VA_ARGS__);                                   \
+        }                                                                           \
+    } while (0)
+
+void aesd_log_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+void aesd_log_set_threshold(int level);
+
+/**
+ * Parses err, warning, info or debug into @param level.
+ */
+bool aesd_log_parse_level(const char *name, int *level);
+
+/**
+ * Starts the thread draining the ring. Records logged before it starts are
+ * kept and written once it runs.
+ */
+bool aesd_log_start(void);
+
+/**
+ * Writes out everything still in the ring and stops the drain thread. Must be
+ * called after every other thread that logs has finished.
+ */
+void aesd_log_stop(void);
+
+#endif /* AESD_LOG_H */
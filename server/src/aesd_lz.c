@@ -0,0 +1,204 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "aesd_lz.h"
+
+#define LZ_MIN_MATCH            4
+#define LZ_LAST_LITERALS        5       // the format ends every block with literals
+#define LZ_MATCH_SEARCH_LIMIT   12      // no match starts this close to the end
+#define LZ_MAX_OFFSET           65535
+#define LZ_HASH_BITS            12
+#define LZ_SKIP_TRIGGER         6       // step up the search after 2^n misses in a row
+
+static inline uint32_t read32(const unsigned char *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hash32(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Writes the part of a length beyond what its token nibble holds.
+ */
+static unsigned char* putLength(unsigned char *op, size_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+/**
+ * Writes one sequence: @param literalCount bytes of @param literals followed
+ * by a match of @param matchLength bytes @param offset bytes back, or by
+ * nothing when @param matchLength is 0 (the last sequence).
+ */
+static unsigned char* putSequence(unsigned char *op, const unsigned char *literals, size_t literalCount,
+                                  size_t offset, size_t matchLength)
+{
+    unsigned char *token = op++;
+
+    *token = (unsigned char)((literalCount < 15 ? literalCount : 15) << 4);
+    if (literalCount >= 15)
+    {
+        op = putLength(op, literalCount - 15);
+    }
+    memcpy(op, literals, literalCount);
+    op += literalCount;
+
+    if (matchLength == 0)
+    {
+        return op;
+    }
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+    matchLength -= LZ_MIN_MATCH;
+    *token |= (unsigned char)(matchLength < 15 ? matchLength : 15);
+    if (matchLength >= 15)
+    {
+        op = putLength(op, matchLength - 15);
+    }
+    return op;
+}
+
+size_t aesd_lz_compress(const void *src, size_t size, void *dst)
+{
+    const unsigned char *in = src;
+    unsigned char *op = dst;
+    uint16_t table[1 << LZ_HASH_BITS];
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    if (size > LZ_MATCH_SEARCH_LIMIT)
+    {
+        const size_t searchEnd = size - LZ_MATCH_SEARCH_LIMIT;
+        const size_t matchEnd = size - LZ_LAST_LITERALS;
+        unsigned misses = 1u << LZ_SKIP_TRIGGER;
+
+        memset(table, 0, sizeof(table));
+        ip = 1;
+        while (ip < searchEnd)
+        {
+            uint32_t sequence = read32(in + ip);
+            uint32_t slot = hash32(sequence);
+            size_t candidate = table[slot];
+            table[slot] = (uint16_t)ip;
+
+            if (candidate >= ip || ip - candidate > LZ_MAX_OFFSET || read32(in + candidate) != sequence)
+            {
+                // Text that does not repeat is skipped faster the longer it goes on
+                ip += misses++ >> LZ_SKIP_TRIGGER;
+                continue;
+            }
+            misses = 1u << LZ_SKIP_TRIGGER;
+
+            // Grow the match backwards into the pending literals, then forwards
+            while (ip > anchor && candidate > 0 && in[ip - 1] == in[candidate - 1])
+            {
+                ip--;
+                candidate--;
+            }
+            size_t length = LZ_MIN_MATCH;
+            while (ip + length < matchEnd && in[candidate + length] == in[ip + length])
+            {
+                length++;
+            }
+
+            op = putSequence(op, in + anchor, ip - anchor, ip - candidate, length);
+            ip += length;
+            anchor = ip;
+            if (ip - 2 < searchEnd)
+            {
+                table[hash32(read32(in + ip - 2))] = (uint16_t)(ip - 2);
+            }
+        }
+    }
+
+    op = putSequence(op, in + anchor, size - anchor, 0, 0);
+    return op - (unsigned char *)dst;
+}
+
+/**
+ * Reads the rest of a length whose token nibble was 15. False past @param end.
+ */
+static bool getLength(const unsigned char **ip, const unsigned char *end, size_t *length)
+{
+    unsigned char byte;
+    do
+    {
+        if (*ip >= end)
+        {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    }
+    while (byte == 255);
+    return true;
+}
+
+ssize_t aesd_lz_decompress(const void *src, size_t size, void *dst, size_t capacity)
+{
+    const unsigned char *ip = src;
+    const unsigned char *end = ip + size;
+    unsigned char *out = dst;
+    size_t op = 0;
+
+    while (ip < end)
+    {
+        unsigned char token = *ip++;
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && getLength(&ip, end, &literalCount) == false)
+        {
+            return -1;
+        }
+        if (literalCount > (size_t)(end - ip) || literalCount > capacity - op)
+        {
+            return -1;
+        }
+        memcpy(out + op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+
+        if (ip == end)
+        {
+            // The last sequence has no match
+            break;
+        }
+        if (end - ip < 2)
+        {
+            return -1;
+        }
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && getLength(&ip, end, &matchLength) == false)
+        {
+            return -1;
+        }
+        matchLength += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || matchLength > capacity - op)
+        {
+            return -1;
+        }
+
+        // A match may overlap the bytes it produces; copying at most offset
+        // bytes at a time keeps each copy clear of its own output
+        while (matchLength > 0)
+        {
+            size_t chunk = matchLength < offset ? matchLength : offset;
+            memcpy(out + op, out + op - offset, chunk);
+            op += chunk;
+            matchLength -= chunk;
+        }
+    }
+    return (ssize_t)op;
+}
@@ -0,0 +1,43 @@
+/*
+ * aesd_lz.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_LZ_H
+#define AESD_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Greedy LZ77 codec writing the LZ4 block format: sequences of a token, the
+ * literals and a 16-bit little-endian match offset, with the last 5 bytes of a
+ * block always left as literals. It trades ratio for speed, and the repeated
+ * text of the history compresses well even so. Blocks are independent, so the
+ * decoder needs nothing but the block itself.
+ */
+#define AESD_LZ_MAX_INPUT           (64 * 1024)     // match offsets are 16 bits
+
+/**
+ * Largest output aesd_lz_compress() can produce for @param size input bytes.
+ */
+#define AESD_LZ_BOUND(size)         ((size) + (size) / 255 + 16)
+
+/**
+ * Compresses @param size (at most AESD_LZ_MAX_INPUT) bytes of @param src into
+ * @param dst, which has room for AESD_LZ_BOUND(size) bytes, and returns the
+ * compressed size.
+ */
+size_t aesd_lz_compress(const void *src, size_t size, void *dst);
+
+/**
+ * Decompresses the @param size byte block at @param src into @param dst of
+ * @param capacity bytes. Returns the decompressed size, or -1 when the block
+ * is malformed or does not fit.
+ */
+ssize_t aesd_lz_decompress(const void *src, size_t size, void *dst, size_t capacity);
+
+#endif /* AESD_LZ_H */
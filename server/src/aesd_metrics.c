@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "aesd_metrics.h"
+#include "aesd_log.h"
+#include "aesd_thread.h"
+
+#define METRICS_REQUEST_WAIT_MS     100     // how long a scraper may take to send its request
+#define METRICS_TEXT_SIZE           (32 * 1024)
+
+__thread struct aesd_metrics_block *aesdMetricsLocal;
+
+// Blocks of live threads; those of exited threads are folded into retired
+static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registryOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t registryKey;
+static struct aesd_metrics_block *registry;
+static struct aesd_metrics_block retired;
+
+static pthread_t serverThread;
+static bool serverStarted = false;
+static int serverFd = -1;
+static int serverShutdownFd = -1;
+static char serverPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} counterInfo[AESD_METRIC_COUNTER_COUNT] = {
+    [AESD_METRIC_ACCEPTS]           = { "aesd_accepts_total", "Connections accepted" },
+    [AESD_METRIC_CLOSES]            = { "aesd_closes_total", "Connections closed" },
+    [AESD_METRIC_BYTES_IN]          = { "aesd_received_bytes_total", "Bytes received from clients" },
+    [AESD_METRIC_BYTES_OUT]         = { "aesd_sent_bytes_total", "Reply bytes sent to clients" },
+    [AESD_METRIC_PACKETS]           = { "aesd_packets_total", "Packets and frames handled" },
+    [AESD_METRIC_PACKETS_COMMITTED] = { "aesd_packets_committed_total", "Appends that reached the backing store" },
+    [AESD_METRIC_REFUSED_TOTAL]     = { "aesd_refused_total", "Connections refused at the connection limit" },
+    [AESD_METRIC_REFUSED_SOURCE]    = { "aesd_refused_source_total", "Connections refused at the per-source limit" },
+    [AESD_METRIC_IDLE_TIMEOUTS]     = { "aesd_idle_timeouts_total", "Connections closed after the idle timeout" },
+    [AESD_METRIC_OVERSIZED]         = { "aesd_oversized_packets_total", "Connections closed for a packet over the size limit" },
+    [AESD_METRIC_COMPRESS_IN]       = { "aesd_compress_input_bytes_total", "History bytes sent in compressed replies" },
+    [AESD_METRIC_COMPRESS_OUT]      = { "aesd_compress_output_bytes_total", "Bytes those compressed replies took" },
+    [AESD_METRIC_COMPRESS_BLOCKS]   = { "aesd_compress_blocks_total", "Blocks compressed for replies" },
+    [AESD_METRIC_COMPRESS_CACHE_HITS] = { "aesd_compress_cache_hits_total", "Blocks served from the compressed block cache" },
+};
+
+static const struct
+{
+    const char *name;
+    const char *help;
+    double scale;                   // exported unit per recorded unit
+} histogramInfo[AESD_METRIC_HISTOGRAM_COUNT] = {
+    [AESD_METRIC_STORE_LOCK_WAIT]   = { "aesd_store_lock_wait_seconds", "Time spent waiting for the store mutex", 1e-9 },
+    [AESD_METRIC_STORE_LOCK_HOLD]   = { "aesd_store_lock_hold_seconds", "Time the store mutex was held", 1e-9 },
+    [AESD_METRIC_REPLY_SIZE]        = { "aesd_reply_size_bytes", "Size of each reply", 1 },
+    [AESD_METRIC_PACKET_LATENCY]    = { "aesd_packet_latency_seconds", "Time from receiving a packet to its reply being sent", 1e-9 },
+};
+
+static void accumulate(struct aesd_metrics_block *total, const struct aesd_metrics_block *block)
+{
+    for (int i = 0; i < AESD_METRIC_COUNTER_COUNT; i++)
+    {
+        total->counters[i] += __atomic_load_n(&block->counters[i], __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < AESD_METRIC_HISTOGRAM_COUNT; i++)
+    {
+        for (int j = 0; j < AESD_METRICS_BUCKETS; j++)
+        {
+            total->histograms[i].buckets[j] += __atomic_load_n(&block->histograms[i].buckets[j], __ATOMIC_RELAXED);
+        }
+        total->histograms[i].sum += __atomic_load_n(&block->histograms[i].sum, __ATOMIC_RELAXED);
+    }
+}
+
+static void retireBlock(void *arg)
+{
+    struct aesd_metrics_block *block = arg;
+
+    pthread_mutex_lock(&registryMutex);
+    for (struct aesd_metrics_block **link = &registry; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == block)
+        {
+            *link = block->next;
+            break;
+        }
+    }
+    accumulate(&retired, block);
+    pthread_mutex_unlock(&registryMutex);
+    free(block);
+}
+
+static void createRegistryKey(void)
+{
+    pthread_key_create(&registryKey, retireBlock);
+}
+
+struct aesd_metrics_block* aesd_metrics_register(void)
+{
+    static struct aesd_metrics_block fallback;     // shared, only if allocation fails
+
+    struct aesd_metrics_block *block = aligned_alloc(_Alignof(struct aesd_metrics_block), sizeof(*block));
+    if (block == NULL)
+    {
+        aesdMetricsLocal = &fallback;
+        return aesdMetricsLocal;
+    }
+    memset(block, 0, sizeof(*block));
+
+    pthread_once(&registryOnce, createRegistryKey);
+    pthread_setspecific(registryKey, block);
+
+    pthread_mutex_lock(&registryMutex);
+    block->next = registry;
+    registry = block;
+    pthread_mutex_unlock(&registryMutex);
+
+    aesdMetricsLocal = block;
+    return block;
+}
+
+/**
+ * Formats the sum of all blocks into @param text, returns its length.
+ */
+static size_t formatMetrics(char *text, size_t size)
+{
+    static struct aesd_metrics_block total;     // metrics thread only
+    size_t length = 0;
+
+    memset(&total, 0, sizeof(total));
+    pthread_mutex_lock(&registryMutex);
+    accumulate(&total, &retired);
+    for (struct aesd_metrics_block *block = registry; block != NULL; block = block->next)
+    {
+        accumulate(&total, block);
+    }
+    pthread_mutex_unlock(&registryMutex);
+
+#define APPEND(...) \
+    length += (size_t)snprintf(text + length, length < size ? size - length : 0, __VA_ARGS__)
+
+    for (int i = 0; i < AESD_METRIC_COUNTER_COUNT; i++)
+    {
+        APPEND("# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counterInfo[i].name, counterInfo[i].help,
+               counterInfo[i].name, counterInfo[i].name, (unsigned long long)total.counters[i]);
+    }
+    APPEND("# HELP aesd_connections_active Connections currently open\n# TYPE aesd_connections_active gauge\n"
+           "aesd_connections_active %llu\n",
+           (unsigned long long)(total.counters[AESD_METRIC_ACCEPTS] - total.counters[AESD_METRIC_CLOSES]));
+
+    for (int i = 0; i < AESD_METRIC_HISTOGRAM_COUNT; i++)
+    {
+        const struct aesd_metrics_histogram *histogram = &total.histograms[i];
+        const char *name = histogramInfo[i].name;
+        uint64_t cumulative = 0;
+        int last = AESD_METRICS_BUCKETS - 1;
+
+        // Skip the empty tail so a scrape stays short
+        while (last > 0 && histogram->buckets[last] == 0)
+        {
+            last--;
+        }
+
+        APPEND("# HELP %s %s\n# TYPE %s histogram\n", name, histogramInfo[i].help, name);
+        for (int j = 0; j <= last && j < AESD_METRICS_BUCKETS - 1; j++)
+        {
+            cumulative += histogram->buckets[j];
+            APPEND("%s_bucket{le=\"%g\"} %llu\n", name, (double)(1ull << j) * histogramInfo[i].scale,
+                   (unsigned long long)cumulative);
+        }
+        cumulative += last == AESD_METRICS_BUCKETS - 1 ? histogram->buckets[last] : 0;
+        APPEND("%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+        APPEND("%s_sum %g\n", name, (double)histogram->sum * histogramInfo[i].scale);
+        APPEND("%s_count %llu\n", name, (unsigned long long)cumulative);
+    }
+#undef APPEND
+
+    return length < size ? length : size - 1;
+}
+
+static bool writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+static void serveClient(int clientFd)
+{
+    static char text[METRICS_TEXT_SIZE];        // metrics thread only
+    char request[512];
+    ssize_t requestLen = 0;
+
+    // A scraper speaking HTTP sends its request first; give it a moment
+    struct pollfd readable = { .fd = clientFd, .events = POLLIN };
+    if (poll(&readable, 1, METRICS_REQUEST_WAIT_MS) > 0)
+    {
+        requestLen = recv(clientFd, request, sizeof(request), MSG_DONTWAIT);
+    }
+
+    size_t length = formatMetrics(text, sizeof(text));
+    if (requestLen >= 4 && memcmp(request, "GET ", 4) == 0)
+    {
+        char header[160];
+        int headerLen = snprintf(header, sizeof(header),
+                                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %zu\r\nConnection: close\r\n\r\n", length);
+        if (writeAll(clientFd, header, headerLen) == false)
+        {
+            return;
+        }
+    }
+    writeAll(clientFd, text, length);
+}
+
+static void* metricsHandler(void *arg)
+{
+    (void)arg; // Unused parameter
+
+    struct pollfd fds[2];
+    fds[0].fd = serverFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = serverShutdownFd;
+    fds[1].events = POLLIN;
+
+    while (1)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            AESD_LOG(LOG_ERR, "Metrics poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            break;
+        }
+        if ((fds[0].revents & POLLIN) == 0)
+        {
+            continue;
+        }
+
+        int clientFd = accept4(serverFd, NULL, NULL, SOCK_CLOEXEC);
+        if (clientFd < 0)
+        {
+            continue;
+        }
+        serveClient(clientFd);
+        close(clientFd);
+    }
+    return NULL;
+}
+
+bool aesd_metrics_start(const char *path, int shutdownFd)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        AESD_LOG(LOG_ERR, "Metrics socket path %s is too long", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    strcpy(serverPath, path);
+
+    serverFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (serverFd < 0)
+    {
+        AESD_LOG(LOG_ERR, "Failed to create metrics socket: %s", strerror(errno));
+        return false;
+    }
+
+    // A stale socket from a previous run would make bind() fail
+    unlink(path);
+    if (bind(serverFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(serverFd, 16) < 0)
+    {
+        AESD_LOG(LOG_ERR, "Failed to listen on metrics socket %s: %s", path, strerror(errno));
+        close(serverFd);
+        serverFd = -1;
+        return false;
+    }
+
+    serverShutdownFd = shutdownFd;
+    pthread_attr_t attr;
+    aesd_thread_attr_init(&attr);
+    int created = pthread_create(&serverThread, &attr, metricsHandler, NULL);
+    pthread_attr_destroy(&attr);
+    if (created != 0)
+    {
+        AESD_LOG(LOG_ERR, "Failed to start metrics thread");
+        close(serverFd);
+        serverFd = -1;
+        unlink(path);
+        return false;
+    }
+    serverStarted = true;
+
+    AESD_LOG(LOG_INFO, "Serving metrics on %s", path);
+    return true;
+}
+
+void aesd_metrics_stop(bool removeSocket)
+{
+    if (serverStarted == false)
+    {
+        return;
+    }
+    pthread_join(serverThread, NULL);
+    serverStarted = false;
+    close(serverFd);
+    serverFd = -1;
+    if (removeSocket)
+    {
+        unlink(serverPath);
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ * aesd_metrics.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_METRICS_H
+#define AESD_METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define AESD_METRICS_BUCKETS        48      // power-of-two buckets, the last one open ended
+
+enum aesd_metric_counter
+{
+    AESD_METRIC_ACCEPTS,                    // connections accepted
+    AESD_METRIC_CLOSES,                     // connections destroyed
+    AESD_METRIC_BYTES_IN,                   // bytes received from clients
+    AESD_METRIC_BYTES_OUT,                  // reply bytes sent to clients
+    AESD_METRIC_PACKETS,                    // packets and frames handled
+    AESD_METRIC_PACKETS_COMMITTED,          // appends that reached the store
+    AESD_METRIC_REFUSED_TOTAL,              // connections refused at the total limit
+    AESD_METRIC_REFUSED_SOURCE,             // connections refused at the per-source limit
+    AESD_METRIC_IDLE_TIMEOUTS,              // connections closed for making no progress
+    AESD_METRIC_OVERSIZED,                  // connections closed for a packet over the limit
+    AESD_METRIC_COMPRESS_IN,                // history bytes sent compressed
+    AESD_METRIC_COMPRESS_OUT,               // compressed bytes they were sent as
+    AESD_METRIC_COMPRESS_BLOCKS,            // blocks compressed
+    AESD_METRIC_COMPRESS_CACHE_HITS,        // blocks copied from the compressed block cache
+    AESD_METRIC_COUNTER_COUNT,
+};
+
+enum aesd_metric_histogram
+{
+    AESD_METRIC_STORE_LOCK_WAIT,            // ns spent waiting for the store mutex
+    AESD_METRIC_STORE_LOCK_HOLD,            // ns the store mutex was held
+    AESD_METRIC_REPLY_SIZE,                 // bytes per reply
+    AESD_METRIC_PACKET_LATENCY,             // ns from receiving a packet to its reply being sent
+    AESD_METRIC_HISTOGRAM_COUNT,
+};
+
+struct aesd_metrics_histogram
+{
+    uint64_t buckets[AESD_METRICS_BUCKETS]; // bucket i counts values up to 2^i above those of bucket i - 1
+    uint64_t sum;
+};
+
+/**
+ * Metrics of one thread. Only the owning thread writes it, with plain relaxed
+ * stores, and the exporter sums all blocks when scraped. Blocks are cache-line
+ * aligned so no two threads ever write the same line.
+ */
+struct aesd_metrics_block
+{
+    uint64_t counters[AESD_METRIC_COUNTER_COUNT];
+    struct aesd_metrics_histogram histograms[AESD_METRIC_HISTOGRAM_COUNT];
+    struct aesd_metrics_block *next;
+} __attribute__((aligned(64)));
+
+extern __thread struct aesd_metrics_block *aesdMetricsLocal;
+
+/**
+ * Allocates and registers the calling thread's block; use aesd_metrics_local().
+ */
+struct aesd_metrics_block* aesd_metrics_register(void);
+
+static inline struct aesd_metrics_block* aesd_metrics_local(void)
+{
+    struct aesd_metrics_block *block = aesdMetricsLocal;
+    return __builtin_expect(block != NULL, 1) ? block : aesd_metrics_register();
+}
+
+static inline uint64_t aesd_metrics_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline void aesd_metrics_add(enum aesd_metric_counter counter, uint64_t value)
+{
+    uint64_t *slot = &aesd_metrics_local()->counters[counter];
+    __atomic_store_n(slot, *slot + value, __ATOMIC_RELAXED);
+}
+
+static inline void aesd_metrics_observe(enum aesd_metric_histogram histogram, uint64_t value)
+{
+    struct aesd_metrics_histogram *slot = &aesd_metrics_local()->histograms[histogram];
+    // Inclusive upper bounds, as the exported le="2^i" labels promise
+    unsigned bucket = value <= 1 ? 0 : 64 - __builtin_clzll(value - 1);
+
+    bucket = bucket < AESD_METRICS_BUCKETS ? bucket : AESD_METRICS_BUCKETS - 1;
+    __atomic_store_n(&slot->buckets[bucket], slot->buckets[bucket] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->sum, slot->sum + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Serves the metrics in the Prometheus text format on a unix stream socket at
+ * @param path until @param shutdownFd becomes readable. A client that sends an
+ * HTTP GET gets an HTTP response (curl --unix-socket), anything else just the
+ * text.
+ */
+bool aesd_metrics_start(const char *path, int shutdownFd);
+
+/**
+ * Joins the metrics thread. @param removeSocket is false when a successor
+ * process has bound its own socket at the same path.
+ */
+void aesd_metrics_stop(bool removeSocket);
+
+#endif /* AESD_METRICS_H */
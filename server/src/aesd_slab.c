@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesd_slab.h"
+
+struct aesd_slab_chunk
+{
+    struct aesd_slab_chunk *next;
+    size_t capacity;                    // objects in this chunk
+    size_t carved;                      // objects handed out at least once
+    char *objects;
+};
+
+/**
+ * Adds a chunk of @param capacity objects, which becomes the one new objects
+ * are carved from. Called with the mutex held.
+ */
+static bool addChunk(struct aesd_slab *slab, size_t capacity)
+{
+    struct aesd_slab_chunk *chunk = malloc(sizeof(*chunk));
+    if (chunk == NULL)
+    {
+        return false;
+    }
+    chunk->objects = aligned_alloc(AESD_SLAB_ALIGN, capacity * slab->objectSize);
+    if (chunk->objects == NULL)
+    {
+        free(chunk);
+        return false;
+    }
+    chunk->capacity = capacity;
+    chunk->carved = 0;
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    slab->chunkCount++;
+    return true;
+}
+
+static size_t uncarved(const struct aesd_slab *slab)
+{
+    return slab->chunks != NULL ? slab->chunks->capacity - slab->chunks->carved : 0;
+}
+
+bool aesd_slab_reserve(struct aesd_slab *slab, size_t count)
+{
+    bool reserved = true;
+
+    pthread_mutex_lock(&slab->mutex);
+    size_t available = uncarved(slab);
+    for (void *object = slab->freeList; object != NULL && available < count; object = *(void **)object)
+    {
+        available++;
+    }
+    // Whatever is left of the current chunk is abandoned, at most one chunk's worth
+    if (available < count)
+    {
+        reserved = addChunk(slab, count);
+    }
+    pthread_mutex_unlock(&slab->mutex);
+    return reserved;
+}
+
+void* aesd_slab_alloc(struct aesd_slab *slab)
+{
+    void *object = NULL;
+
+    pthread_mutex_lock(&slab->mutex);
+    if (slab->freeList != NULL)
+    {
+        object = slab->freeList;
+        slab->freeList = *(void **)object;
+    }
+    else if (uncarved(slab) > 0 || addChunk(slab, slab->chunkObjects))
+    {
+        struct aesd_slab_chunk *chunk = slab->chunks;
+        object = chunk->objects + chunk->carved * slab->objectSize;
+        chunk->carved++;
+    }
+    if (object != NULL)
+    {
+        slab->inUse++;
+    }
+    pthread_mutex_unlock(&slab->mutex);
+    return object;
+}
+
+void aesd_slab_free(struct aesd_slab *slab, void *object)
+{
+    if (object == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&slab->mutex);
+    *(void **)object = slab->freeList;
+    slab->freeList = object;
+    slab->inUse--;
+    pthread_mutex_unlock(&slab->mutex);
+}
+
+void aesd_slab_destroy(struct aesd_slab *slab)
+{
+    pthread_mutex_lock(&slab->mutex);
+    while (slab->chunks != NULL)
+    {
+        struct aesd_slab_chunk *chunk = slab->chunks;
+        slab->chunks = chunk->next;
+        free(chunk->objects);
+        free(chunk);
+    }
+    slab->chunkCount = 0;
+    slab->freeList = NULL;
+    pthread_mutex_unlock(&slab->mutex);
+}
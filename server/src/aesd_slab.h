@@ -0,0 +1,60 @@
+/*
+ * aesd_slab.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_SLAB_H
+#define AESD_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define AESD_SLAB_ALIGN             64      // objects never share a cache line
+
+struct aesd_slab_chunk;
+
+/**
+ * Cache of fixed-size objects carved from large chunks. Freed objects go to a
+ * free list and are handed out again, so in steady state neither allocation
+ * nor release reaches malloc(). Chunks are only returned by
+ * aesd_slab_destroy(). Objects are carved lazily, so the pages of a reserved
+ * chunk stay untouched until they are used. Safe to use from any thread.
+ */
+struct aesd_slab
+{
+    pthread_mutex_t mutex;
+    size_t objectSize;                  // rounded up to AESD_SLAB_ALIGN
+    size_t chunkObjects;                // objects per chunk when the slab grows
+    void *freeList;                     // released objects, linked through their first word
+    struct aesd_slab_chunk *chunks;     // newest first, objects carved from the newest only
+    size_t chunkCount;
+    size_t inUse;
+};
+
+#define AESD_SLAB_INITIALIZER(size, perChunk) \
+    { .mutex = PTHREAD_MUTEX_INITIALIZER, \
+      .objectSize = ((size) + AESD_SLAB_ALIGN - 1) & ~(size_t)(AESD_SLAB_ALIGN - 1), \
+      .chunkObjects = (perChunk) }
+
+/**
+ * Makes sure @param count more objects can be handed out without the slab
+ * growing.
+ */
+bool aesd_slab_reserve(struct aesd_slab *slab, size_t count);
+
+/**
+ * Returns an uninitialized object, or NULL when out of memory.
+ */
+void* aesd_slab_alloc(struct aesd_slab *slab);
+void aesd_slab_free(struct aesd_slab *slab, void *object);
+
+/**
+ * Releases every chunk; no object of @param slab may be in use.
+ */
+void aesd_slab_destroy(struct aesd_slab *slab);
+
+#endif /* AESD_SLAB_H */
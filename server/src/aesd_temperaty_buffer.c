@@ -1,31 +1,46 @@
-
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
 
 #include "aesd_temperaty_buffer.h"
+#include "aesd_log.h"
+
+#define AESD_TEMPERARY_BUFFER_MIN_CAPACITY  512
 
 void aesd_temperary_buffer_init(struct aesd_temperary_buffer *bufferTemperary)
 {
     bufferTemperary->buffptr = NULL;
     bufferTemperary->size = 0;
+    bufferTemperary->capacity = 0;
 }
 
 void aesd_temperary_buffer_clean(struct aesd_temperary_buffer *bufferTemperary)
 {
     if (NULL != bufferTemperary->buffptr)
     {
-        printf("Cleaning temporary buffer\n");
+        AESD_LOG(LOG_DEBUG, "Cleaning temporary buffer");
         // Free the memory allocated for the buffer
         free((void *)bufferTemperary->buffptr);
         bufferTemperary->buffptr = NULL;
         bufferTemperary->size = 0;
+        bufferTemperary->capacity = 0;
     }
     else
     {
-        printf("Temporary buffer is already clean\n");
+        AESD_LOG(LOG_DEBUG, "Temporary buffer is already clean");
+    }
+}
+
+void aesd_temperary_buffer_reset(struct aesd_temperary_buffer *bufferTemperary)
+{
+    if (bufferTemperary->capacity > AESD_TEMPERARY_BUFFER_KEEP_MAX)
+    {
+        aesd_temperary_buffer_clean(bufferTemperary);
+        return;
     }
+    // Keep the storage for the next packet
+    bufferTemperary->size = 0;
 }
 
 bool aesd_temperary_buffer_is_empty(struct aesd_temperary_buffer *bufferTemperary)
@@ -33,35 +48,48 @@ bool aesd_temperary_buffer_is_empty(struct aesd_temperary_buffer *bufferTemperar
     return (bufferTemperary->buffptr == NULL || bufferTemperary->size == 0);
 }
 
-bool aesd_temperary_buffer_add(struct aesd_temperary_buffer *bufferTemperary, const char *data, size_t size)
+char* aesd_temperary_buffer_reserve(struct aesd_temperary_buffer *bufferTemperary, size_t size)
 {
+    if (bufferTemperary->capacity - bufferTemperary->size >= size)
+    {
+        return bufferTemperary->buffptr + bufferTemperary->size;
+    }
 
-    char* buffptrLast = bufferTemperary->buffptr;
-
-    if (buffptrLast == NULL)
+    size_t capacity = bufferTemperary->capacity > 0 ? bufferTemperary->capacity : AESD_TEMPERARY_BUFFER_MIN_CAPACITY;
+    while (capacity - bufferTemperary->size < size)
     {
-        // If the buffer is empty, allocate new memory
-        buffptrLast = malloc(size);
-        if (buffptrLast == NULL)
+        if (capacity > SIZE_MAX / 2)
         {
-            return false;
+            return NULL;
         }
-        memcpy(buffptrLast, data, size);
-        bufferTemperary->buffptr = buffptrLast;
-        bufferTemperary->size = size;
-        return true;
-    }    
+        capacity *= 2;
+    }
 
-    char* buffptrNew = malloc(bufferTemperary->size + size);
+    char* buffptrNew = realloc(bufferTemperary->buffptr, capacity);
     if (NULL == buffptrNew)
     {
-        return false;
+        return NULL;
     }
-    
-    memcpy(buffptrNew, buffptrLast, bufferTemperary->size);
-    memcpy(buffptrNew + bufferTemperary->size, data, size);
-    free(buffptrLast);
     bufferTemperary->buffptr = buffptrNew;
+    bufferTemperary->capacity = capacity;
+
+    return bufferTemperary->buffptr + bufferTemperary->size;
+}
+
+void aesd_temperary_buffer_commit(struct aesd_temperary_buffer *bufferTemperary, size_t size)
+{
+    bufferTemperary->size += size;
+}
+
+bool aesd_temperary_buffer_add(struct aesd_temperary_buffer *bufferTemperary, const char *data, size_t size)
+{
+    char* destination = aesd_temperary_buffer_reserve(bufferTemperary, size);
+    if (destination == NULL)
+    {
+        return false;
+    }
+
+    memcpy(destination, data, size);
     bufferTemperary->size += size;
 
     return true;
@@ -74,5 +102,6 @@ void aesd_temperary_buffer_delete(struct aesd_temperary_buffer *bufferTemperary)
         free(bufferTemperary->buffptr);
         bufferTemperary->buffptr = NULL;
         bufferTemperary->size = 0;
+        bufferTemperary->capacity = 0;
     }
-}
\ No newline at end of file
+}
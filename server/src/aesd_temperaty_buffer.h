@@ -16,14 +16,22 @@
 #include <stdbool.h>
 #endif
 
+/**
+ * Storage larger than this is released by aesd_temperary_buffer_reset() instead
+ * of being kept around for the next packet.
+ */
+#define AESD_TEMPERARY_BUFFER_KEEP_MAX  (1024 * 1024)
+
 struct aesd_temperary_buffer
 {
     char *buffptr;
     size_t size;
+    size_t capacity;
 };
 
 void aesd_temperary_buffer_init(struct aesd_temperary_buffer *bufferTemperary);
 void aesd_temperary_buffer_clean(struct aesd_temperary_buffer *bufferTemperary);
+void aesd_temperary_buffer_reset(struct aesd_temperary_buffer *bufferTemperary);
 
 bool aesd_temperary_buffer_is_empty(struct aesd_temperary_buffer *bufferTemperary);
 
@@ -31,4 +39,12 @@ bool aesd_temperary_buffer_is_empty(struct aesd_temperary_buffer *bufferTemperar
 bool aesd_temperary_buffer_add(struct aesd_temperary_buffer *bufferTemperary, const char *data, size_t size);
 void aesd_temperary_buffer_delete(struct aesd_temperary_buffer *bufferTemperary);
 
+/**
+ * Makes room for at least @param size more bytes, growing the capacity
+ * geometrically, and returns where they go. Data written there becomes part of
+ * the buffer after aesd_temperary_buffer_commit().
+ */
+char* aesd_temperary_buffer_reserve(struct aesd_temperary_buffer *bufferTemperary, size_t size);
+void aesd_temperary_buffer_commit(struct aesd_temperary_buffer *bufferTemperary, size_t size);
+
 #endif /* AESD_TEMPERARY_BUFFER_H */
@@ -0,0 +1,68 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "aesd_timestamp.h"
+#include "aesd_backing_store.h"
+#include "aesd_log.h"
+
+// The line only changes once a second, so it is formatted once per second no
+// matter how short the interval is
+static time_t cachedSecond = (time_t)-1;
+static char cachedLine[160];
+static size_t cachedLength = 0;
+
+int aesd_timestamp_timer_open(unsigned intervalMs)
+{
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0)
+    {
+        return -1;
+    }
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = intervalMs / 1000;
+    spec.it_interval.tv_nsec = (long)(intervalMs % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(timerFd, 0, &spec, NULL) < 0)
+    {
+        close(timerFd);
+        return -1;
+    }
+    return timerFd;
+}
+
+void aesd_timestamp_on_timer(int timerFd)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        // Spurious wakeup, or the expiration was already consumed
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (now != cachedSecond)
+    {
+        struct tm tm_info;
+        char time_str[128];
+
+        localtime_r(&now, &tm_info);
+        strftime(time_str, sizeof(time_str), "%a, %d %b %Y %H:%M:%S %z", &tm_info);
+        cachedLength = (size_t)snprintf(cachedLine, sizeof(cachedLine), "timestamp:%s\n", time_str);
+        if (cachedLength >= sizeof(cachedLine))
+        {
+            cachedLength = sizeof(cachedLine) - 1;
+        }
+        cachedSecond = now;
+    }
+
+    if (aesd_backing_store_append(cachedLine, cachedLength) == false)
+    {
+        AESD_LOG(LOG_ERR, "Failed to append timestamp");
+    }
+}
@@ -0,0 +1,27 @@
+/*
+ * aesd_timestamp.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_TIMESTAMP_H
+#define AESD_TIMESTAMP_H
+
+#define AESD_TIMESTAMP_DEFAULT_INTERVAL_MS  10000
+
+/**
+ * Opens a non-blocking timerfd that expires every @param intervalMs
+ * milliseconds, for the caller to poll next to its other descriptors.
+ * Returns -1 on failure.
+ */
+int aesd_timestamp_timer_open(unsigned intervalMs);
+
+/**
+ * Called when @param timerFd is readable: consumes the expirations and appends
+ * one timestamp line to the backing store. Expirations missed while the caller
+ * was busy are coalesced into that single line.
+ */
+void aesd_timestamp_on_timer(int timerFd);
+
+#endif /* AESD_TIMESTAMP_H */
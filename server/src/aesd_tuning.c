@@ -0,0 +1,168 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "aesd_tuning.h"
+#include "aesd_log.h"
+
+#define TUNING_PROFILE_SIZE     256
+
+static struct aesd_tuning tuning;                   // read-only once set
+static atomic_bool busyPollRefused = false;         // stop retrying SO_BUSY_POLL
+
+/**
+ * Parses the value of "key=value" into @param value.
+ */
+static bool parseValue(const char *token, const char *key, int *value)
+{
+    size_t keyLen = strlen(key);
+    if (strncmp(token, key, keyLen) != 0 || token[keyLen] != '=')
+    {
+        return false;
+    }
+
+    char *end;
+    errno = 0;
+    long parsed = strtol(token + keyLen + 1, &end, 10);
+    if (errno != 0 || end == token + keyLen + 1 || *end != '\0' || parsed < 0 || parsed > INT_MAX)
+    {
+        return false;
+    }
+    *value = (int)parsed;
+    return true;
+}
+
+bool aesd_tuning_parse(const char *profile, struct aesd_tuning *result)
+{
+    char copy[TUNING_PROFILE_SIZE];
+    char *saved;
+
+    if (strlen(profile) >= sizeof(copy))
+    {
+        return false;
+    }
+    strcpy(copy, profile);
+    memset(result, 0, sizeof(*result));
+
+    for (char *token = strtok_r(copy, ",", &saved); token != NULL; token = strtok_r(NULL, ",", &saved))
+    {
+        if (strcmp(token, "latency") == 0)
+        {
+            result->noDelay = true;
+            result->cork = true;
+            result->deferAcceptSec = 1;
+        }
+        else if (strcmp(token, "nodelay") == 0)
+        {
+            result->noDelay = true;
+        }
+        else if (strcmp(token, "cork") == 0)
+        {
+            result->cork = true;
+        }
+        else if (strcmp(token, "none") != 0 &&
+                 parseValue(token, "sndbuf", &result->sendBuffer) == false &&
+                 parseValue(token, "rcvbuf", &result->receiveBuffer) == false &&
+                 parseValue(token, "defer_accept", &result->deferAcceptSec) == false &&
+                 parseValue(token, "busy_poll", &result->busyPollUs) == false)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void aesd_tuning_set(const struct aesd_tuning *profile)
+{
+    tuning = *profile;
+}
+
+void aesd_tuning_describe(char *text, size_t size)
+{
+    int length = snprintf(text, size, "%s%s", tuning.noDelay ? " nodelay" : "", tuning.cork ? " cork" : "");
+    if (tuning.sendBuffer > 0 && length >= 0 && (size_t)length < size)
+    {
+        length += snprintf(text + length, size - length, " sndbuf=%d", tuning.sendBuffer);
+    }
+    if (tuning.receiveBuffer > 0 && length >= 0 && (size_t)length < size)
+    {
+        length += snprintf(text + length, size - length, " rcvbuf=%d", tuning.receiveBuffer);
+    }
+    if (tuning.deferAcceptSec > 0 && length >= 0 && (size_t)length < size)
+    {
+        length += snprintf(text + length, size - length, " defer_accept=%d", tuning.deferAcceptSec);
+    }
+    if (tuning.busyPollUs > 0 && length >= 0 && (size_t)length < size)
+    {
+        length += snprintf(text + length, size - length, " busy_poll=%d", tuning.busyPollUs);
+    }
+    if (length == 0)
+    {
+        snprintf(text, size, " none");
+    }
+}
+
+/**
+ * Sets one option, logging a failure; none of them is needed to serve.
+ */
+static bool setOption(int fd, int level, int name, int value, const char *label)
+{
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0)
+    {
+        AESD_LOG(LOG_WARNING, "Failed to set %s: %s", label, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void aesd_tuning_apply_listener(int listenFd)
+{
+    // Set before listen() so the window scale offered to clients matches
+    if (tuning.sendBuffer > 0)
+    {
+        setOption(listenFd, SOL_SOCKET, SO_SNDBUF, tuning.sendBuffer, "SO_SNDBUF");
+    }
+    if (tuning.receiveBuffer > 0)
+    {
+        setOption(listenFd, SOL_SOCKET, SO_RCVBUF, tuning.receiveBuffer, "SO_RCVBUF");
+    }
+    if (tuning.deferAcceptSec > 0)
+    {
+        setOption(listenFd, IPPROTO_TCP, TCP_DEFER_ACCEPT, tuning.deferAcceptSec, "TCP_DEFER_ACCEPT");
+    }
+}
+
+void aesd_tuning_apply_connection(int sockFd, sa_family_t family)
+{
+    if (family != AF_INET && family != AF_INET6)
+    {
+        return;
+    }
+    if (tuning.noDelay)
+    {
+        setOption(sockFd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if (tuning.busyPollUs > 0 && atomic_load_explicit(&busyPollRefused, memory_order_relaxed) == false &&
+        setOption(sockFd, SOL_SOCKET, SO_BUSY_POLL, tuning.busyPollUs, "SO_BUSY_POLL") == false)
+    {
+        // Needs CAP_NET_ADMIN above net.core.busy_read; warn once, not per connection
+        atomic_store_explicit(&busyPollRefused, true, memory_order_relaxed);
+    }
+}
+
+bool aesd_tuning_corks(void)
+{
+    return tuning.cork;
+}
+
+void aesd_tuning_cork(int sockFd, bool on)
+{
+    int value = on;
+    // Uncorking pushes out the partial segment left at the end
+    setsockopt(sockFd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+}
@@ -0,0 +1,58 @@
+/*
+ * aesd_tuning.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_TUNING_H
+#define AESD_TUNING_H
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+/**
+ * Socket options for TCP listeners and the connections accepted from them.
+ * Anything left at zero keeps the kernel default; unix sockets are not tuned.
+ */
+struct aesd_tuning
+{
+    bool noDelay;               // TCP_NODELAY: replies leave without waiting for ACKs
+    bool cork;                  // TCP_CORK around replies written in several pieces
+    int sendBuffer;             // SO_SNDBUF bytes, set on the listener
+    int receiveBuffer;          // SO_RCVBUF bytes, set on the listener
+    int deferAcceptSec;         // TCP_DEFER_ACCEPT: accept once the first bytes arrived
+    int busyPollUs;             // SO_BUSY_POLL: spin on the device queue before sleeping
+};
+
+/**
+ * Parses a comma-separated profile such as "nodelay,cork,sndbuf=262144" into
+ * @param tuning. Keys are nodelay, cork, sndbuf=, rcvbuf=, defer_accept=
+ * (seconds) and busy_poll= (microseconds); "latency" stands for
+ * nodelay,cork,defer_accept=1. Returns false on an unknown key or value.
+ */
+bool aesd_tuning_parse(const char *profile, struct aesd_tuning *tuning);
+void aesd_tuning_set(const struct aesd_tuning *tuning);
+
+/**
+ * Describes the profile in effect for the startup log.
+ */
+void aesd_tuning_describe(char *text, size_t size);
+
+/**
+ * Applies the listener options; accepted connections inherit the buffer sizes.
+ */
+void aesd_tuning_apply_listener(int listenFd);
+
+/**
+ * Applies the per-connection options to a socket of address @param family.
+ */
+void aesd_tuning_apply_connection(int sockFd, sa_family_t family);
+
+/**
+ * Whether replies written in several pieces are corked.
+ */
+bool aesd_tuning_corks(void);
+void aesd_tuning_cork(int sockFd, bool on);
+
+#endif /* AESD_TUNING_H */
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "aesd_upgrade.h"
+#include "aesd_log.h"
+
+#define UPGRADE_MAGIC       0x41455355u
+#define UPGRADE_MAX_FDS     253         // SCM_MAX_FD
+#define UPGRADE_READY       'R'
+
+extern char **environ;
+
+/**
+ * Copy of the environment with AESD_UPGRADE_ENV set to @param fd.
+ */
+static char** upgradeEnvironment(int fd, char *variable, size_t size)
+{
+    size_t count = 0;
+    while (environ[count] != NULL)
+    {
+        count++;
+    }
+
+    char **envp = malloc((count + 2) * sizeof(char *));
+    if (envp == NULL)
+    {
+        return NULL;
+    }
+    snprintf(variable, size, "%s=%d", AESD_UPGRADE_ENV, fd);
+    envp[0] = variable;
+    memcpy(envp + 1, environ, (count + 1) * sizeof(char *));
+    return envp;
+}
+
+static bool sendHeader(int sockFd, const struct aesd_upgrade_header *header, const int *fds)
+{
+    int count = aesd_upgrade_fd_count(header);
+    char control[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+    struct iovec iov = { .iov_base = (void *)header, .iov_len = sizeof(*header) };
+    struct msghdr message = {0};
+
+    if (count < 1 || count > UPGRADE_MAX_FDS)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    memset(control, 0, sizeof(control));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+
+    return sendmsg(sockFd, &message, MSG_NOSIGNAL) == (ssize_t)sizeof(*header);
+}
+
+int aesd_upgrade_spawn(const char *path, char *const argv[], const sigset_t *mask,
+                       const struct aesd_upgrade_header *header, const int *fds, pid_t *pid)
+{
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+    {
+        return -1;
+    }
+
+    char variable[64];
+    char **envp = upgradeEnvironment(pair[1], variable, sizeof(variable));
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    // Duplicating onto itself clears close-on-exec for the successor's end only
+    posix_spawn_file_actions_adddup2(&actions, pair[1], pair[1]);
+    posix_spawnattr_setsigmask(&attr, mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    // posix_spawn() does not copy the page tables of a server holding a large log
+    int spawned = envp != NULL ? posix_spawn(pid, path, &actions, &attr, argv, envp) : ENOMEM;
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    free(envp);
+    close(pair[1]);
+    if (spawned != 0)
+    {
+        close(pair[0]);
+        errno = spawned;
+        return -1;
+    }
+
+    struct aesd_upgrade_header message = *header;
+    message.magic = UPGRADE_MAGIC;
+    if (sendHeader(pair[0], &message, fds) == false)
+    {
+        int error = errno;
+        close(pair[0]);
+        kill(*pid, SIGKILL);
+        waitpid(*pid, NULL, 0);
+        errno = error;
+        return -1;
+    }
+    return pair[0];
+}
+
+bool aesd_upgrade_wait_ready(int sockFd, pid_t pid, int timeoutMs)
+{
+    struct pollfd readable = { .fd = sockFd, .events = POLLIN };
+    char ready = 0;
+
+    int ret;
+    do
+    {
+        ret = poll(&readable, 1, timeoutMs);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret > 0 && read(sockFd, &ready, 1) == 1 && ready == UPGRADE_READY)
+    {
+        return true;
+    }
+    if (ret == 0)
+    {
+        AESD_LOG(LOG_ERR, "Process %d did not report within %d ms", (int)pid, timeoutMs);
+        kill(pid, SIGKILL);
+    }
+    waitpid(pid, NULL, 0);
+    return false;
+}
+
+int aesd_upgrade_inherited(void)
+{
+    const char *value = getenv(AESD_UPGRADE_ENV);
+    if (value == NULL)
+    {
+        return -1;
+    }
+
+    char *end;
+    long fd = strtol(value, &end, 10);
+    // Not to be seen by this process's own successor
+    unsetenv(AESD_UPGRADE_ENV);
+    if (*end != '\0' || fd < 0 || fd > INT32_MAX || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+    {
+        return -1;
+    }
+    return (int)fd;
+}
+
+bool aesd_upgrade_receive(int sockFd, struct aesd_upgrade_header *header, int *fds, int maxFds)
+{
+    char control[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+    struct iovec iov = { .iov_base = header, .iov_len = sizeof(*header) };
+    struct msghdr message = {0};
+
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do
+    {
+        received = recvmsg(sockFd, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+
+    struct cmsghdr *cmsg = received == (ssize_t)sizeof(*header) ? CMSG_FIRSTHDR(&message) : NULL;
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        return false;
+    }
+
+    int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    int *passedFds = (int *)CMSG_DATA(cmsg);
+    if (header->magic != UPGRADE_MAGIC || count != aesd_upgrade_fd_count(header) || count > maxFds)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            close(passedFds[i]);
+        }
+        return false;
+    }
+    memcpy(fds, passedFds, count * sizeof(int));
+    return true;
+}
+
+void aesd_upgrade_ready(int sockFd)
+{
+    char ready = UPGRADE_READY;
+    ssize_t res = write(sockFd, &ready, 1);
+    (void)res; // Unused variable
+    close(sockFd);
+}
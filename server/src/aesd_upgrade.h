@@ -0,0 +1,66 @@
+/*
+ * aesd_upgrade.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_UPGRADE_H
+#define AESD_UPGRADE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#define AESD_UPGRADE_ENV    "AESD_UPGRADE_FD"
+
+/**
+ * What a server hands its successor, in this order: the TCP listener
+ * shards, the unix socket listener and the descriptor of the in-memory log.
+ */
+struct aesd_upgrade_header
+{
+    uint32_t magic;
+    uint32_t listeners;         // TCP listener shards
+    uint32_t unixListener;      // 1 when the unix socket listener follows them
+    uint32_t history;           // 1 when the log comes last
+};
+
+static inline int aesd_upgrade_fd_count(const struct aesd_upgrade_header *header)
+{
+    return (int)(header->listeners + header->unixListener + header->history);
+}
+
+/**
+ * Starts @param path with @param argv as the successor of this process, with
+ * the signal mask @param mask, and sends it @param header and @param fds over
+ * a unix socket. Returns that socket, on which the successor reports that it
+ * is serving, or -1. @param pid receives the successor's pid.
+ */
+int aesd_upgrade_spawn(const char *path, char *const argv[], const sigset_t *mask,
+                       const struct aesd_upgrade_header *header, const int *fds, pid_t *pid);
+
+/**
+ * Waits up to @param timeoutMs for the successor @param pid to report on
+ * @param sockFd. A successor that fails or does not report in time is reaped.
+ */
+bool aesd_upgrade_wait_ready(int sockFd, pid_t pid, int timeoutMs);
+
+/**
+ * The successor's end of the socket, or -1 when this process was not started
+ * by aesd_upgrade_spawn().
+ */
+int aesd_upgrade_inherited(void);
+
+/**
+ * Receives @param header and up to @param maxFds descriptors into @param fds.
+ */
+bool aesd_upgrade_receive(int sockFd, struct aesd_upgrade_header *header, int *fds, int maxFds);
+
+/**
+ * Tells the predecessor this process is serving, so it may stop accepting.
+ */
+void aesd_upgrade_ready(int sockFd);
+
+#endif /* AESD_UPGRADE_H */
@@ -0,0 +1,891 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "aesd_uring.h"
+#include "aesd_log.h"
+#include "aesd_metrics.h"
+#include "aesd_slab.h"
+#include "aesd_thread.h"
+#include "aesd_tuning.h"
+
+#define URING_SQ_ENTRIES        256
+#define URING_CQ_ENTRIES        4096
+#define URING_BUFFER_COUNT      256     // power of two
+#define URING_BUFFER_SIZE       4096
+#define URING_BUFFER_GROUP      0
+#define URING_SEND_IOVECS       16
+
+// Kind of request, kept in the low bits of user_data next to the pointer of
+// the loop or connection it belongs to
+enum uringOp
+{
+    URING_OP_ACCEPT,
+    URING_OP_SHUTDOWN,
+    URING_OP_CANCEL,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_IDLE_CHECK,
+    URING_OP_DRAIN,
+};
+#define URING_OP_MASK           7ULL
+
+struct aesd_uring_connection
+{
+    struct aesd_connection *connection;
+    unsigned inFlight;                  // requests that will still post a completion
+    bool receiving;                     // a recv is armed
+    bool recvPaused;                    // its cancellation was requested at the high-water mark
+    bool sending;                       // a sendmsg is armed
+    bool peerClosed;                    // recv saw the end of the stream
+    bool closing;                       // destroyed once inFlight drops to zero
+    struct msghdr message;
+    struct iovec iov[URING_SEND_IOVECS];
+    struct aesd_uring_connection *next;
+    struct aesd_uring_connection *prev;
+};
+
+// Entries of all loops, freed back by the loop that owns them
+static struct aesd_slab entrySlab = AESD_SLAB_INITIALIZER(sizeof(struct aesd_uring_connection), 64);
+
+static int ringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int ringRegister(int ringFd, unsigned opcode, void *arg, unsigned count)
+{
+    return (int)syscall(__NR_io_uring_register, ringFd, opcode, arg, count);
+}
+
+static uint64_t userData(void *owner, enum uringOp op)
+{
+    return (uint64_t)(uintptr_t)owner | op;
+}
+
+static void ringUnmap(struct aesd_uring *loop)
+{
+    if (loop->sqes != NULL)
+    {
+        munmap(loop->sqes, loop->sqesSize);
+    }
+    if (loop->cqRing != NULL && loop->cqRing != loop->sqRing)
+    {
+        munmap(loop->cqRing, loop->cqRingSize);
+    }
+    if (loop->sqRing != NULL)
+    {
+        munmap(loop->sqRing, loop->sqRingSize);
+    }
+    loop->sqes = NULL;
+    loop->cqRing = NULL;
+    loop->sqRing = NULL;
+}
+
+static void ringClose(struct aesd_uring *loop)
+{
+    ringUnmap(loop);
+    if (loop->ringFd >= 0)
+    {
+        close(loop->ringFd);
+        loop->ringFd = -1;
+    }
+    free(loop->bufRing);
+    free(loop->buffers);
+    loop->bufRing = NULL;
+    loop->buffers = NULL;
+}
+
+/**
+ * Creates the ring, maps it and registers the provided receive buffers.
+ */
+static bool ringOpen(struct aesd_uring *loop, unsigned sqEntries, unsigned cqEntries)
+{
+    struct io_uring_params params;
+
+    loop->ringFd = -1;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = cqEntries;
+    loop->ringFd = ringSetup(sqEntries, &params);
+    if (loop->ringFd < 0 && errno == EINVAL)
+    {
+        // Kernels before 5.19 do not know the cooperative task running hint
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = cqEntries;
+        loop->ringFd = ringSetup(sqEntries, &params);
+    }
+    if (loop->ringFd < 0)
+    {
+        return false;
+    }
+    if ((params.features & IORING_FEAT_FAST_POLL) == 0 || (params.features & IORING_FEAT_NODROP) == 0)
+    {
+        errno = ENOTSUP;
+        goto fail;
+    }
+
+    loop->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    loop->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (loop->cqRingSize > loop->sqRingSize)
+        {
+            loop->sqRingSize = loop->cqRingSize;
+        }
+        loop->cqRingSize = loop->sqRingSize;
+    }
+
+    loop->sqRing = mmap(NULL, loop->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        loop->ringFd, IORING_OFF_SQ_RING);
+    if (loop->sqRing == MAP_FAILED)
+    {
+        loop->sqRing = NULL;
+        goto fail;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        loop->cqRing = loop->sqRing;
+    }
+    else
+    {
+        loop->cqRing = mmap(NULL, loop->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            loop->ringFd, IORING_OFF_CQ_RING);
+        if (loop->cqRing == MAP_FAILED)
+        {
+            loop->cqRing = NULL;
+            goto fail;
+        }
+    }
+    loop->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    loop->sqes = mmap(NULL, loop->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      loop->ringFd, IORING_OFF_SQES);
+    if (loop->sqes == MAP_FAILED)
+    {
+        loop->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = loop->sqRing;
+    char *cq = loop->cqRing;
+    loop->sqHead = (unsigned *)(sq + params.sq_off.head);
+    loop->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    loop->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    loop->sqLocalTail = *loop->sqTail;
+    loop->cqHead = (unsigned *)(cq + params.cq_off.head);
+    loop->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    loop->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    loop->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Entries are always used in ring order, so the indirection array is fixed
+    unsigned *sqArray = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++)
+    {
+        sqArray[i] = i;
+    }
+
+    // The kernel picks a buffer for every receive as data arrives, so idle
+    // connections do not hold one
+    void *bufRing = NULL;
+    if (posix_memalign(&bufRing, sysconf(_SC_PAGESIZE), URING_BUFFER_COUNT * sizeof(struct io_uring_buf)) != 0)
+    {
+        errno = ENOMEM;
+        goto fail;
+    }
+    loop->bufRing = bufRing;
+    memset(loop->bufRing, 0, URING_BUFFER_COUNT * sizeof(struct io_uring_buf));
+    loop->buffers = malloc((size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (loop->buffers == NULL)
+    {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)loop->bufRing;
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (ringRegister(loop->ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        goto fail;
+    }
+
+    for (unsigned i = 0; i < URING_BUFFER_COUNT; i++)
+    {
+        struct io_uring_buf *buf = &loop->bufRing->bufs[i];
+        buf->addr = (uint64_t)(uintptr_t)(loop->buffers + (size_t)i * URING_BUFFER_SIZE);
+        buf->len = URING_BUFFER_SIZE;
+        buf->bid = i;
+    }
+    __atomic_store_n(&loop->bufRing->tail, URING_BUFFER_COUNT, __ATOMIC_RELEASE);
+    return true;
+
+fail:
+    {
+        int savedErrno = errno;
+        ringClose(loop);
+        errno = savedErrno;
+    }
+    return false;
+}
+
+/**
+ * Hands buffer @param id back to the kernel once its bytes were consumed.
+ */
+static void recycleBuffer(struct aesd_uring *loop, unsigned id)
+{
+    uint16_t tail = loop->bufRing->tail;
+    struct io_uring_buf *buf = &loop->bufRing->bufs[tail & (URING_BUFFER_COUNT - 1)];
+
+    // Only addr, len and bid: resv of the first entry overlays the tail
+    buf->addr = (uint64_t)(uintptr_t)(loop->buffers + (size_t)id * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = id;
+    __atomic_store_n(&loop->bufRing->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * Hands every queued entry to the kernel; with @param wait also blocks until
+ * at least one completion is posted. This is the loop's only syscall on the
+ * packet path.
+ */
+static bool ringSubmit(struct aesd_uring *loop, bool wait)
+{
+    __atomic_store_n(loop->sqTail, loop->sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = loop->sqLocalTail - __atomic_load_n(loop->sqHead, __ATOMIC_ACQUIRE);
+
+    loop->enterCalls++;
+    if (ringEnter(loop->ringFd, toSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0) < 0)
+    {
+        if (errno == EINTR || errno == EBUSY || errno == EAGAIN)
+        {
+            // Completions must be reaped first; entries stay queued
+            return true;
+        }
+        AESD_LOG(LOG_ERR, "io_uring_enter failed: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static struct io_uring_sqe* nextSqe(struct aesd_uring *loop)
+{
+    if (loop->sqLocalTail - __atomic_load_n(loop->sqHead, __ATOMIC_ACQUIRE) > loop->sqMask)
+    {
+        // Submission ring full: flush it without waiting
+        ringSubmit(loop, false);
+        if (loop->sqLocalTail - __atomic_load_n(loop->sqHead, __ATOMIC_ACQUIRE) > loop->sqMask)
+        {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &loop->sqes[loop->sqLocalTail & loop->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    loop->sqLocalTail++;
+    loop->inFlight++;
+    return sqe;
+}
+
+static void armShutdownPoll(struct aesd_uring *loop)
+{
+    struct io_uring_sqe *sqe = nextSqe(loop);
+    if (sqe == NULL)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop->shutdownFd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = userData(loop, URING_OP_SHUTDOWN);
+}
+
+static void armDrainPoll(struct aesd_uring *loop)
+{
+    struct io_uring_sqe *sqe = nextSqe(loop);
+    if (sqe == NULL)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop->drainFd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = userData(loop, URING_OP_DRAIN);
+}
+
+/**
+ * Stops accepting once the listener is handed over to another process; the
+ * connections already accepted are served on.
+ */
+static void stopAccepting(struct aesd_uring *loop)
+{
+    loop->accepting = false;
+
+    struct io_uring_sqe *sqe = loop->acceptArmed ? nextSqe(loop) : NULL;
+    if (sqe == NULL)
+    {
+        atomic_store(&loop->drained, loop->acceptArmed == false);
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = userData(loop, URING_OP_ACCEPT);
+    sqe->user_data = userData(loop, URING_OP_CANCEL);
+}
+
+static void armAccept(struct aesd_uring *loop)
+{
+    struct io_uring_sqe *sqe = nextSqe(loop);
+    if (sqe == NULL)
+    {
+        AESD_LOG(LOG_ERR, "Submission ring full, cannot accept");
+        return;
+    }
+    loop->acceptArmed = true;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listenFd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = userData(loop, URING_OP_ACCEPT);
+    if (loop->multishotAccept)
+    {
+        // Every completion would overwrite the same address, so the peer is
+        // looked up per connection instead
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+    else
+    {
+        loop->acceptAddrLen = sizeof(loop->acceptAddr);
+        sqe->addr = (uint64_t)(uintptr_t)&loop->acceptAddr;
+        sqe->addr2 = (uint64_t)(uintptr_t)&loop->acceptAddrLen;
+    }
+}
+
+static void cancelAll(struct aesd_uring *loop)
+{
+    struct io_uring_sqe *sqe = nextSqe(loop);
+    if (sqe == NULL)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = userData(loop, URING_OP_CANCEL);
+}
+
+/**
+ * Wakes the loop up after the idle check interval to close idle connections.
+ */
+static void armIdleCheck(struct aesd_uring *loop)
+{
+    int interval = aesd_connection_idle_check_interval();
+    if (interval < 0)
+    {
+        return;
+    }
+
+    struct io_uring_sqe *sqe = nextSqe(loop);
+    if (sqe == NULL)
+    {
+        return;
+    }
+    loop->idleCheck.tv_sec = interval / 1000;
+    loop->idleCheck.tv_nsec = (long long)(interval % 1000) * 1000000;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&loop->idleCheck;
+    sqe->len = 1;
+    sqe->user_data = userData(loop, URING_OP_IDLE_CHECK);
+}
+
+static bool armRecv(struct aesd_uring *loop, struct aesd_uring_connection *entry)
+{
+    struct io_uring_sqe *sqe = nextSqe(loop);
+    if (sqe == NULL)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = entry->connection->sockFd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->ioprio = loop->multishotRecv ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = userData(entry, URING_OP_RECV);
+    entry->receiving = true;
+    entry->inFlight++;
+    return true;
+}
+
+/**
+ * Stops the multishot recv of a connection whose output queue is full; it is
+ * armed again once the replies drain.
+ */
+static bool pauseRecv(struct aesd_uring *loop, struct aesd_uring_connection *entry)
+{
+    struct io_uring_sqe *sqe = nextSqe(loop);
+    if (sqe == NULL)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = userData(entry, URING_OP_RECV);
+    sqe->user_data = userData(loop, URING_OP_CANCEL);
+    entry->recvPaused = true;
+    return true;
+}
+
+static bool armSend(struct aesd_uring *loop, struct aesd_uring_connection *entry)
+{
+    int count = aesd_backing_store_reply_iovecs(&entry->connection->reply, entry->iov, URING_SEND_IOVECS);
+    if (count == 0)
+    {
+        // Nothing in memory to send for a reply that is not done would leave
+        // the connection replying forever
+        return aesd_backing_store_reply_done(&entry->connection->reply);
+    }
+
+    struct io_uring_sqe *sqe = nextSqe(loop);
+    if (sqe == NULL)
+    {
+        return false;
+    }
+    memset(&entry->message, 0, sizeof(entry->message));
+    entry->message.msg_iov = entry->iov;
+    entry->message.msg_iovlen = count;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = entry->connection->sockFd;
+    sqe->addr = (uint64_t)(uintptr_t)&entry->message;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    if (entry->connection->tcp && aesd_tuning_corks() && entry->connection->queuedReplies > 0)
+    {
+        // The next reply follows this one at once; MSG_MORE corks without
+        // the two setsockopt() calls TCP_CORK would cost the loop
+        sqe->msg_flags |= MSG_MORE;
+    }
+    sqe->user_data = userData(entry, URING_OP_SEND);
+    entry->sending = true;
+    entry->inFlight++;
+    return true;
+}
+
+static void closeConnection(struct aesd_uring *loop, struct aesd_uring_connection *entry)
+{
+    if (entry->closing == false)
+    {
+        entry->closing = true;
+        if (entry->inFlight > 0)
+        {
+            // Completes the armed requests, the entry goes once they are in
+            loop->otherCalls++;
+            shutdown(entry->connection->sockFd, SHUT_RDWR);
+        }
+    }
+    if (entry->inFlight > 0)
+    {
+        return;
+    }
+
+    if (entry->prev != NULL)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        loop->connections = entry->next;
+    }
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry->prev;
+    }
+    loop->connectionCount--;
+    loop->packets += entry->connection->packetCount;
+    loop->otherCalls++;
+    aesd_connection_destroy(entry->connection);
+    aesd_slab_free(&entrySlab, entry);
+}
+
+/**
+ * Queues whatever the connection needs next after one of its completions.
+ */
+static void updateConnection(struct aesd_uring *loop, struct aesd_uring_connection *entry)
+{
+    enum aesd_connection_state state = entry->connection->state;
+    bool wantsRead = aesd_connection_wants_read(entry->connection);
+
+    if (entry->closing || state == AESD_CONNECTION_CLOSED ||
+        (entry->peerClosed && state == AESD_CONNECTION_RECEIVING) || loop->running == false)
+    {
+        closeConnection(loop, entry);
+        return;
+    }
+    if (state == AESD_CONNECTION_REPLYING && entry->sending == false && armSend(loop, entry) == false)
+    {
+        closeConnection(loop, entry);
+        return;
+    }
+    if (entry->receiving && wantsRead == false && loop->multishotRecv && entry->recvPaused == false &&
+        pauseRecv(loop, entry) == false)
+    {
+        closeConnection(loop, entry);
+        return;
+    }
+    if (entry->receiving == false && entry->peerClosed == false && wantsRead && armRecv(loop, entry) == false)
+    {
+        closeConnection(loop, entry);
+    }
+}
+
+/**
+ * Closes the connections that made no progress within the idle timeout.
+ */
+static void closeIdle(struct aesd_uring *loop)
+{
+    uint64_t now = aesd_metrics_now_ns();
+    struct aesd_uring_connection *entry = loop->connections;
+
+    while (entry != NULL)
+    {
+        struct aesd_uring_connection *next = entry->next;
+        if (entry->closing == false && aesd_connection_check_idle(entry->connection, now) == AESD_CONNECTION_CLOSED)
+        {
+            closeConnection(loop, entry);
+        }
+        entry = next;
+    }
+}
+
+static void handleAccept(struct aesd_uring *loop, int res, bool more)
+{
+    if (res < 0)
+    {
+        if (res == -EINVAL && loop->multishotAccept)
+        {
+            AESD_LOG(LOG_INFO, "Multishot accept not supported, using single-shot accept");
+            loop->multishotAccept = false;
+        }
+        else if (res != -ECANCELED && res != -EINTR && res != -ECONNABORTED)
+        {
+            AESD_LOG(LOG_ERR, "accept failed: %s", strerror(-res));
+        }
+    }
+    else if (loop->running == false)
+    {
+        close(res);
+    }
+    else
+    {
+        struct sockaddr_storage clientAddr = loop->acceptAddr;
+        socklen_t clientLen = loop->acceptAddrLen;
+        if (loop->multishotAccept)
+        {
+            clientLen = sizeof(clientAddr);
+            loop->otherCalls++;
+            if (getpeername(res, (struct sockaddr *)&clientAddr, &clientLen) < 0)
+            {
+                clientLen = 0;
+            }
+        }
+
+        struct aesd_uring_connection *entry = aesd_slab_alloc(&entrySlab);
+        if (entry != NULL)
+        {
+            memset(entry, 0, sizeof(*entry));
+        }
+        struct aesd_connection *connection = entry != NULL ? aesd_connection_create(res, (struct sockaddr *)&clientAddr, clientLen) : NULL;
+        if (connection == NULL)
+        {
+            if (entry == NULL || errno != ECONNREFUSED)
+            {
+                AESD_LOG(LOG_ERR, "Failed to allocate client connection");
+            }
+            aesd_slab_free(&entrySlab, entry);
+            close(res);
+        }
+        else
+        {
+            entry->connection = connection;
+            entry->next = loop->connections;
+            if (loop->connections != NULL)
+            {
+                loop->connections->prev = entry;
+            }
+            loop->connections = entry;
+            loop->connectionCount++;
+            updateConnection(loop, entry);
+        }
+    }
+
+    if (more == false)
+    {
+        loop->acceptArmed = false;
+        if (loop->running && loop->accepting)
+        {
+            armAccept(loop);
+        }
+        else if (loop->accepting == false)
+        {
+            // Whatever was accepted before the cancel is in the loop by now
+            atomic_store(&loop->drained, true);
+        }
+    }
+}
+
+static void handleRecv(struct aesd_uring *loop, struct aesd_uring_connection *entry, int res, unsigned flags)
+{
+    bool more = (flags & IORING_CQE_F_MORE) != 0;
+    bool paused = entry->recvPaused;
+
+    if (more == false)
+    {
+        entry->receiving = false;
+        entry->recvPaused = false;
+    }
+
+    if (flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned id = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0 && entry->closing == false)
+        {
+            aesd_connection_on_received(entry->connection, loop->buffers + (size_t)id * URING_BUFFER_SIZE, res);
+        }
+        recycleBuffer(loop, id);
+    }
+
+    if (res == 0)
+    {
+        entry->peerClosed = true;
+    }
+    else if (res == -ECANCELED && paused)
+    {
+        // Stopped at the high-water mark, see pauseRecv()
+    }
+    else if (res == -EINVAL && loop->multishotRecv)
+    {
+        AESD_LOG(LOG_INFO, "Multishot recv not supported, using single-shot recv");
+        loop->multishotRecv = false;
+    }
+    else if (res < 0 && res != -ENOBUFS)
+    {
+        if (res != -ECANCELED && res != -ECONNRESET)
+        {
+            AESD_LOG(LOG_ERR, "recv failed: %s", strerror(-res));
+        }
+        closeConnection(loop, entry);
+        return;
+    }
+    updateConnection(loop, entry);
+}
+
+static void handleSend(struct aesd_uring *loop, struct aesd_uring_connection *entry, int res)
+{
+    entry->sending = false;
+    if (res < 0)
+    {
+        if (res != -ECANCELED && res != -EPIPE && res != -ECONNRESET)
+        {
+            AESD_LOG(LOG_ERR, "sendmsg failed: %s", strerror(-res));
+        }
+        closeConnection(loop, entry);
+        return;
+    }
+    if (entry->closing == false)
+    {
+        aesd_connection_on_sent(entry->connection, res);
+    }
+    updateConnection(loop, entry);
+}
+
+static void reapCompletions(struct aesd_uring *loop)
+{
+    unsigned head = *loop->cqHead;
+    unsigned tail = __atomic_load_n(loop->cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &loop->cqes[head & loop->cqMask];
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        void *owner = (void *)(uintptr_t)(data & ~URING_OP_MASK);
+        bool more = (flags & IORING_CQE_F_MORE) != 0;
+
+        head++;
+        // Free the slot before handling, which may queue more requests
+        __atomic_store_n(loop->cqHead, head, __ATOMIC_RELEASE);
+        if (more == false)
+        {
+            loop->inFlight--;
+        }
+
+        switch ((enum uringOp)(data & URING_OP_MASK))
+        {
+        case URING_OP_SHUTDOWN:
+            loop->running = false;
+            cancelAll(loop);
+            break;
+        case URING_OP_CANCEL:
+            break;
+        case URING_OP_DRAIN:
+            if (loop->running && res >= 0)
+            {
+                stopAccepting(loop);
+            }
+            break;
+        case URING_OP_IDLE_CHECK:
+            if (loop->running)
+            {
+                closeIdle(loop);
+                armIdleCheck(loop);
+            }
+            break;
+        case URING_OP_ACCEPT:
+            handleAccept(loop, res, more);
+            break;
+        case URING_OP_RECV:
+        case URING_OP_SEND:
+        {
+            struct aesd_uring_connection *entry = owner;
+            if (more == false)
+            {
+                entry->inFlight--;
+            }
+            if ((data & URING_OP_MASK) == URING_OP_RECV)
+            {
+                handleRecv(loop, entry, res, flags);
+            }
+            else
+            {
+                handleSend(loop, entry, res);
+            }
+            break;
+        }
+        }
+
+        tail = __atomic_load_n(loop->cqTail, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void* uringLoopHandler(void *arg)
+{
+    struct aesd_uring *loop = (struct aesd_uring *)arg;
+
+    armShutdownPoll(loop);
+    armDrainPoll(loop);
+    armAccept(loop);
+    armIdleCheck(loop);
+
+    // Runs until the shutdown completion cancelled everything and every
+    // cancelled request has posted its completion
+    while (loop->running || loop->inFlight > 0)
+    {
+        if (ringSubmit(loop, true) == false)
+        {
+            break;
+        }
+        reapCompletions(loop);
+    }
+
+    AESD_LOG(LOG_DEBUG, "io_uring loop terminating with %zu connections", loop->connectionCount);
+
+    while (loop->connections != NULL)
+    {
+        struct aesd_uring_connection *entry = loop->connections;
+        entry->inFlight = 0;
+        closeConnection(loop, entry);
+    }
+
+    uint64_t syscalls = loop->enterCalls + loop->otherCalls;
+    AESD_LOG(LOG_INFO, "io_uring loop: %" PRIu64 " packets, %" PRIu64 " io_uring_enter + %" PRIu64
+             " other syscalls, %.2f syscalls per packet", loop->packets, loop->enterCalls, loop->otherCalls,
+             loop->packets > 0 ? (double)syscalls / loop->packets : 0.0);
+
+    pthread_exit(NULL);
+}
+
+bool aesd_uring_drained(struct aesd_uring *loop)
+{
+    return atomic_load(&loop->drained);
+}
+
+bool aesd_uring_supported(void)
+{
+    struct aesd_uring probe;
+
+    memset(&probe, 0, sizeof(probe));
+    if (ringOpen(&probe, 4, 8) == false)
+    {
+        AESD_LOG(LOG_WARNING, "io_uring unavailable: %s", strerror(errno));
+        return false;
+    }
+    ringClose(&probe);
+    return true;
+}
+
+bool aesd_uring_start(struct aesd_uring *loop, int shutdownFd, int listenFd, int drainFd, int cpu)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->shutdownFd = shutdownFd;
+    loop->listenFd = listenFd;
+    loop->drainFd = drainFd;
+    loop->accepting = true;
+    loop->multishotAccept = true;
+    loop->multishotRecv = true;
+    loop->running = true;
+
+    if (ringOpen(loop, URING_SQ_ENTRIES, URING_CQ_ENTRIES) == false)
+    {
+        return false;
+    }
+
+    pthread_attr_t attr;
+    aesd_thread_attr_init(&attr);
+    if (cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    int created = pthread_create(&loop->thread, &attr, uringLoopHandler, loop);
+    pthread_attr_destroy(&attr);
+    if (created != 0)
+    {
+        ringClose(loop);
+        return false;
+    }
+    loop->started = true;
+    return true;
+}
+
+void aesd_uring_join(struct aesd_uring *loop)
+{
+    if (!loop->started)
+    {
+        return;
+    }
+    pthread_join(loop->thread, NULL);
+    ringClose(loop);
+    loop->started = false;
+}
+
+void aesd_uring_cleanup(void)
+{
+    aesd_slab_destroy(&entrySlab);
+}
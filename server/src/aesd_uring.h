@@ -0,0 +1,100 @@
+/*
+ * aesd_uring.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_URING_H
+#define AESD_URING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "aesd_connection.h"
+
+/**
+ * One io_uring completion loop running on its own thread. It accepts from its
+ * listening socket, receives into a ring of provided buffers and sends replies
+ * straight from the backing store's memory, queueing every request in the
+ * submission ring and handing the whole batch to the kernel with a single
+ * io_uring_enter() that also waits for completions. Multishot accept and recv
+ * are used where the kernel supports them, with single-shot requests as the
+ * fallback.
+ */
+struct aesd_uring
+{
+    pthread_t thread;
+    bool started;
+    int ringFd;
+    int shutdownFd;                     // read end of the server shutdown pipe
+    int listenFd;                       // blocking listener owned by this loop
+    int drainFd;                        // readable once the listener is handed over
+
+    // Submission and completion rings shared with the kernel
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqLocalTail;               // queued entries not yet handed to the kernel
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    // Provided receive buffers, registered with the kernel
+    struct io_uring_buf_ring *bufRing;
+    char *buffers;
+
+    bool multishotAccept;
+    bool multishotRecv;
+    bool running;
+    bool accepting;
+    bool acceptArmed;                   // an accept request will still complete
+    atomic_bool drained;                // stopped accepting and no accept is left
+    unsigned inFlight;                  // requests that will still post a completion
+    struct sockaddr_storage acceptAddr; // filled in by single-shot accept
+    socklen_t acceptAddrLen;
+    struct __kernel_timespec idleCheck; // interval of the idle connection check
+
+    struct aesd_uring_connection *connections;
+    size_t connectionCount;
+
+    uint64_t enterCalls;                // io_uring_enter()
+    uint64_t otherCalls;                // every other syscall made by the loop
+    uint64_t packets;
+};
+
+/**
+ * Checks that the kernel provides everything the loop needs, so the server can
+ * fall back to epoll before it starts any loop.
+ */
+bool aesd_uring_supported(void);
+
+/**
+ * Starts @param loop accepting from the blocking @param listenFd until
+ * @param drainFd turns readable. @param cpu pins the loop thread, or -1.
+ */
+bool aesd_uring_start(struct aesd_uring *loop, int shutdownFd, int listenFd, int drainFd, int cpu);
+void aesd_uring_join(struct aesd_uring *loop);
+
+/**
+ * True once @param loop accepts no more connections after the drain.
+ */
+bool aesd_uring_drained(struct aesd_uring *loop);
+
+/**
+ * Returns the memory of the connection entries once every loop was joined.
+ */
+void aesd_uring_cleanup(void);
+
+#endif /* AESD_URING_H */
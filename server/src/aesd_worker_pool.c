@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd_worker_pool.h"
+#include "aesd_log.h"
+#include "aesd_thread.h"
+
+static uint64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void* workerHandler(void *arg)
+{
+    struct aesd_worker_pool *pool = (struct aesd_worker_pool *)arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->queueCount == 0 && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->notEmpty, &pool->mutex);
+        }
+        if (pool->stopping)
+        {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+
+        struct aesd_connection *connection = pool->queue[pool->queueHead];
+        pool->queueHead = (pool->queueHead + 1) % pool->queueDepth;
+        pool->queueCount--;
+
+        uint64_t waitNs = monotonicNs() - connection->acceptedAtNs;
+        pool->dispatched++;
+        pool->queueWaitTotalNs += waitNs;
+        if (waitNs > pool->queueWaitMaxNs)
+        {
+            pool->queueWaitMaxNs = waitNs;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+
+        pool->handler(connection);
+    }
+
+    return NULL;
+}
+
+bool aesd_worker_pool_init(struct aesd_worker_pool *pool, size_t threadCount, size_t queueDepth, aesd_worker_handler_t handler)
+{
+    memset(pool, 0, sizeof(*pool));
+
+    if (threadCount == 0 || queueDepth == 0)
+    {
+        return false;
+    }
+
+    pool->threads = calloc(threadCount, sizeof(pthread_t));
+    pool->queue = calloc(queueDepth, sizeof(struct aesd_connection *));
+    if (pool->threads == NULL || pool->queue == NULL)
+    {
+        free(pool->threads);
+        free(pool->queue);
+        return false;
+    }
+
+    pool->threadCount = threadCount;
+    pool->queueDepth = queueDepth;
+    pool->handler = handler;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->notEmpty, NULL);
+
+    pthread_attr_t attr;
+    aesd_thread_attr_init(&attr);
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        if (pthread_create(&pool->threads[i], &attr, workerHandler, pool) != 0)
+        {
+            pthread_attr_destroy(&attr);
+            aesd_worker_pool_shutdown(pool);
+            return false;
+        }
+        pool->threadsStarted++;
+    }
+    pthread_attr_destroy(&attr);
+
+    return true;
+}
+
+bool aesd_worker_pool_submit(struct aesd_worker_pool *pool, struct aesd_connection *connection)
+{
+    bool queued = false;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (!pool->stopping && pool->queueCount < pool->queueDepth)
+    {
+        pool->queue[(pool->queueHead + pool->queueCount) % pool->queueDepth] = connection;
+        pool->queueCount++;
+        queued = true;
+        pthread_cond_signal(&pool->notEmpty);
+    }
+    else
+    {
+        pool->rejected++;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return queued;
+}
+
+void aesd_worker_pool_shutdown(struct aesd_worker_pool *pool)
+{
+    if (pool->threads == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->notEmpty);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 0; i < pool->threadsStarted; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    while (pool->queueCount > 0)
+    {
+        aesd_connection_destroy(pool->queue[pool->queueHead]);
+        pool->queueHead = (pool->queueHead + 1) % pool->queueDepth;
+        pool->queueCount--;
+    }
+
+    if (pool->dispatched > 0)
+    {
+        AESD_LOG(LOG_INFO, "Worker pool dispatched %lu connections, queue wait avg %lu us max %lu us, rejected %lu",
+                 (unsigned long)pool->dispatched,
+                 (unsigned long)(pool->queueWaitTotalNs / pool->dispatched / 1000),
+                 (unsigned long)(pool->queueWaitMaxNs / 1000),
+                 (unsigned long)pool->rejected);
+    }
+
+    pthread_cond_destroy(&pool->notEmpty);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool->queue);
+    pool->threads = NULL;
+    pool->queue = NULL;
+}
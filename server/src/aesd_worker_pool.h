@@ -0,0 +1,61 @@
+/*
+ * aesd_worker_pool.h
+ *
+ *  Created on: October 17th, 2026
+ *      Author: Filip Owsiany
+ */
+
+#ifndef AESD_WORKER_POOL_H
+#define AESD_WORKER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "aesd_connection.h"
+
+typedef void (*aesd_worker_handler_t)(struct aesd_connection *connection);
+
+/**
+ * Fixed set of threads serving accepted connections taken from a bounded FIFO.
+ * A worker runs the handler for one connection at a time and picks up the next
+ * queued connection as soon as the handler returns.
+ */
+struct aesd_worker_pool
+{
+    pthread_t *threads;
+    size_t threadCount;
+    size_t threadsStarted;
+    aesd_worker_handler_t handler;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    struct aesd_connection **queue;     // ring of queueDepth entries
+    size_t queueDepth;
+    size_t queueHead;
+    size_t queueCount;
+    bool stopping;
+
+    // Time connections spent queued between accept() and a worker picking them up
+    uint64_t dispatched;
+    uint64_t queueWaitTotalNs;
+    uint64_t queueWaitMaxNs;
+    uint64_t rejected;
+};
+
+bool aesd_worker_pool_init(struct aesd_worker_pool *pool, size_t threadCount, size_t queueDepth, aesd_worker_handler_t handler);
+
+/**
+ * Queues @param connection for the next idle worker. Returns false without
+ * taking ownership when the queue is full or the pool is shutting down.
+ */
+bool aesd_worker_pool_submit(struct aesd_worker_pool *pool, struct aesd_connection *connection);
+
+/**
+ * Stops accepting work, joins all workers and destroys connections still queued.
+ * Handlers must return on their own, e.g. by watching the shutdown pipe.
+ */
+void aesd_worker_pool_shutdown(struct aesd_worker_pool *pool);
+
+#endif /* AESD_WORKER_POOL_H */
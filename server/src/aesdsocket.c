@@ -1,11 +1,16 @@
+#define _GNU_SOURCE
 #include <errno.h>
+#include <limits.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
@@ -17,60 +22,111 @@
 
 #include "aesd_ioctl.h"
 #include "aesd_temperaty_buffer.h"
+#include "aesd_admission.h"
+#include "aesd_backing_store.h"
+#include "aesd_connection.h"
+#include "aesd_event_loop.h"
+#include "aesd_uring.h"
+#include "aesd_worker_pool.h"
+#include "aesd_log.h"
+#include "aesd_metrics.h"
+#include "aesd_thread.h"
+#include "aesd_timestamp.h"
+#include "aesd_tuning.h"
+#include "aesd_upgrade.h"
 
 #define BUFFER_SIZE             512
-#define MAX_THREADS             128
-
-#define USE_AESD_CHAR_DEVICE    1
-
-#define SEEK_CMD_PREFIX         "AESDCHAR_IOCSEEKTO:"
-
-typedef struct clientData_t 
+#define DEFAULT_WORKER_THREADS  128
+#define DEFAULT_WORKER_QUEUE    64
+#define CONNECTION_RESERVE      1024    // connections carved up front in epoll and io_uring modes
+#define MAX_EVENT_LOOPS         64
+#define MAX_LISTENERS           MAX_EVENT_LOOPS
+#define SERVER_PORT             9000
+#define UPGRADE_READY_TIMEOUT_MS 5000   // how long a successor may take to start serving
+#define DRAIN_TIMEOUT_MS        30000   // how long connections may outlive a hand over
+#define DRAIN_POLL_MS           10
+
+enum serverMode
 {
-    int newSockFd;
-    int clientLen;
-    struct sockaddr_in clientAddr;
-} clientData_t;
+    SERVER_MODE_THREAD,     // worker pool, one connection per worker at a time
+    SERVER_MODE_EPOLL,      // connections multiplexed over a few epoll loops
+    SERVER_MODE_URING,      // one io_uring completion loop per listener shard
+};
 
-static const char* version = "2.0.0";
+static const char* version = "2.1.0";
 static volatile sig_atomic_t stop = 0;
+static volatile sig_atomic_t upgrade = 0;
+static bool handedOver = false;
+static char execPath[PATH_MAX];
+static char **serverArgv;
 
 static int serverSockFd = 0;
+static int unixSockFd = -1;
+static const char *unixSocketPath = NULL;
 
-#if !USE_AESD_CHAR_DEVICE
-static pthread_t timestampThread = 0;
-#endif
-static pthread_t clientThreads[MAX_THREADS] = {0};
-static int threadCount = 0;
+static struct aesd_worker_pool workerPool;
+static int workerThreadCount = DEFAULT_WORKER_THREADS;
+static int workerQueueDepth = DEFAULT_WORKER_QUEUE;
 
 static bool runAsDaemon = false;
-#if !USE_AESD_CHAR_DEVICE
-static bool timestampThreadStarted = false;
-#endif
+static int timestampTimerFd = -1;
+static int timestampIntervalMs = AESD_TIMESTAMP_DEFAULT_INTERVAL_MS;
+
+static enum serverMode mode = SERVER_MODE_THREAD;
+static int eventLoopCount = 1;
+static struct aesd_event_loop eventLoops[MAX_EVENT_LOOPS + 1];   // + the unix socket shard
+static int nextEventLoop = 0;
+static struct aesd_uring uringLoops[MAX_LISTENERS + 1];
+static int uringLoopCount = 0;
+static enum aesd_backing_store_reply_path replyPath = AESD_REPLY_PATH_HISTORY;
+static int commitWindowUs = 0;
+static int commitMaxBatch = AESD_BACKING_STORE_DEFAULT_BATCH;
+static long outputHighWater = AESD_CONNECTION_DEFAULT_HIGH_WATER;
+static const char *metricsPath = NULL;
+
+// Admission control, 0 for no limit
+static long maxConnections = 0;
+static long maxPerSource = 0;
+static long idleTimeoutMs = 0;
+static long maxPacketBytes = 0;
+
+// With more than one listener every one of them is an SO_REUSEPORT shard with
+// its own acceptor: an event loop in epoll mode, an accept thread otherwise.
+// The unix socket listener, if any, is one more shard after them.
+static int listenerCount = 1;
+static int listenBacklog = SOMAXCONN;
+static int listenFds[MAX_LISTENERS + 1];
+static int shardCount = 0;
+static pthread_t acceptThreads[MAX_LISTENERS + 1];
+static int acceptThreadCount = 0;
 
 int pipeClientHandler[2]; // [0] for reading, [1] for writing
-
-#if !USE_AESD_CHAR_DEVICE
-int pipeTimestampWriterHandler[2]; // [0] for reading, [1] for writing
-#endif
-
-
-static pthread_mutex_t fileMutex = PTHREAD_MUTEX_INITIALIZER;
+static int pipeDrain[2];  // readable once the listeners are handed over
 
 void    logAndExit(const char *msg, const char *filename, int exit_code);
 char**  bufferPacketCreate(void);
 void    bufferPacketDelete(char **bufferPacket);
 void    bufferPacketFree(char **bufferPacket, uint8_t* bufferPacketIndex);
-void    cleanupClientHandler(clientData_t* clientData, struct aesd_temperary_buffer* buffer);
+void    cleanupClientHandler(struct aesd_connection* connection);
 void    cleanupMain(void);
-bool    checkForNullCharInString(const char *str, const ssize_t len);
-bool    checkForNewlineCharInString(const char *str, const ssize_t len, ssize_t *newlinePosition);
 void    SIGINTHandler(int signum, siginfo_t *info, void *extra);
 void    SIGTERMHandler(int signum, siginfo_t *info, void *extra);
+void    SIGUSR2Handler(int signum, siginfo_t *info, void *extra);
 void    setSignalSIGINTHandler(void);
 void    setSignalSIGTERMHandler(void);
-void*   timestampWriterHandler(void* arg);
-void*   clientHandler(void* arg);
+void    setSignalSIGUSR2Handler(void);
+void    blockTerminationSignals(sigset_t *previous);
+void    restoreSignals(const sigset_t *previous);
+void    parseArguments(int argc, char *argv[]);
+void    clientHandler(struct aesd_connection* connection);
+int     openListener(bool reusePort);
+int     openUnixListener(const char *path);
+void    submitConnection(struct aesd_connection* connection);
+void*   acceptHandler(void* arg);
+void    receiveListeners(int predecessorFd);
+bool    handOver(const sigset_t *mask);
+bool    acceptorsDrained(void);
+void    drainConnections(const sigset_t *mask);
 
 void logAndExit(const char *msg, const char *filename, int exit_code) 
 {
@@ -80,7 +136,7 @@ void logAndExit(const char *msg, const char *filename, int exit_code)
         exit(EXIT_FAILURE);
     }
     snprintf(msgBuffer, sizeof(msgBuffer), "errno: %d msg: %s file: %s", errno, msg, filename ? filename : "unknown");
-    syslog(LOG_ERR, "%s", msgBuffer);
+    AESD_LOG(LOG_ERR, "%s", msgBuffer);
 
     perror(msgBuffer);
     cleanupMain();
@@ -118,163 +174,83 @@ void bufferPacketFree(char **bufferPacket, uint8_t* bufferPacketIndex)
     *bufferPacketIndex = 0;
 }
 
-void cleanupClientHandler(clientData_t* clientData, struct aesd_temperary_buffer* buffer) 
+void cleanupClientHandler(struct aesd_connection* connection) 
 {
-    //bufferPacketFree(bufferPacket, bufferPacketIndex);
-    if (buffer != NULL) 
-    {
-        aesd_temperary_buffer_clean(buffer);
-    }
-    if (clientData->newSockFd > 0) 
-    {
-        close(clientData->newSockFd);
-    }
-    if (clientData != NULL)
-    {
-        free(clientData);
-        clientData = NULL;
-    }    
-    printf("cleanupClientHandler() thread ID: %ld\n", syscall(SYS_gettid));
+    aesd_connection_destroy(connection);
+    AESD_LOG(LOG_DEBUG, "cleanupClientHandler() thread ID: %ld", syscall(SYS_gettid));
 }
 
 void cleanupMain(void) 
 {
-#if !USE_AESD_CHAR_DEVICE
-    if (timestampThreadStarted && pipeTimestampWriterHandler[1] > 0) 
+    if (timestampTimerFd >= 0)
     {
-        ssize_t res = write(pipeTimestampWriterHandler[1], "x", 1);
-        (void)res; // Unused variable
-        pthread_join(timestampThread, NULL);
-    }
-#endif
-    
-    if (threadCount > 0 && pipeClientHandler[1] > 0) 
-    {
-        for (int i = 0; i < threadCount; i++) 
-        {
-            ssize_t res = write(pipeClientHandler[1], "x", 1);
-            (void)res; // Unused variable
-        }
+        close(timestampTimerFd);
+        timestampTimerFd = -1;
     }
 
-    if (threadCount > 0) 
+    if (pipeClientHandler[1] > 0) 
     {
-        for (int i = 0; i < threadCount; i++) 
-        {
-            pthread_join(clientThreads[i], NULL);
-        }
+        // Nobody reads the byte back, so the pipe stays readable for every
+        // client thread and event loop polling it
+        ssize_t res = write(pipeClientHandler[1], "x", 1);
+        (void)res; // Unused variable
     }
 
-    if (serverSockFd > 0) 
+    for (int i = 0; i < acceptThreadCount; i++)
     {
-        close(serverSockFd);
+        pthread_join(acceptThreads[i], NULL);
     }
-    syslog(LOG_INFO, "Server shutting down");
-#if !USE_AESD_CHAR_DEVICE
-    remove("/var/tmp/aesdsocketdata");
-#endif
-    closelog();
-    printf("Server shutting down\n");
-}
+    acceptThreadCount = 0;
 
-bool checkForNullCharInString(const char *str, const ssize_t len) 
-{
-    if (str == NULL || len <= 0) 
-    {
-        syslog(LOG_WARNING, "Received NULL string or invalid length");
-        return true;
-    }
-    for (ssize_t i = 0; i < len; i++) 
-    {
-        if (str[i] == '\0') 
-        {
-            syslog(LOG_WARNING, "String contains null character at position %zd", i);
-            return true;
-        }
-    }
-    return false;
-}
+    aesd_worker_pool_shutdown(&workerPool);
 
-bool checkForNewlineCharInString(const char *str, const ssize_t len, ssize_t *newlinePosition) 
-{
-    if (str == NULL || len <= 0) 
+    for (int i = 0; i < eventLoopCount; i++) 
     {
-        syslog(LOG_DEBUG, "Received NULL string or invalid length");
-        return true;
+        aesd_event_loop_join(&eventLoops[i]);
     }
-    for (ssize_t i = 0; i < len; i++) 
-    {
-        if (str[i] == '\n') 
-        {
-            if (newlinePosition != NULL) 
-            {
-                *newlinePosition = i;
-            }
-            syslog(LOG_DEBUG, "String contains newline character at position %zd", i);
-            return true;
-        }
-    }
-    return false;
-}
 
-bool checkForCommandInString(const char *buffer, size_t size, struct aesd_seekto *command) 
-{
-    if (buffer == NULL || size == 0) 
+    for (int i = 0; i < uringLoopCount; i++)
     {
-        syslog(LOG_WARNING, "Received NULL string or invalid length");
-        return false;
+        aesd_uring_join(&uringLoops[i]);
     }
+    uringLoopCount = 0;
+    aesd_uring_cleanup();
 
-    const size_t prefixLen = sizeof(SEEK_CMD_PREFIX) - 1;
+    // Every connection went with the thread or loop serving it
+    aesd_connection_cleanup();
 
-    if (size < prefixLen || strncmp(buffer, SEEK_CMD_PREFIX, prefixLen) != 0) 
-    {
-        return false;
-    }
+    // A successor took over the socket paths and the data file
+    aesd_metrics_stop(handedOver == false);
 
-    const char* cmdPosition = strstr(buffer, SEEK_CMD_PREFIX);
-
-    if (cmdPosition == NULL) 
+    if (serverSockFd > 0) 
     {
-        syslog(LOG_WARNING, "Command prefix not found in string");
-        return false;
+        close(serverSockFd);
     }
-
-    const char* cmdFirstArg = cmdPosition + prefixLen;
-
-    char* endPosition;
-    unsigned long commandValue = strtoul(cmdFirstArg, &endPosition, 10); // Convert the command to an unsigned long
-
-    if (endPosition == cmdFirstArg) 
+    for (int i = 1; i < listenerCount; i++)
     {
-        syslog(LOG_WARNING, "Invalid command format");
-        return false;
+        if (listenFds[i] > 0)
+        {
+            close(listenFds[i]);
+        }
     }
-
-    const char* cmdSecondArg = strstr(buffer, ",");
-
-    if (cmdSecondArg == NULL) 
+    if (unixSockFd >= 0)
     {
-        syslog(LOG_WARNING, "Command second argument not found in string");
-        return false;
+        close(unixSockFd);
+        if (handedOver == false)
+        {
+            unlink(unixSocketPath);
+        }
     }
-
-    cmdSecondArg++; // Move past the colon
-
-    unsigned long offsetValue = strtoul(cmdSecondArg, &endPosition, 10); // Convert the offset to an unsigned long
-
-    if (endPosition == cmdSecondArg) 
+    aesd_backing_store_cleanup();
+    AESD_LOG(LOG_INFO, "Server shutting down");
+#if !USE_AESD_CHAR_DEVICE
+    if (handedOver == false)
     {
-        syslog(LOG_WARNING, "Invalid offset format");
-        return false;
+        remove("/var/tmp/aesdsocketdata");
     }
-
-    command->write_cmd = commandValue;
-    command->write_cmd_offset = offsetValue;
-
-    printf("Command found: write_cmd=%lu, write_cmd_offset=%lu\n", commandValue, offsetValue);
-
-    return true;
+#endif
+    aesd_log_stop();
+    closelog();
 }
 
 void SIGINTHandler(int signum, siginfo_t *info, void *extra)
@@ -282,7 +258,7 @@ void SIGINTHandler(int signum, siginfo_t *info, void *extra)
     (void)signum; // Unused parameter
     (void)info;   // Unused parameter
     (void)extra;  // Unused parameter
-    printf("Handler SIGINT, thread ID: %ld\n", syscall(SYS_gettid));
+    AESD_LOG(LOG_DEBUG, "Handler SIGINT, thread ID: %ld", syscall(SYS_gettid));
     stop = 1;
 }
 
@@ -291,10 +267,18 @@ void SIGTERMHandler(int signum, siginfo_t *info, void *extra)
     (void)signum; // Unused parameter
     (void)info;   // Unused parameter
     (void)extra;  // Unused parameter
-    printf("Handler SIGTERM, thread ID: %ld\n", syscall(SYS_gettid));
+    AESD_LOG(LOG_DEBUG, "Handler SIGTERM, thread ID: %ld", syscall(SYS_gettid));
     stop = 1;
 }
 
+void SIGUSR2Handler(int signum, siginfo_t *info, void *extra)
+{
+    (void)signum; // Unused parameter
+    (void)info;   // Unused parameter
+    (void)extra;  // Unused parameter
+    upgrade = 1;
+}
+
 void setSignalSIGINTHandler(void)
 {
     struct sigaction action;
@@ -313,283 +297,636 @@ void setSignalSIGTERMHandler(void)
     sigaction(SIGTERM, &action, NULL);
 }
 
-void* timestampWriterHandler(void* arg)
+void setSignalSIGUSR2Handler(void)
 {
-    (void)arg; // Unused parameter
-#if !USE_AESD_CHAR_DEVICE
-    while (1)
-    {
-        struct pollfd pfd;
-        pfd.fd = pipeTimestampWriterHandler[0];
-        pfd.events = POLLIN;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_flags = SA_SIGINFO;
+    action.sa_sigaction = SIGUSR2Handler;
+    sigaction(SIGUSR2, &action, NULL);
+}
 
-        int ret = poll(&pfd, 1, 10000);
+void blockTerminationSignals(sigset_t *previous)
+{
+    // Threads inherit the mask, which keeps SIGINT/SIGTERM (and SIGUSR2, the
+    // hand over) on the main thread where they interrupt accept()
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, previous);
+}
 
-        if (ret == -1)
+void restoreSignals(const sigset_t *previous)
+{
+    pthread_sigmask(SIG_SETMASK, previous, NULL);
+}
+
+void parseArguments(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "dm:l:w:q:r:v:s:b:t:g:G:o:S:u:c:p:i:P:T:")) != -1)
+    {
+        switch (opt)
         {
-            perror("poll");
+        case 'd':
+            runAsDaemon = true;
+            break;
+        case 'm':
+            if (strcmp(optarg, "thread") == 0)
+            {
+                mode = SERVER_MODE_THREAD;
+            }
+            else if (strcmp(optarg, "epoll") == 0)
+            {
+                mode = SERVER_MODE_EPOLL;
+            }
+            else if (strcmp(optarg, "uring") == 0)
+            {
+                mode = SERVER_MODE_URING;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown mode %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l':
+            eventLoopCount = atoi(optarg);
+            if (eventLoopCount < 1 || eventLoopCount > MAX_EVENT_LOOPS)
+            {
+                fprintf(stderr, "Event loop count must be between 1 and %d\n", MAX_EVENT_LOOPS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            listenerCount = atoi(optarg);
+            if (listenerCount < 1 || listenerCount > MAX_LISTENERS)
+            {
+                fprintf(stderr, "Listener shard count must be between 1 and %d\n", MAX_LISTENERS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            listenBacklog = atoi(optarg);
+            if (listenBacklog < 1)
+            {
+                fprintf(stderr, "Listen backlog must be at least 1\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            timestampIntervalMs = atoi(optarg);
+            if (timestampIntervalMs < 1)
+            {
+                fprintf(stderr, "Timestamp interval must be at least 1 ms\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'g':
+            commitWindowUs = atoi(optarg);
+            if (commitWindowUs < 0)
+            {
+                fprintf(stderr, "Group commit window must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'G':
+            commitMaxBatch = atoi(optarg);
+            if (commitMaxBatch < 1 || commitMaxBatch > AESD_BACKING_STORE_MAX_BATCH)
+            {
+                fprintf(stderr, "Group commit batch must be between 1 and %d\n", AESD_BACKING_STORE_MAX_BATCH);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':
+            outputHighWater = atol(optarg);
+            if (outputHighWater < 0)
+            {
+                fprintf(stderr, "Output high-water mark must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            metricsPath = optarg;
+            break;
+        case 'u':
+            unixSocketPath = optarg;
+            break;
+        case 'c':
+            maxConnections = atol(optarg);
+            if (maxConnections < 0)
+            {
+                fprintf(stderr, "Connection limit must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            maxPerSource = atol(optarg);
+            if (maxPerSource < 0)
+            {
+                fprintf(stderr, "Per-source connection limit must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'i':
+            idleTimeoutMs = atol(optarg);
+            if (idleTimeoutMs < 0 || idleTimeoutMs > INT_MAX)
+            {
+                fprintf(stderr, "Idle timeout must be between 0 and %d ms\n", INT_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'P':
+            maxPacketBytes = atol(optarg);
+            if (maxPacketBytes < 0)
+            {
+                fprintf(stderr, "Packet size limit must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'T':
+        {
+            struct aesd_tuning tuning;
+            if (aesd_tuning_parse(optarg, &tuning) == false)
+            {
+                fprintf(stderr, "Unknown tuning profile %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            aesd_tuning_set(&tuning);
             break;
         }
-        else if (ret == 0)
+        case 'w':
+            workerThreadCount = atoi(optarg);
+            if (workerThreadCount < 1)
+            {
+                fprintf(stderr, "Worker thread count must be at least 1\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            workerQueueDepth = atoi(optarg);
+            if (workerQueueDepth < 1)
+            {
+                fprintf(stderr, "Worker queue depth must be at least 1\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'r':
+            if (strcmp(optarg, "history") == 0)
+            {
+                replyPath = AESD_REPLY_PATH_HISTORY;
+            }
+            else if (strcmp(optarg, "sendfile") == 0)
+            {
+                replyPath = AESD_REPLY_PATH_SENDFILE;
+            }
+            else if (strcmp(optarg, "copy") == 0)
+            {
+                replyPath = AESD_REPLY_PATH_COPY;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown reply path %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'v':
         {
-            time_t now = time(NULL);
-            struct tm *tm_info = localtime(&now);
-            char time_str[128];
+            int level;
+            if (aesd_log_parse_level(optarg, &level) == false)
+            {
+                fprintf(stderr, "Unknown log level %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            aesd_log_set_threshold(level);
+            break;
+        }
+        default:
+            fprintf(stderr, "Usage: %s [-d] [-m thread|epoll|uring] [-l event_loops] [-w workers] [-q queue_depth] [-r history|sendfile|copy] [-v err|warning|info|debug] [-s listener_shards] [-b backlog] [-t timestamp_interval_ms] [-g commit_window_us] [-G commit_batch] [-o output_high_water_bytes] [-S metrics_socket] [-u unix_socket] [-c max_connections] [-p max_per_source] [-i idle_timeout_ms] [-P max_packet_bytes] [-T nodelay,cork,sndbuf=N,rcvbuf=N,defer_accept=S,busy_poll=US|latency]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
 
-            strftime(time_str, sizeof(time_str), "%a, %d %b %Y %H:%M:%S %z", tm_info);
+void clientHandler(struct aesd_connection* connection) 
+{
+    struct pollfd fds[2];
 
-            char final_line[256];
-            snprintf(final_line, sizeof(final_line), "timestamp:%s\n", time_str);
+    fds[0].fd = connection->sockFd;
+    fds[1].fd = pipeClientHandler[0];
+    fds[1].events = POLLIN;
+
+    AESD_LOG(LOG_DEBUG, "Client file descriptor: %d, clientHandler() thread ID: %ld", connection->sockFd, syscall(SYS_gettid));
+
+    while (connection->state != AESD_CONNECTION_CLOSED) 
+    {
+        fds[0].events = (aesd_connection_wants_read(connection) ? POLLIN : 0) |
+                        (connection->state == AESD_CONNECTION_REPLYING ? POLLOUT : 0);
 
-            pthread_mutex_lock(&fileMutex);
-            FILE* f = fopen("/var/tmp/aesdsocketdata", "a");
-            if (f != NULL)
+        // Wake up when the connection would time out, so idle clients do not
+        // hold a worker forever
+        int ret = poll(fds, 2, aesd_connection_idle_wait_ms(connection, aesd_metrics_now_ns()));
+        if (ret == -1) 
+        {
+            if (errno == EINTR)
             {
-                fputs(final_line, f);
-                fclose(f);
+                continue;
             }
-            pthread_mutex_unlock(&fileMutex);
+            AESD_LOG(LOG_ERR, "poll failed: %s", strerror(errno));
+            break;
         }
-        else if (pfd.revents & POLLIN)
+        if (ret == 0)
         {
-            char buf[1];
-            ssize_t res = read(pipeTimestampWriterHandler[0], buf, 1);
-            (void)res; // Unused variable
-            printf("Timestamp writer thread terminating...\n");
+            aesd_connection_check_idle(connection, aesd_metrics_now_ns());
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            AESD_LOG(LOG_DEBUG, "Receiver thread terminating...");
             break;
         }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) 
+        {
+            aesd_connection_on_readable(connection);
+        }
+
+        if (fds[0].revents & (POLLOUT | POLLHUP | POLLERR)) 
+        {
+            aesd_connection_on_writable(connection);
+        }
     }
-#endif
 
-    pthread_exit(NULL);
+    cleanupClientHandler(connection);
+    AESD_LOG(LOG_DEBUG, "Close client handler thread ID: %ld", syscall(SYS_gettid));
 }
 
-void* clientHandler(void* arg) 
+int openListener(bool reusePort)
 {
-    clientData_t* clientData = (clientData_t*)arg;
-    struct pollfd fds[2];
-    // uint8_t bufferPacketIndex = 0;
-    // char **bufferPacket = bufferPacketCreate();
+    // One dual-stack socket takes IPv6 and IPv4 clients alike; without IPv6
+    // support in the kernel fall back to IPv4 only
+    bool ipv6 = true;
+    int listenFd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (listenFd < 0 && errno == EAFNOSUPPORT)
+    {
+        ipv6 = false;
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    }
 
-    struct aesd_temperary_buffer bufferString = {0};
-    aesd_temperary_buffer_init(&bufferString);
+    if (listenFd < 0) 
+    {
+        logAndExit("Failed to create socket", __FILE__, EXIT_FAILURE);
+    }
 
-    fds[0].fd = clientData->newSockFd;
-    fds[0].events = POLLIN;
+    int optval = 1;
+    if (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) 
+    {
+        logAndExit("Failed to set socket options", __FILE__, EXIT_FAILURE);
+    }
+    // The kernel spreads incoming connections over all sockets bound this way
+    if (reusePort && setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) 
+    {
+        logAndExit("Failed to set SO_REUSEPORT", __FILE__, EXIT_FAILURE);
+    }
 
-    fds[1].fd = pipeClientHandler[0];
-    fds[1].events = POLLIN;
+    int bound;
+    if (ipv6)
+    {
+        int v6Only = 0;
+        if (setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof(v6Only)) < 0)
+        {
+            logAndExit("Failed to clear IPV6_V6ONLY", __FILE__, EXIT_FAILURE);
+        }
 
-    printf("Client file descriptor: %d\n", clientData->newSockFd);
-    printf("clientHandler() thread ID: %ld\n", syscall(SYS_gettid));
+        struct sockaddr_in6 serverAddr;
+        memset(&serverAddr, 0, sizeof(serverAddr));
+        serverAddr.sin6_family = AF_INET6;
+        serverAddr.sin6_addr = in6addr_any;
+        serverAddr.sin6_port = htons(SERVER_PORT);
+        bound = bind(listenFd, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
+    }
+    else
+    {
+        struct sockaddr_in serverAddr;
+        memset(&serverAddr, 0, sizeof(serverAddr));
+        serverAddr.sin_family = AF_INET;  
+        serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);  
+        serverAddr.sin_port = htons(SERVER_PORT);  
+        bound = bind(listenFd, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
+    }
 
-    while (1) 
+    if (bound < 0) 
     {
-        //bufferPacketFree(bufferPacket, &bufferPacketIndex);
-        char *buffer = (char*) calloc(BUFFER_SIZE, sizeof(char));
+        logAndExit("Failed to bind socket", __FILE__, EXIT_FAILURE);
+    }
 
-        if (buffer == NULL) 
-        {
-            logAndExit("Failed to allocate memory for buffer", __FILE__, EXIT_FAILURE);
-        }
+    aesd_tuning_apply_listener(listenFd);
+    if (listen(listenFd, listenBacklog) < 0)
+    {
+        logAndExit("Failed to listen on socket", __FILE__, EXIT_FAILURE);
+    }
 
-        // if (bufferPacketIndex >= 128) 
-        // {
-        //     bufferPacketFree(bufferPacket, &bufferPacketIndex);
-        //     logAndExit("Buffer packet index exceeded limit", __FILE__, EXIT_FAILURE);
-        // }
+    return listenFd;
+}
 
-        // bufferPacket[bufferPacketIndex++] = buffer;
+/**
+ * Listens on a unix stream socket at @param path for clients on this host,
+ * which skip the TCP loopback path. They speak the same protocol.
+ */
+int openUnixListener(const char *path)
+{
+    struct sockaddr_un serverAddr = { .sun_family = AF_UNIX };
 
-        int ret = poll(fds, 2, -1);
-        if (ret == -1) 
+    if (strlen(path) >= sizeof(serverAddr.sun_path))
+    {
+        fprintf(stderr, "Unix socket path %s is too long\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(serverAddr.sun_path, path);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+    {
+        logAndExit("Failed to create unix socket", __FILE__, EXIT_FAILURE);
+    }
+
+    // A stale socket from a previous run would make bind() fail
+    unlink(path);
+    if (bind(listenFd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0)
+    {
+        close(listenFd);
+        logAndExit("Failed to bind unix socket", __FILE__, EXIT_FAILURE);
+    }
+    if (listen(listenFd, listenBacklog) < 0)
+    {
+        close(listenFd);
+        unlink(path);
+        logAndExit("Failed to listen on unix socket", __FILE__, EXIT_FAILURE);
+    }
+
+    AESD_LOG(LOG_INFO, "Listening on unix socket %s", path);
+    return listenFd;
+}
+
+void submitConnection(struct aesd_connection* connection)
+{
+    if (aesd_worker_pool_submit(&workerPool, connection) == false)
+    {
+        AESD_LOG(LOG_WARNING, "Worker queue full, dropping connection from %s", connection->clientName);
+        aesd_connection_destroy(connection);
+    }
+}
+
+/**
+ * Accept thread of one listener shard in thread mode. @param arg is the shard
+ * index into listenFds.
+ */
+void* acceptHandler(void* arg)
+{
+    int listenFd = listenFds[(intptr_t)arg];
+    struct pollfd fds[3];
+
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = pipeClientHandler[0];
+    fds[1].events = POLLIN;
+    fds[2].fd = pipeDrain[0];
+    fds[2].events = POLLIN;
+
+    while (1)
+    {
+        int ret = poll(fds, 3, -1);
+        if (ret == -1)
         {
-            perror("poll");
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            AESD_LOG(LOG_ERR, "poll failed: %s", strerror(errno));
             break;
         }
 
-        if (fds[1].revents & POLLIN) {
-            char tmp;
-            ssize_t res = read(pipeClientHandler[0], &tmp, 1);
-            (void)res; // Unused variable
-            printf("Receiver thread terminating...\n");
+        if ((fds[1].revents | fds[2].revents) & POLLIN)
+        {
             break;
         }
 
-        if (fds[0].revents & POLLIN) 
+        struct sockaddr_storage clientAddr;
+        socklen_t clientLen = sizeof(clientAddr);
+        int newSockFd = accept4(listenFd, (struct sockaddr *)&clientAddr, &clientLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (newSockFd < 0)
         {
-            printf("Received data from client\n");
-            ssize_t recvLen = recv(clientData->newSockFd, buffer, BUFFER_SIZE - 1, 0);
-            if (recvLen >= 0 && recvLen < BUFFER_SIZE) 
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
             {
-                buffer[recvLen] = '\0';
+                AESD_LOG(LOG_ERR, "accept failed: %s", strerror(errno));
             }
-
-            if(aesd_temperary_buffer_add(&bufferString, buffer, recvLen) == false) 
+            continue;
+        }
+        struct aesd_connection* connection = aesd_connection_create(newSockFd, (struct sockaddr *)&clientAddr, clientLen);
+        if (connection == NULL)
+        {
+            if (errno != ECONNREFUSED)
             {
-                free(buffer);
-                logAndExit("Failed to add data to temporary buffer", __FILE__, EXIT_FAILURE);
+                AESD_LOG(LOG_ERR, "Failed to allocate client connection");
             }
+            close(newSockFd);
+            continue;
+        }
+        submitConnection(connection);
+    }
 
-            free(buffer);
+    AESD_LOG(LOG_DEBUG, "Accept thread terminating...");
+    pthread_exit(NULL);
+}
 
-            if (recvLen < 0) 
-            {
-                aesd_temperary_buffer_clean(&bufferString);
-                //bufferPacketFree(bufferPacket, &bufferPacketIndex);
-                logAndExit("Failed to receive data", __FILE__, EXIT_FAILURE);
-            } 
-            else if (recvLen == 0) 
-            {
-                syslog(LOG_INFO, "Closed connection from %s", inet_ntoa(clientData->clientAddr.sin_addr));
-                printf("Closed connection from %s\n", inet_ntoa(clientData->clientAddr.sin_addr));
-                aesd_temperary_buffer_clean(&bufferString);
-                //bufferPacketFree(bufferPacket, &bufferPacketIndex);
-                close(clientData->newSockFd);
-                break;
-            }      
-            
-            printf("Received %zd bytes from %s\n", recvLen, inet_ntoa(clientData->clientAddr.sin_addr));
+/**
+ * Takes over the listeners of the server process that started this one,
+ * instead of opening them.
+ */
+void receiveListeners(int predecessorFd)
+{
+    int fds[MAX_LISTENERS + 2];
+    struct aesd_upgrade_header header;
 
-            if (checkForNullCharInString(bufferString.buffptr, recvLen)) 
-            {
-                //bufferPacketFree(bufferPacket, &bufferPacketIndex);
-                printf("Received data contains null character\n");
-            }
+    if (aesd_upgrade_receive(predecessorFd, &header, fds, MAX_LISTENERS + 2) == false)
+    {
+        logAndExit("Failed to receive listeners from the previous server", __FILE__, EXIT_FAILURE);
+    }
+    if ((int)header.listeners != listenerCount || (header.unixListener != 0) != (unixSocketPath != NULL))
+    {
+        logAndExit("Listeners of the previous server do not match the arguments", __FILE__, EXIT_FAILURE);
+    }
 
-            ssize_t newlinePosition = -1;
-            if (checkForNewlineCharInString(bufferString.buffptr, recvLen, &newlinePosition)) 
-            {
+    shardCount = listenerCount;
+    memcpy(listenFds, fds, shardCount * sizeof(int));
+    serverSockFd = listenFds[0];
+    if (header.unixListener)
+    {
+        unixSockFd = fds[shardCount];
+        listenFds[shardCount++] = unixSockFd;
+    }
+    if (header.history)
+    {
+        aesd_backing_store_adopt_history(fds[shardCount]);
+    }
+    AESD_LOG(LOG_INFO, "Took over %d listeners from the previous server", shardCount);
+}
 
-                pthread_mutex_lock(&fileMutex);
-                FILE *fptr;
-                struct aesd_seekto command = {0};
+/**
+ * Starts the binary this server was started from, with the same arguments, and
+ * hands it the listeners and the in-memory log. Returns true once it serves;
+ * on failure this process carries on as if nothing happened.
+ */
+bool handOver(const sigset_t *mask)
+{
+    int fds[MAX_LISTENERS + 2];
+    struct aesd_upgrade_header header = {0};
+
+    memcpy(fds, listenFds, shardCount * sizeof(int));
+    header.listeners = listenerCount;
+    header.unixListener = unixSockFd >= 0;
+    int historyFd = aesd_backing_store_history_fd();
+    if (historyFd >= 0)
+    {
+        fds[shardCount] = historyFd;
+        header.history = 1;
+    }
 
-                if(checkForCommandInString(bufferString.buffptr, bufferString.size, &command) == true)
-                {
-#if USE_AESD_CHAR_DEVICE
-                    fptr = fopen("/dev/aesdchar", "r+");
-#else
-                    fptr = fopen("/var/tmp/aesdsocketdata", "r+");
-#endif
+    AESD_LOG(LOG_INFO, "Handing over to a new %s", execPath);
+    pid_t pid;
+    int sockFd = aesd_upgrade_spawn(execPath, serverArgv, mask, &header, fds, &pid);
+    if (sockFd < 0)
+    {
+        AESD_LOG(LOG_ERR, "Failed to start %s: %s", execPath, strerror(errno));
+        return false;
+    }
+    bool ready = aesd_upgrade_wait_ready(sockFd, pid, UPGRADE_READY_TIMEOUT_MS);
+    close(sockFd);
+    if (ready == false)
+    {
+        AESD_LOG(LOG_ERR, "New server failed to start, carrying on");
+        return false;
+    }
+    AESD_LOG(LOG_INFO, "Process %d took over the listeners", (int)pid);
+    return true;
+}
 
-                    if (ioctl(fileno(fptr), AESDCHAR_IOCSEEKTO, &command) < 0) 
-                    {
-                        perror("ioctl");
-                        pthread_mutex_unlock(&fileMutex);
-                        aesd_temperary_buffer_clean(&bufferString);
-                        logAndExit("Failed to seek in file", __FILE__, EXIT_FAILURE);
-                    }
-
-                    char bufferSend[BUFFER_SIZE] = {0};
-                    memset(bufferSend, 0, sizeof(bufferSend));
-
-                    while (1)
-                    {
-                        size_t bytesRead = fread(bufferSend, 1, sizeof(bufferSend), fptr);
-                        if (bytesRead == 0) 
-                        {
-                            if (feof(fptr)) 
-                            {
-                                break;
-                            } 
-                            else 
-                            {
-                                logAndExit("Failed to read from file", __FILE__, EXIT_FAILURE);
-                            }
-                        }
-                        send(clientData->newSockFd, bufferSend, bytesRead, 0);
-                        memset(bufferSend, 0, sizeof(bufferSend));
-                    }               
-
-                    fclose(fptr);
-
-                }
-                else
-                {
-#if USE_AESD_CHAR_DEVICE
-                    fptr = fopen("/dev/aesdchar", "a");
-#else
-                    fptr = fopen("/var/tmp/aesdsocketdata", "a");
-#endif
-            
-                    printf("Received data contains newline character\n");
-                    // for (size_t i = 0; i < bufferPacketIndex; i++)
-                    // {
-                    //     if (bufferPacket[i] == NULL) 
-                    //     {
-                    //         continue;
-                    //     }
-                        //printf("Writing to file (file descriptor %d): %s\n", clientData->newSockFd, bufferString.buffptr);
-
-                        printf("Writing to file (byte %ld):\n", bufferString.size);
-                        for (size_t i = 0; i < bufferString.size; i++)
-                        {
-                            printf("%c", bufferString.buffptr[i]);
-                        }
-                        printf("\n");
-                        
-
-
-                        fwrite(bufferString.buffptr, 1, bufferString.size, fptr);
-                    // }
-
-                    fclose(fptr);
-                    char bufferSend[BUFFER_SIZE] = {0};
-                    memset(bufferSend, 0, sizeof(bufferSend));
-
-#if USE_AESD_CHAR_DEVICE
-                    fptr = fopen("/dev/aesdchar", "r");
-#else
-                    fptr = fopen("/var/tmp/aesdsocketdata", "r");
-#endif
+/**
+ * True once no event loop or io_uring loop accepts any more connections.
+ */
+bool acceptorsDrained(void)
+{
+    for (int i = 0; i < eventLoopCount && mode == SERVER_MODE_EPOLL; i++)
+    {
+        if (aesd_event_loop_drained(&eventLoops[i]) == false)
+        {
+            return false;
+        }
+    }
+    for (int i = 0; i < uringLoopCount; i++)
+    {
+        if (aesd_uring_drained(&uringLoops[i]) == false)
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
-                    while (1)
-                    {
-                        size_t bytesRead = fread(bufferSend, 1, sizeof(bufferSend), fptr);
-                        if (bytesRead == 0) 
-                        {
-                            if (feof(fptr)) 
-                            {
-                                break;
-                            } 
-                            else 
-                            {
-                                logAndExit("Failed to read from file", __FILE__, EXIT_FAILURE);
-                            }
-                        }
-                        send(clientData->newSockFd, bufferSend, bytesRead, 0);
-                        memset(bufferSend, 0, sizeof(bufferSend));
-                    }
-                    fclose(fptr);
-                }
-
-                pthread_mutex_unlock(&fileMutex);
-                aesd_temperary_buffer_clean(&bufferString);
-            }
-        }
-    }
-
-    cleanupClientHandler(clientData, &bufferString);
-    //bufferPacketDelete(bufferPacket);
-    printf("Close client handler thread ID: %ld\n", syscall(SYS_gettid));
-    pthread_exit(NULL);
+/**
+ * Stops accepting and waits for the open connections to close, for up to
+ * DRAIN_TIMEOUT_MS or until SIGINT/SIGTERM.
+ */
+void drainConnections(const sigset_t *mask)
+{
+    ssize_t res = write(pipeDrain[1], "x", 1);
+    (void)res; // Unused variable
+
+    // The successor keeps the timestamps going
+    if (timestampTimerFd >= 0)
+    {
+        close(timestampTimerFd);
+        timestampTimerFd = -1;
+    }
+
+    // A connection an acceptor is still taking in is not counted yet
+    for (int i = 0; i < acceptThreadCount; i++)
+    {
+        pthread_join(acceptThreads[i], NULL);
+    }
+    acceptThreadCount = 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    time_t deadline = now.tv_sec + DRAIN_TIMEOUT_MS / 1000;
+    struct timespec tick = { .tv_sec = 0, .tv_nsec = DRAIN_POLL_MS * 1000000L };
+
+    while (!stop && now.tv_sec < deadline && (acceptorsDrained() == false || aesd_admission_open_connections() > 0))
+    {
+        ppoll(NULL, 0, &tick, mask);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    AESD_LOG(LOG_INFO, "Drained, %zu connections left", aesd_admission_open_connections());
 }
 
 int main(int argc, char *argv[]) {
-    printf("Server type: %s\n", USE_AESD_CHAR_DEVICE == 1 ? "AESD_CHAR_DEVICE" : "VAR/TMP");
-    printf("Server version: %s\n", version);
     openlog("Server", LOG_PID, LOG_USER);
 
-    if (argc == 2 && strcmp(argv[1], "-d") == 0) 
+    // Resolved now: once an upgrade replaced the binary, /proc/self/exe names
+    // the deleted file
+    ssize_t execPathLen = readlink("/proc/self/exe", execPath, sizeof(execPath) - 1);
+    execPath[execPathLen > 0 ? execPathLen : 0] = '\0';
+    serverArgv = argv;
+    int predecessorFd = aesd_upgrade_inherited();
+
+    parseArguments(argc, argv);
+    if (mode == SERVER_MODE_URING && aesd_uring_supported() == false)
+    {
+        AESD_LOG(LOG_WARNING, "Falling back to epoll");
+        mode = SERVER_MODE_EPOLL;
+    }
+    if (mode == SERVER_MODE_URING && replyPath != AESD_REPLY_PATH_COPY &&
+        (USE_AESD_CHAR_DEVICE == 1 || replyPath == AESD_REPLY_PATH_SENDFILE))
+    {
+        // The ring sends from memory; sendfile() has no completion-based counterpart here.
+        // Without the in-memory history (the char device) that leaves copies
+        enum aesd_backing_store_reply_path ringPath = USE_AESD_CHAR_DEVICE == 1 ? AESD_REPLY_PATH_COPY :
+                                                                                 AESD_REPLY_PATH_HISTORY;
+        if (replyPath == AESD_REPLY_PATH_SENDFILE)
+        {
+            AESD_LOG(LOG_WARNING, "sendfile replies are not available with io_uring, using %s",
+                     ringPath == AESD_REPLY_PATH_COPY ? "copy" : "history");
+        }
+        replyPath = ringPath;
+    }
+    aesd_backing_store_set_reply_path(replyPath);
+    aesd_backing_store_set_group_commit(commitWindowUs, commitMaxBatch);
+    aesd_connection_set_high_water(outputHighWater);
+    aesd_connection_set_idle_timeout((unsigned)idleTimeoutMs);
+    aesd_connection_set_max_packet(maxPacketBytes);
+    aesd_admission_set_limits(maxConnections, maxPerSource);
+    // Thread mode never holds more than its workers and their queue
+    size_t reserve = mode == SERVER_MODE_THREAD ? (size_t)workerThreadCount + workerQueueDepth : CONNECTION_RESERVE;
+    if (aesd_connection_reserve(reserve) == false)
     {
-        runAsDaemon = true;
+        logAndExit("Failed to reserve connections", __FILE__, EXIT_FAILURE);
     }
 
-    if (runAsDaemon) 
+    static const char *modeNames[] = { "THREAD", "EPOLL", "URING" };
+    AESD_LOG(LOG_INFO, "Server type: %s", USE_AESD_CHAR_DEVICE == 1 ? "AESD_CHAR_DEVICE" : "VAR/TMP");
+    AESD_LOG(LOG_INFO, "Server version: %s", version);
+    AESD_LOG(LOG_INFO, "Server mode: %s", modeNames[mode]);
+    char tuningText[128];
+    aesd_tuning_describe(tuningText, sizeof(tuningText));
+    AESD_LOG(LOG_INFO, "Socket tuning:%s", tuningText);
+
+    // A successor inherits the session its predecessor already detached
+    if (runAsDaemon && predecessorFd < 0) 
     {
-        printf("Running as daemon\n");
-        syslog(LOG_INFO, "Running as daemon");
+        AESD_LOG(LOG_INFO, "Running as daemon");
         pid_t pid = fork();
 
         if (pid < 0) 
@@ -626,83 +963,254 @@ int main(int argc, char *argv[]) {
 
     setSignalSIGINTHandler();
     setSignalSIGTERMHandler();
+    setSignalSIGUSR2Handler();
 
-    serverSockFd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-
-    if (serverSockFd < 0) 
+    // io_uring loops always accept on their own, one per shard
+    bool sharded = listenerCount > 1 || mode == SERVER_MODE_URING;
+    if (predecessorFd >= 0)
     {
-        logAndExit("Failed to create socket", __FILE__, EXIT_FAILURE);
+        receiveListeners(predecessorFd);
     }
+    else
+    {
+        serverSockFd = openListener(listenerCount > 1);
+        listenFds[0] = serverSockFd;
+        for (int i = 1; i < listenerCount; i++)
+        {
+            listenFds[i] = openListener(true);
+        }
+        shardCount = listenerCount;
+        if (unixSocketPath != NULL)
+        {
+            unixSockFd = openUnixListener(unixSocketPath);
+            listenFds[shardCount++] = unixSockFd;
+        }
+    }
+    // Acceptors wait for readiness first, only the io_uring loops accept blocking
+    for (int i = 0; i < shardCount && mode != SERVER_MODE_URING; i++)
+    {
+        if (fcntl(listenFds[i], F_SETFL, fcntl(listenFds[i], F_GETFL, 0) | O_NONBLOCK) < 0)
+        {
+            logAndExit("Failed to make listening socket non-blocking", __FILE__, EXIT_FAILURE);
+        }
+    }
+    if (sharded && mode != SERVER_MODE_URING)
+    {
+        // Every shard brings its own acceptor, so there is one loop per shard
+        eventLoopCount = shardCount;
+        AESD_LOG(LOG_INFO, "Listening on %d SO_REUSEPORT shards, backlog %d", listenerCount, listenBacklog);
+    }
+    long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    cpuCount = cpuCount > 0 ? cpuCount : 1;
 
-    int optval = 1;
-    if (setsockopt(serverSockFd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) 
+    if (pipe2(pipeClientHandler, O_CLOEXEC) < 0)
     {
-        logAndExit("Failed to set socket options", __FILE__, EXIT_FAILURE);
+        logAndExit("Failed to create pipe for client handler", __FILE__, EXIT_FAILURE);
+    }
+    if (pipe2(pipeDrain, O_CLOEXEC) < 0)
+    {
+        logAndExit("Failed to create pipe for draining", __FILE__, EXIT_FAILURE);
     }
 
-    struct sockaddr_in serverAddr;
-    memset(&serverAddr, 0, sizeof(serverAddr));
-    serverAddr.sin_family = AF_INET;  
-    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);  
-    serverAddr.sin_port = htons(9000);  
+    sigset_t previousMask;
+    blockTerminationSignals(&previousMask);
 
-    if (bind(serverSockFd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) 
+    if (aesd_log_start() == false)
     {
-        logAndExit("Failed to bind socket", __FILE__, EXIT_FAILURE);
+        restoreSignals(&previousMask);
+        logAndExit("Failed to start logger", __FILE__, EXIT_FAILURE);
     }
 
-    listen(serverSockFd, 5);
+    if (aesd_backing_store_init() == false)
+    {
+        restoreSignals(&previousMask);
+        logAndExit("Failed to initialize backing store", __FILE__, EXIT_FAILURE);
+    }
+
+    if (metricsPath != NULL && aesd_metrics_start(metricsPath, pipeClientHandler[0]) == false)
+    {
+        restoreSignals(&previousMask);
+        logAndExit("Failed to start metrics socket", __FILE__, EXIT_FAILURE);
+    }
 
 #if !USE_AESD_CHAR_DEVICE
-    if (pthread_create(&timestampThread, NULL, timestampWriterHandler, NULL) == 0) 
+    // Ticks are handled by the main thread's wait below, next to the listener
+    timestampTimerFd = aesd_timestamp_timer_open(timestampIntervalMs);
+    if (timestampTimerFd < 0)
     {
-        timestampThreadStarted = true;
+        AESD_LOG(LOG_ERR, "Failed to create timestamp timer: %s", strerror(errno));
     }
 #endif
 
-    if (pipe(pipeClientHandler) < 0) 
+    if (mode == SERVER_MODE_URING)
     {
-        logAndExit("Failed to create pipe for client handler", __FILE__, EXIT_FAILURE);
+        for (int i = 0; i < shardCount; i++)
+        {
+            if (aesd_uring_start(&uringLoops[i], pipeClientHandler[0], listenFds[i], pipeDrain[0], (int)(i % cpuCount)) == false)
+            {
+                restoreSignals(&previousMask);
+                logAndExit("Failed to start io_uring loop", __FILE__, EXIT_FAILURE);
+            }
+            uringLoopCount++;
+        }
+    }
+    else if (mode == SERVER_MODE_EPOLL)
+    {
+        for (int i = 0; i < eventLoopCount; i++)
+        {
+            int listenFd = sharded ? listenFds[i] : -1;
+            int cpu = sharded ? (int)(i % cpuCount) : -1;
+            if (aesd_event_loop_start(&eventLoops[i], pipeClientHandler[0], listenFd, pipeDrain[0], cpu) == false)
+            {
+                restoreSignals(&previousMask);
+                logAndExit("Failed to start event loop", __FILE__, EXIT_FAILURE);
+            }
+        }
+    }
+    else if (aesd_worker_pool_init(&workerPool, workerThreadCount, workerQueueDepth, clientHandler) == false)
+    {
+        restoreSignals(&previousMask);
+        logAndExit("Failed to start worker pool", __FILE__, EXIT_FAILURE);
+    }
+    else if (sharded)
+    {
+        for (int i = 0; i < shardCount; i++)
+        {
+            pthread_attr_t attr;
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cpuCount, &cpus);
+            aesd_thread_attr_init(&attr);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+            int created = pthread_create(&acceptThreads[i], &attr, acceptHandler, (void *)(intptr_t)i);
+            pthread_attr_destroy(&attr);
+            if (created != 0)
+            {
+                restoreSignals(&previousMask);
+                logAndExit("Failed to start accept thread", __FILE__, EXIT_FAILURE);
+            }
+            acceptThreadCount++;
+        }
     }
 
-#if !USE_AESD_CHAR_DEVICE
-    if (pipe(pipeTimestampWriterHandler) < 0) 
+    if (predecessorFd >= 0)
     {
-        logAndExit("Failed to create pipe for timestamp writer handler", __FILE__, EXIT_FAILURE);
+        aesd_upgrade_ready(predecessorFd);
     }
-#endif
+
+    if (sharded)
+    {
+        // The shards accept on their own; wait here for SIGINT/SIGTERM/SIGUSR2
+        struct pollfd timerPoll = { .fd = timestampTimerFd, .events = POLLIN };
+        while (!stop && !handedOver)
+        {
+            if (ppoll(&timerPoll, 1, NULL, &previousMask) > 0 && (timerPoll.revents & POLLIN))
+            {
+                aesd_timestamp_on_timer(timestampTimerFd);
+            }
+            if (upgrade)
+            {
+                upgrade = 0;
+                handedOver = handOver(&previousMask);
+            }
+        }
+        if (handedOver)
+        {
+            drainConnections(&previousMask);
+        }
+        restoreSignals(&previousMask);
+        AESD_LOG(LOG_INFO, handedOver ? "Handed over, exiting" : "Caught signal, exiting");
+        cleanupMain();
+        return EXIT_SUCCESS;
+    }
+
+    struct pollfd fds[3];
+    fds[0].fd = serverSockFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = timestampTimerFd;   // ignored by ppoll() when -1
+    fds[1].events = POLLIN;
+    fds[2].fd = unixSockFd;
+    fds[2].events = POLLIN;
 
     while (!stop)
     {
-        struct sockaddr_in clientAddr;
-        int clientLen = sizeof(clientAddr);
+        struct sockaddr_storage clientAddr;
+        socklen_t clientLen = sizeof(clientAddr);
         int newSockFd = 0;
 
-        printf("Waiting for a connection...\n");
-        newSockFd = accept(serverSockFd, (struct sockaddr *) &clientAddr, (socklen_t *) &clientLen);
-        if (newSockFd < 0)
+        if (upgrade)
         {
-            if (errno == EINTR && stop)
+            upgrade = 0;
+            handedOver = handOver(&previousMask);
+            if (handedOver)
             {
                 break;
             }
+        }
+
+        AESD_LOG(LOG_DEBUG, "Waiting for a connection...");
+        // SIGINT/SIGTERM are only unblocked while waiting, so none is lost
+        // between the check of stop and the wait
+        if (ppoll(fds, 3, NULL, &previousMask) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            restoreSignals(&previousMask);
+            logAndExit("Failed to poll listening socket", __FILE__, EXIT_FAILURE);
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            aesd_timestamp_on_timer(timestampTimerFd);
+        }
+        int readyFd = (fds[0].revents & POLLIN) ? serverSockFd : (fds[2].revents & POLLIN) ? unixSockFd : -1;
+        if (readyFd < 0)
+        {
+            continue;
+        }
+
+        // Close-on-exec, so a successor spawned on SIGUSR2 does not inherit it
+        newSockFd = accept4(readyFd, (struct sockaddr *) &clientAddr, &clientLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (newSockFd < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            restoreSignals(&previousMask);
             logAndExit("Failed to accept connection", __FILE__, EXIT_FAILURE);
         }
-        printf("File descriptor for new connection: %d\n\n", newSockFd);
-        syslog(LOG_INFO, "Accepted connection from %s", inet_ntoa(clientAddr.sin_addr));
-        printf("Accepted connection from %s\n", inet_ntoa(clientAddr.sin_addr));
 
-        clientData_t* clientDataContainer = malloc(sizeof(clientData_t));
-        memset(clientDataContainer, 0, sizeof(clientData_t));
-        clientDataContainer->clientLen = sizeof(struct sockaddr_in);
-        clientDataContainer->newSockFd = newSockFd;
-        clientDataContainer->clientAddr = clientAddr;
+        struct aesd_connection* connection = aesd_connection_create(newSockFd, (struct sockaddr *)&clientAddr, clientLen);
+        if (connection == NULL && errno == ECONNREFUSED)
+        {
+            // Turned away by admission control
+            close(newSockFd);
+            continue;
+        }
+        if (connection == NULL)
+        {
+            restoreSignals(&previousMask);
+            logAndExit("Failed to allocate client connection", __FILE__, EXIT_FAILURE);
+        }
+
+        if (mode == SERVER_MODE_EPOLL)
+        {
+            aesd_event_loop_add_connection(&eventLoops[nextEventLoop], connection);
+            nextEventLoop = (nextEventLoop + 1) % eventLoopCount;
+            continue;
+        }
 
-        pthread_create(&clientThreads[threadCount++], NULL, clientHandler, clientDataContainer);
+        submitConnection(connection);
     }
 
-    cleanupMain();    
-    syslog(LOG_INFO, "Caught signal, exiting");
-    printf("Caught signal, exiting\n");
+    if (handedOver)
+    {
+        drainConnections(&previousMask);
+    }
+    restoreSignals(&previousMask);
+    AESD_LOG(LOG_INFO, handedOver ? "Handed over, exiting" : "Caught signal, exiting");
+    cleanupMain();
     return EXIT_SUCCESS;
 }
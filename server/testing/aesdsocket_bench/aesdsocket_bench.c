@@ -0,0 +1,1754 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../../src/aesd_compress.h"
+#include "../../src/aesd_frame.h"
+#include "../../src/aesd_lz.h"
+
+#define MAX_STEPS       32
+#define RECV_CHUNK      65536
+#define FLOOD_RAMP_US               500000
+#define FLOOD_REPLY_TIMEOUT_MS      5000
+
+// The full history sent back for the command is drained with the first reply
+static const char deltaCommand[] = "AESDCHAR_DELTA:1\n";
+static const char compressCommand[] = "AESDCHAR_COMPRESS:1\n";
+
+struct benchOptions
+{
+    const char *host;               // IPv4 or IPv6 literal
+    int port;
+    const char *unixPath;           // connect to this unix socket instead
+    int steps[MAX_STEPS];
+    int stepCount;
+    int samples;
+    int lineSize;
+    long serverPid;
+    int churn;
+    bool throughput;
+    int ingestSizes[MAX_STEPS];     // MB, single-line packets
+    int ingestCount;
+    int pipelineLines;              // lines sent back to back in one segment
+    int concurrentClients;          // clients running round trips at the same time
+    int slowClients;                // how many of them read their replies slowly
+    int stalledClients;             // extra clients that pipeline packets and never read
+    bool delta;                     // ask for delta replies before the first packet
+    int connectRate;                // connections opened by the connect-rate mode
+    int connectThreads;             // client threads opening them
+    int loadClients;                // connections driven by the load generator
+    int loadRate;                   // packets per second per connection, 0 for back to back
+    int seekEvery;                  // every n-th load packet is a seek command, 0 for none
+    bool frames;                    // load generator speaks the framed protocol
+    bool compress;                  // load generator asks for compressed replies
+    int floodConnections;           // idle connections held open during the load run
+    const char *floodSource;        // local address they connect from
+};
+
+struct recvBuffer
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * TCP segments sent on this host so far, from /proc/net/snmp; over loopback
+ * that counts both ends of every connection. 0 when unavailable.
+ */
+static uint64_t tcpOutSegments(void)
+{
+    FILE *snmp = fopen("/proc/net/snmp", "r");
+    char names[1024];
+    char values[1024];
+    uint64_t segments = 0;
+
+    if (snmp == NULL)
+    {
+        return 0;
+    }
+    // A "Tcp:" line of field names is followed by one with their values
+    while (fgets(names, sizeof(names), snmp) != NULL)
+    {
+        if (strncmp(names, "Tcp:", 4) != 0 || fgets(values, sizeof(values), snmp) == NULL)
+        {
+            continue;
+        }
+        char *nameSaved;
+        char *valueSaved;
+        char *name = strtok_r(names, " \n", &nameSaved);
+        char *value = strtok_r(values, " \n", &valueSaved);
+        while (name != NULL && value != NULL)
+        {
+            if (strcmp(name, "OutSegs") == 0)
+            {
+                segments = strtoull(value, NULL, 10);
+                break;
+            }
+            name = strtok_r(NULL, " \n", &nameSaved);
+            value = strtok_r(NULL, " \n", &valueSaved);
+        }
+        break;
+    }
+    fclose(snmp);
+    return segments;
+}
+
+static int compareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *sorted, int count, double p)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    int index = (int)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+/**
+ * Connects to the server, over TCP from the local address @param source if it
+ * is not NULL. A @param timeoutMs above 0 bounds how long connect() may wait
+ * for the handshake.
+ */
+static int connectFrom(const struct benchOptions *options, const char *source, int timeoutMs)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    memset(&addr, 0, sizeof(addr));
+
+    if (options->unixPath != NULL)
+    {
+        struct sockaddr_un *local = (struct sockaddr_un *)&addr;
+        local->sun_family = AF_UNIX;
+        strncpy(local->sun_path, options->unixPath, sizeof(local->sun_path) - 1);
+        addrLen = sizeof(*local);
+    }
+    else
+    {
+        struct sockaddr_in *inet = (struct sockaddr_in *)&addr;
+        struct sockaddr_in6 *inet6 = (struct sockaddr_in6 *)&addr;
+        if (inet_pton(AF_INET, options->host, &inet->sin_addr) == 1)
+        {
+            inet->sin_family = AF_INET;
+            inet->sin_port = htons(options->port);
+            addrLen = sizeof(*inet);
+        }
+        else if (inet_pton(AF_INET6, options->host, &inet6->sin6_addr) == 1)
+        {
+            inet6->sin6_family = AF_INET6;
+            inet6->sin6_port = htons(options->port);
+            addrLen = sizeof(*inet6);
+        }
+        else
+        {
+            fprintf(stderr, "Invalid host %s\n", options->host);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (timeoutMs > 0)
+    {
+        struct timeval timeout = { .tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    if (source != NULL && options->unixPath == NULL)
+    {
+        struct sockaddr_storage local;
+        memset(&local, 0, sizeof(local));
+        local.ss_family = addr.ss_family;
+        void *localAddr = addr.ss_family == AF_INET ? (void *)&((struct sockaddr_in *)&local)->sin_addr
+                                                    : (void *)&((struct sockaddr_in6 *)&local)->sin6_addr;
+        if (inet_pton(addr.ss_family, source, localAddr) != 1)
+        {
+            fprintf(stderr, "Invalid source address %s\n", source);
+            exit(EXIT_FAILURE);
+        }
+        if (bind(fd, (struct sockaddr *)&local, addrLen) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, addrLen) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connectToServer(const struct benchOptions *options)
+{
+    return connectFrom(options, NULL, 0);
+}
+
+/**
+ * Reads replies until the stream received so far ends with @param line, which is
+ * how a full-history reply to our own packet ends when we are the only writer.
+ */
+static bool waitForLine(int fd, struct recvBuffer *buffer, const char *line, size_t lineLen)
+{
+    buffer->size = 0;
+    while (buffer->size < lineLen || memcmp(buffer->data + buffer->size - lineLen, line, lineLen) != 0)
+    {
+        if (buffer->capacity - buffer->size < RECV_CHUNK)
+        {
+            buffer->capacity = buffer->capacity * 2 + RECV_CHUNK;
+            buffer->data = realloc(buffer->data, buffer->capacity);
+            if (buffer->data == NULL)
+            {
+                return false;
+            }
+        }
+        ssize_t received = recv(fd, buffer->data + buffer->size, buffer->capacity - buffer->size, 0);
+        if (received <= 0)
+        {
+            errno = received == 0 ? ECONNRESET : errno;
+            return false;
+        }
+        buffer->size += received;
+    }
+    return true;
+}
+
+static long readServerStatus(long pid, const char *field)
+{
+    char path[64];
+    char line[256];
+    long value = -1;
+    size_t fieldLen = strlen(field);
+
+    snprintf(path, sizeof(path), "/proc/%ld/status", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (strncmp(line, field, fieldLen) == 0 && line[fieldLen] == ':')
+        {
+            value = strtol(line + fieldLen + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+/**
+ * CPU time the server process used so far, user and system, in seconds; -1
+ * when it cannot be read.
+ */
+static double readServerCpu(long pid)
+{
+    char path[64];
+    char stat[1024];
+
+    snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    size_t length = fread(stat, 1, sizeof(stat) - 1, f);
+    fclose(f);
+    stat[length] = '\0';
+
+    // utime and stime are fields 14 and 15, counted from behind the command
+    // name, which may hold spaces
+    char *fields = strrchr(stat, ')');
+    unsigned long utime;
+    unsigned long stime;
+    if (fields == NULL || sscanf(fields + 2, "%*c %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %lu %lu",
+                                 &utime, &stime) != 2)
+    {
+        return -1;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static bool sendAll(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, data, size, 0);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static void buildLine(char *line, int lineSize, unsigned long sequence)
+{
+    int prefix = snprintf(line, lineSize + 1, "bench:%lu:", sequence);
+    memset(line + prefix, 'x', lineSize - prefix - 1);
+    line[lineSize - 1] = '\n';
+}
+
+static void printLatencies(const char *label, uint64_t *latencies, int count)
+{
+    qsort(latencies, count, sizeof(uint64_t), compareU64);
+    printf("%s p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", label,
+           percentile(latencies, count, 0.50) / 1000.0,
+           percentile(latencies, count, 0.99) / 1000.0,
+           percentile(latencies, count, 0.999) / 1000.0,
+           latencies[count - 1] / 1000.0);
+}
+
+/**
+ * Connection churn: every sample is a fresh connection that sends one packet,
+ * waits for the reply and closes, so the latency includes accept and dispatch.
+ */
+static int runChurn(const struct benchOptions *options)
+{
+    uint64_t *connectLatencies = calloc(options->churn, sizeof(uint64_t));
+    uint64_t *replyLatencies = calloc(options->churn, sizeof(uint64_t));
+    char *line = malloc(options->lineSize + 1);
+    struct recvBuffer buffer = {0};
+    int completed = 0;
+
+    if (connectLatencies == NULL || replyLatencies == NULL || line == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t begin = nowNs();
+    for (int i = 0; i < options->churn; i++)
+    {
+        buildLine(line, options->lineSize, i);
+
+        uint64_t start = nowNs();
+        int fd = connectToServer(options);
+        if (fd < 0)
+        {
+            fprintf(stderr, "connect failed after %d connections: %s\n", i, strerror(errno));
+            break;
+        }
+        connectLatencies[i] = nowNs() - start;
+        if (send(fd, line, options->lineSize, 0) != options->lineSize ||
+            waitForLine(fd, &buffer, line, options->lineSize) == false)
+        {
+            fprintf(stderr, "round trip failed: %s\n", strerror(errno));
+            close(fd);
+            break;
+        }
+        replyLatencies[i] = nowNs() - start;
+        close(fd);
+        completed++;
+    }
+    uint64_t elapsed = nowNs() - begin;
+
+    if (completed > 0)
+    {
+        printf("%d connections in %.3f s, %.0f connections/s\n", completed, elapsed / 1e9, completed / (elapsed / 1e9));
+        printLatencies("connect:", connectLatencies, completed);
+        printLatencies("connect to reply:", replyLatencies, completed);
+    }
+
+    free(buffer.data);
+    free(line);
+    free(replyLatencies);
+    free(connectLatencies);
+    return completed == options->churn ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Reply throughput: one connection, every packet is answered with the whole
+ * history, so with a large pre-filled history this measures the reply path.
+ */
+static int runThroughput(const struct benchOptions *options)
+{
+    uint64_t *latencies = calloc(options->samples, sizeof(uint64_t));
+    char *line = malloc(options->lineSize + 1);
+    struct recvBuffer buffer = {0};
+    uint64_t totalBytes = 0;
+    uint64_t totalNs = 0;
+
+    if (latencies == NULL || line == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    int fd = connectToServer(options);
+    if (fd < 0)
+    {
+        perror("connect");
+        return EXIT_FAILURE;
+    }
+
+    if (options->delta && sendAll(fd, deltaCommand, sizeof(deltaCommand) - 1) == false)
+    {
+        perror("send");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < options->samples; i++)
+    {
+        buildLine(line, options->lineSize, i);
+
+        uint64_t start = nowNs();
+        if (send(fd, line, options->lineSize, 0) != options->lineSize ||
+            waitForLine(fd, &buffer, line, options->lineSize) == false)
+        {
+            fprintf(stderr, "round trip failed: %s\n", strerror(errno));
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        latencies[i] = nowNs() - start;
+        totalNs += latencies[i];
+        totalBytes += buffer.size;
+    }
+    close(fd);
+
+    printf("%d replies, %.2f MB average, %.1f MB/s\n", options->samples,
+           totalBytes / (double)options->samples / 1e6, totalBytes / (totalNs / 1e9) / 1e6);
+    printLatencies("reply:", latencies, options->samples);
+
+    free(buffer.data);
+    free(line);
+    free(latencies);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Ingest throughput: sends one single-line packet of each size and measures the
+ * time until the first reply byte, i.e. until the server has taken in the whole
+ * packet and stored it.
+ */
+static int runIngest(const struct benchOptions *options)
+{
+    struct recvBuffer buffer = {0};
+
+    printf("%10s %14s %12s %14s\n", "packet_mb", "first_byte_ms", "ingest_mb_s", "full_reply_ms");
+
+    for (int i = 0; i < options->ingestCount; i++)
+    {
+        size_t size = (size_t)options->ingestSizes[i] * 1024 * 1024;
+        char *packet = malloc(size);
+        if (packet == NULL)
+        {
+            perror("malloc");
+            return EXIT_FAILURE;
+        }
+        int prefix = snprintf(packet, size, "ingest:%d:", i);
+        memset(packet + prefix, 'x', size - prefix - 1);
+        packet[size - 1] = '\n';
+
+        int fd = connectToServer(options);
+        if (fd < 0)
+        {
+            perror("connect");
+            free(packet);
+            return EXIT_FAILURE;
+        }
+
+        uint64_t start = nowNs();
+        char first;
+        if (sendAll(fd, packet, size) == false || recv(fd, &first, 1, MSG_PEEK) != 1)
+        {
+            fprintf(stderr, "ingest of %zu bytes failed: %s\n", size, strerror(errno));
+            close(fd);
+            free(packet);
+            return EXIT_FAILURE;
+        }
+        uint64_t firstByte = nowNs() - start;
+
+        if (waitForLine(fd, &buffer, packet, size) == false)
+        {
+            fprintf(stderr, "reply to %zu bytes failed: %s\n", size, strerror(errno));
+            close(fd);
+            free(packet);
+            return EXIT_FAILURE;
+        }
+        uint64_t fullReply = nowNs() - start;
+        close(fd);
+        free(packet);
+
+        printf("%10d %14.1f %12.1f %14.1f\n", options->ingestSizes[i], firstByte / 1e6,
+               size / (firstByte / 1e9) / 1e6, fullReply / 1e6);
+        fflush(stdout);
+    }
+
+    free(buffer.data);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Pipelining: sends a batch of lines with a single send() and waits for one
+ * reply per line. Every reply ends with the line it answers, so the batch is
+ * complete once the stream ends with the last line of the batch.
+ */
+static int runPipeline(const struct benchOptions *options)
+{
+    size_t batchSize = (size_t)options->pipelineLines * options->lineSize;
+    char *batch = malloc(batchSize + 1);
+    uint64_t *latencies = calloc(options->samples, sizeof(uint64_t));
+    struct recvBuffer buffer = {0};
+    unsigned long sequence = 0;
+
+    if (batch == NULL || latencies == NULL)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    int fd = connectToServer(options);
+    if (fd < 0)
+    {
+        perror("connect");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < options->samples; i++)
+    {
+        for (int line = 0; line < options->pipelineLines; line++)
+        {
+            buildLine(batch + (size_t)line * options->lineSize, options->lineSize, sequence++);
+        }
+        const char *lastLine = batch + batchSize - options->lineSize;
+
+        uint64_t start = nowNs();
+        if (sendAll(fd, batch, batchSize) == false ||
+            waitForLine(fd, &buffer, lastLine, options->lineSize) == false)
+        {
+            fprintf(stderr, "pipelined batch failed: %s\n", strerror(errno));
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        latencies[i] = nowNs() - start;
+    }
+    close(fd);
+
+    uint64_t totalNs = 0;
+    for (int i = 0; i < options->samples; i++)
+    {
+        totalNs += latencies[i];
+    }
+    printf("%d batches of %d lines, %.0f lines/s\n", options->samples, options->pipelineLines,
+           (double)options->samples * options->pipelineLines / (totalNs / 1e9));
+    printLatencies("batch:", latencies, options->samples);
+
+    free(buffer.data);
+    free(latencies);
+    free(batch);
+    return EXIT_SUCCESS;
+}
+
+struct concurrentClient
+{
+    const struct benchOptions *options;
+    pthread_barrier_t *startBarrier;
+    int fd;
+    int id;
+    bool slow;
+    uint64_t *latencies;
+    uint64_t bytes;
+    int completed;
+    uint64_t finishedNs;
+};
+
+/**
+ * Like waitForLine(), but drains the socket a few KB at a time with a pause in
+ * between, the way a client on a congested link would.
+ */
+static bool waitForLineSlowly(int fd, struct recvBuffer *buffer, const char *line, size_t lineLen)
+{
+    buffer->size = 0;
+    while (buffer->size < lineLen || memcmp(buffer->data + buffer->size - lineLen, line, lineLen) != 0)
+    {
+        if (buffer->capacity - buffer->size < 4096)
+        {
+            buffer->capacity = buffer->capacity * 2 + RECV_CHUNK;
+            buffer->data = realloc(buffer->data, buffer->capacity);
+            if (buffer->data == NULL)
+            {
+                return false;
+            }
+        }
+        ssize_t received = recv(fd, buffer->data + buffer->size, 4096, 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        buffer->size += received;
+        usleep(1000);
+    }
+    return true;
+}
+
+static void* concurrentClientRun(void *arg)
+{
+    struct concurrentClient *client = arg;
+    const struct benchOptions *options = client->options;
+    char *line = malloc(options->lineSize + 1);
+    struct recvBuffer buffer = {0};
+    int fd = client->fd;
+
+    if (options->delta && sendAll(fd, deltaCommand, sizeof(deltaCommand) - 1) == false)
+    {
+        fprintf(stderr, "client %d delta command failed: %s\n", client->id, strerror(errno));
+    }
+    pthread_barrier_wait(client->startBarrier);
+
+    for (int i = 0; line != NULL && i < options->samples; i++)
+    {
+        // Unique per client so every reply can only end with our own line
+        buildLine(line, options->lineSize, (unsigned long)client->id * 1000000ul + i);
+
+        uint64_t start = nowNs();
+        bool received = send(fd, line, options->lineSize, 0) == options->lineSize &&
+                        (client->slow ? waitForLineSlowly(fd, &buffer, line, options->lineSize)
+                                      : waitForLine(fd, &buffer, line, options->lineSize));
+        if (received == false)
+        {
+            fprintf(stderr, "client %d round trip failed: %s\n", client->id, strerror(errno));
+            break;
+        }
+        client->latencies[i] = nowNs() - start;
+        client->bytes += buffer.size;
+        client->completed++;
+    }
+
+    client->finishedNs = nowNs();
+    close(fd);
+    free(buffer.data);
+    free(line);
+    return NULL;
+}
+
+/**
+ * Pipelines packets on @param fd without ever reading the replies, until the
+ * server stops taking them. Returns how many bytes it accepted.
+ */
+static uint64_t stallConnection(int fd, const struct benchOptions *options)
+{
+    char *batch = malloc((size_t)options->lineSize * 64);
+    uint64_t pushed = 0;
+    int receiveBuffer = 4096;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    for (int i = 0; batch != NULL && i < 64; i++)
+    {
+        buildLine(batch + (size_t)i * options->lineSize, options->lineSize, 9000000000ul + i);
+    }
+
+    while (batch != NULL)
+    {
+        ssize_t sent = send(fd, batch, (size_t)options->lineSize * 64, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            pushed += sent;
+            continue;
+        }
+        struct pollfd writable = { .fd = fd, .events = POLLOUT };
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            break;
+        }
+        if (poll(&writable, 1, 200) <= 0)
+        {
+            break;
+        }
+    }
+
+    free(batch);
+    return pushed;
+}
+
+/**
+ * Concurrency: clients send packets and read the full-history replies (only
+ * what is new with -D) at the same time, some of them slowly. Reports the
+ * aggregate reply rate of the fast clients, which should not depend on how
+ * slowly the others read.
+ */
+static int runConcurrent(const struct benchOptions *options)
+{
+    int clients = options->concurrentClients;
+    pthread_t *threads = calloc(clients, sizeof(pthread_t));
+    struct concurrentClient *state = calloc(clients, sizeof(struct concurrentClient));
+    uint64_t *fastLatencies = calloc((size_t)clients * options->samples, sizeof(uint64_t));
+    int fastCount = 0;
+    uint64_t fastBytes = 0;
+    uint64_t slowBytes = 0;
+    int result = EXIT_SUCCESS;
+    pthread_barrier_t startBarrier;
+    int *stalled = calloc(options->stalledClients + 1, sizeof(int));
+    uint64_t stalledBytes = 0;
+
+    if (threads == NULL || state == NULL || fastLatencies == NULL || stalled == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    // Stalled clients fill their output queues before the measurement starts
+    for (int i = 0; i < options->stalledClients; i++)
+    {
+        stalled[i] = connectToServer(options);
+        if (stalled[i] < 0)
+        {
+            fprintf(stderr, "connect failed after %d stalled clients: %s\n", i, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        stalledBytes += stallConnection(stalled[i], options);
+    }
+
+    // Connect everybody first so the timing does not include the accept backlog
+    for (int i = 0; i < clients; i++)
+    {
+        state[i].fd = connectToServer(options);
+        if (state[i].fd < 0)
+        {
+            fprintf(stderr, "connect failed after %d clients: %s\n", i, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    pthread_barrier_init(&startBarrier, NULL, clients + 1);
+    for (int i = 0; i < clients; i++)
+    {
+        state[i].options = options;
+        state[i].startBarrier = &startBarrier;
+        state[i].id = i;
+        state[i].slow = i < options->slowClients;
+        state[i].latencies = calloc(options->samples, sizeof(uint64_t));
+        if (state[i].latencies == NULL || pthread_create(&threads[i], NULL, concurrentClientRun, &state[i]) != 0)
+        {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+    pthread_barrier_wait(&startBarrier);
+    uint64_t start = nowNs();
+
+    uint64_t fastEnd = start;
+    for (int i = 0; i < clients; i++)
+    {
+        pthread_join(threads[i], NULL);
+        if (state[i].completed != options->samples)
+        {
+            result = EXIT_FAILURE;
+        }
+        if (state[i].slow)
+        {
+            slowBytes += state[i].bytes;
+        }
+        else
+        {
+            memcpy(fastLatencies + fastCount, state[i].latencies, state[i].completed * sizeof(uint64_t));
+            fastCount += state[i].completed;
+            fastBytes += state[i].bytes;
+            fastEnd = state[i].finishedNs > fastEnd ? state[i].finishedNs : fastEnd;
+        }
+        free(state[i].latencies);
+    }
+    pthread_barrier_destroy(&startBarrier);
+    double elapsed = (nowNs() - start) / 1e9;
+    double fastElapsed = (fastEnd - start) / 1e9;
+
+    printf("%d clients (%d slow), %d round trips each, %.2f s total\n", clients, options->slowClients,
+           options->samples, elapsed);
+    if (fastCount > 0)
+    {
+        printf("fast clients: %.0f replies/s, %.1f MB/s\n", fastCount / fastElapsed, fastBytes / fastElapsed / 1e6);
+        printLatencies("fast reply:", fastLatencies, fastCount);
+    }
+    printf("slow clients: %.1f MB received\n", slowBytes / 1e6);
+    if (options->stalledClients > 0)
+    {
+        printf("stalled clients: %d, %.1f MB accepted before the server stopped reading\n",
+               options->stalledClients, stalledBytes / 1e6);
+    }
+
+    for (int i = 0; i < options->stalledClients; i++)
+    {
+        close(stalled[i]);
+    }
+    free(stalled);
+    free(fastLatencies);
+    free(state);
+    free(threads);
+    return result;
+}
+
+struct connectRateClient
+{
+    const struct benchOptions *options;
+    pthread_barrier_t *startBarrier;
+    int id;
+    int connections;
+    uint64_t *latencies;
+    int completed;
+};
+
+static void* connectRateClientRun(void *arg)
+{
+    struct connectRateClient *client = arg;
+    const struct benchOptions *options = client->options;
+    char *line = malloc(options->lineSize + 1);
+    struct recvBuffer buffer = {0};
+
+    pthread_barrier_wait(client->startBarrier);
+
+    for (int i = 0; line != NULL && i < client->connections; i++)
+    {
+        buildLine(line, options->lineSize, (unsigned long)client->id * 1000000ul + i);
+
+        uint64_t start = nowNs();
+        int fd = connectToServer(options);
+        if (fd < 0)
+        {
+            fprintf(stderr, "client %d connect failed: %s\n", client->id, strerror(errno));
+            break;
+        }
+        bool received = send(fd, line, options->lineSize, 0) == options->lineSize &&
+                        waitForLine(fd, &buffer, line, options->lineSize);
+        close(fd);
+        if (received == false)
+        {
+            fprintf(stderr, "client %d round trip failed: %s\n", client->id, strerror(errno));
+            break;
+        }
+        client->latencies[client->completed++] = nowNs() - start;
+    }
+
+    free(buffer.data);
+    free(line);
+    return NULL;
+}
+
+/**
+ * Connect rate: several threads open connections back to back, each one sending
+ * a packet and waiting for the reply before closing, so every connection has
+ * been accepted and served. Reports accepted connections per second.
+ */
+static int runConnectRate(const struct benchOptions *options)
+{
+    int threads = options->connectThreads;
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    struct connectRateClient *clients = calloc(threads, sizeof(struct connectRateClient));
+    uint64_t *latencies = calloc(options->connectRate, sizeof(uint64_t));
+    pthread_barrier_t startBarrier;
+    int completed = 0;
+
+    if (ids == NULL || clients == NULL || latencies == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    pthread_barrier_init(&startBarrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++)
+    {
+        clients[i].options = options;
+        clients[i].startBarrier = &startBarrier;
+        clients[i].id = i;
+        clients[i].connections = options->connectRate / threads + (i < options->connectRate % threads);
+        clients[i].latencies = calloc(clients[i].connections + 1, sizeof(uint64_t));
+        if (clients[i].latencies == NULL || pthread_create(&ids[i], NULL, connectRateClientRun, &clients[i]) != 0)
+        {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+    pthread_barrier_wait(&startBarrier);
+    uint64_t start = nowNs();
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+        memcpy(latencies + completed, clients[i].latencies, clients[i].completed * sizeof(uint64_t));
+        completed += clients[i].completed;
+        free(clients[i].latencies);
+    }
+    double elapsed = (nowNs() - start) / 1e9;
+    pthread_barrier_destroy(&startBarrier);
+
+    if (completed > 0)
+    {
+        printf("%d connections from %d threads in %.3f s, %.0f connections/s\n", completed, threads, elapsed,
+               completed / elapsed);
+        printLatencies("connect to reply:", latencies, completed);
+    }
+
+    free(latencies);
+    free(clients);
+    free(ids);
+    return completed == options->connectRate ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Moves a load connection's read position to an offset within the oldest entry
+static const char seekCommandFormat[] = "AESDCHAR_IOCSEEKTO:0,%d\n";
+
+struct loadClient
+{
+    const struct benchOptions *options;
+    pthread_barrier_t *startBarrier;
+    int fd;
+    int id;
+    uint64_t *writeLatencies;
+    uint64_t *seekLatencies;
+    int writes;
+    int seeks;
+    int badReplies;
+    uint64_t bytesOut;
+    uint64_t bytesIn;               // history the replies carried
+    uint64_t bytesWire;             // bytes the replies took on the wire
+};
+
+static bool recvAll(int fd, void *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t received = recv(fd, data, size, 0);
+        if (received <= 0)
+        {
+            errno = received == 0 ? ECONNRESET : errno;
+            return false;
+        }
+        data = (char *)data + received;
+        size -= received;
+    }
+    return true;
+}
+
+static bool sendFrame(int fd, uint8_t opcode, const void *payload, size_t length)
+{
+    unsigned char header[AESD_FRAME_HEADER_SIZE];
+    struct aesd_frame_header frame = { .length = length, .opcode = opcode };
+
+    aesd_frame_encode(header, &frame);
+    return send(fd, header, sizeof(header), length > 0 ? MSG_MORE : 0) == sizeof(header) &&
+           sendAll(fd, payload, length);
+}
+
+static bool reserveBuffer(struct recvBuffer *buffer, size_t size)
+{
+    if (buffer->capacity < size)
+    {
+        buffer->capacity = size + RECV_CHUNK;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (buffer->data == NULL)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Decompresses the blocks of a compressed reply in @param packed and appends
+ * them to @param buffer.
+ */
+static bool inflateReply(const struct recvBuffer *packed, struct recvBuffer *buffer)
+{
+    const unsigned char *block = (const unsigned char *)packed->data;
+    const unsigned char *end = block + packed->size;
+
+    while (block < end)
+    {
+        if (end - block < AESD_COMPRESS_BLOCK_HEADER_SIZE)
+        {
+            errno = EPROTO;
+            return false;
+        }
+        uint32_t rawLength = aesd_frame_get_u32(block);
+        uint32_t stored = aesd_frame_get_u32(block + sizeof(uint32_t));
+        size_t storedLength = stored & ~AESD_COMPRESS_STORED;
+        block += AESD_COMPRESS_BLOCK_HEADER_SIZE;
+        if (rawLength > AESD_COMPRESS_BLOCK_SIZE || storedLength > (size_t)(end - block) ||
+            reserveBuffer(buffer, buffer->size + rawLength) == false)
+        {
+            errno = EPROTO;
+            return false;
+        }
+
+        ssize_t inflated;
+        if (stored & AESD_COMPRESS_STORED)
+        {
+            memcpy(buffer->data + buffer->size, block, storedLength);
+            inflated = storedLength;
+        }
+        else
+        {
+            inflated = aesd_lz_decompress(block, storedLength, buffer->data + buffer->size, rawLength);
+        }
+        if (inflated != rawLength)
+        {
+            errno = EPROTO;
+            return false;
+        }
+        buffer->size += rawLength;
+        block += storedLength;
+    }
+    return true;
+}
+
+/**
+ * Reads the reply to a frame with @param opcode into @param buffer, without
+ * its header, decompressing it by way of @param packed when it is compressed.
+ * Adds the bytes it took to @param wireBytes.
+ */
+static bool waitForFrame(int fd, struct recvBuffer *buffer, struct recvBuffer *packed, uint8_t opcode,
+                         uint64_t *wireBytes)
+{
+    unsigned char header[AESD_FRAME_HEADER_SIZE];
+    struct aesd_frame_header frame;
+
+    if (recvAll(fd, header, sizeof(header)) == false)
+    {
+        return false;
+    }
+    aesd_frame_decode(header, &frame);
+    if (frame.opcode != opcode || frame.length > AESD_FRAME_MAX_PAYLOAD)
+    {
+        errno = EPROTO;
+        return false;
+    }
+    *wireBytes += sizeof(header) + frame.length;
+
+    struct recvBuffer *target = frame.flags & AESD_FRAME_FLAG_COMPRESSED ? packed : buffer;
+    if (reserveBuffer(target, frame.length) == false)
+    {
+        return false;
+    }
+    target->size = frame.length;
+    if (recvAll(fd, target->data, frame.length) == false)
+    {
+        return false;
+    }
+    if (target == buffer)
+    {
+        return true;
+    }
+    buffer->size = 0;
+    return inflateReply(packed, buffer);
+}
+
+/**
+ * waitForLine() for compressed replies: decompresses them one after another
+ * into @param buffer until it ends with @param line, adding the bytes they
+ * took to @param wireBytes.
+ */
+static bool waitForCompressedLine(int fd, struct recvBuffer *buffer, struct recvBuffer *packed, const char *line,
+                                  size_t lineLen, uint64_t *wireBytes)
+{
+    buffer->size = 0;
+    do
+    {
+        unsigned char header[AESD_COMPRESS_HEADER_SIZE];
+        if (recvAll(fd, header, sizeof(header)) == false)
+        {
+            return false;
+        }
+        uint32_t rawLength = aesd_frame_get_u32(header);
+        uint32_t length = aesd_frame_get_u32(header + sizeof(uint32_t));
+        if (reserveBuffer(packed, length) == false || recvAll(fd, packed->data, length) == false)
+        {
+            return false;
+        }
+        packed->size = length;
+        *wireBytes += sizeof(header) + length;
+        size_t before = buffer->size;
+        if (inflateReply(packed, buffer) == false || buffer->size - before != rawLength)
+        {
+            errno = EPROTO;
+            return false;
+        }
+    }
+    while (buffer->size < lineLen || memcmp(buffer->data + buffer->size - lineLen, line, lineLen) != 0);
+    return true;
+}
+
+/**
+ * Checks that @param data is made of whole lines the bench writes, @param
+ * lineSize bytes starting with "bench:", or of the timestamps the file backend
+ * adds.
+ */
+static bool checkLines(const char *data, size_t size, int lineSize)
+{
+    while (size > 0)
+    {
+        const char *newline = memchr(data, '\n', size);
+        if (newline == NULL)
+        {
+            return false;
+        }
+        size_t length = newline - data + 1;
+        bool benchLine = length == (size_t)lineSize && memcmp(data, "bench:", 6) == 0;
+        bool timestamp = length > 10 && memcmp(data, "timestamp:", 10) == 0;
+        if (benchLine == false && timestamp == false)
+        {
+            return false;
+        }
+        data += length;
+        size -= length;
+    }
+    return true;
+}
+
+/**
+ * A write reply must hold our own line; a seek reply must start @param
+ * seekOffset bytes into the oldest entry and go on with whole lines.
+ */
+static bool checkLoadReply(const struct recvBuffer *buffer, const char *line, int lineSize, int seekOffset)
+{
+    if (seekOffset < 0)
+    {
+        return memmem(buffer->data, buffer->size, line, lineSize) != NULL &&
+               checkLines(buffer->data, buffer->size, lineSize);
+    }
+
+    const char *newline = memchr(buffer->data, '\n', buffer->size);
+    if (newline == NULL || newline - buffer->data + 1 != lineSize - seekOffset)
+    {
+        return false;
+    }
+    size_t skipped = newline - buffer->data + 1;
+    return checkLines(buffer->data + skipped, buffer->size - skipped, lineSize);
+}
+
+/**
+ * Waits for the newline-framed reply ending with @param line, compressed or
+ * not, adding the bytes it took to @param wireBytes.
+ */
+static bool waitForReply(int fd, struct recvBuffer *buffer, struct recvBuffer *packed, const char *line,
+                         const struct benchOptions *options, uint64_t *wireBytes)
+{
+    if (options->compress)
+    {
+        return waitForCompressedLine(fd, buffer, packed, line, options->lineSize, wireBytes);
+    }
+    if (waitForLine(fd, buffer, line, options->lineSize) == false)
+    {
+        return false;
+    }
+    *wireBytes += buffer->size;
+    return true;
+}
+
+static void* loadClientRun(void *arg)
+{
+    struct loadClient *client = arg;
+    const struct benchOptions *options = client->options;
+    char *line = malloc(options->lineSize + 1);
+    char *lastLine = malloc(options->lineSize + 1);
+    char seekCommand[64];
+    struct recvBuffer buffer = {0};
+    struct recvBuffer packed = {0};
+    uint64_t setupBytes = 0;
+    int fd = client->fd;
+    bool ready = line != NULL && lastLine != NULL;
+
+    if (ready && options->frames)
+    {
+        unsigned char enable = 1;
+        ready = sendAll(fd, AESD_FRAME_MAGIC, AESD_FRAME_MAGIC_SIZE) &&
+                (options->compress == false ||
+                 (sendFrame(fd, AESD_FRAME_COMPRESS, &enable, 1) &&
+                  waitForFrame(fd, &buffer, &packed, AESD_FRAME_COMPRESS, &setupBytes))) &&
+                (options->delta == false ||
+                 (sendFrame(fd, AESD_FRAME_DELTA, &enable, 1) &&
+                  waitForFrame(fd, &buffer, &packed, AESD_FRAME_DELTA, &setupBytes)));
+    }
+    else if (ready)
+    {
+        // Compression first, so every reply after it comes compressed
+        ready = (options->compress == false || sendAll(fd, compressCommand, sizeof(compressCommand) - 1)) &&
+                (options->delta == false || sendAll(fd, deltaCommand, sizeof(deltaCommand) - 1));
+    }
+    if (ready == false)
+    {
+        fprintf(stderr, "client %d setup failed: %s\n", client->id, strerror(errno));
+    }
+    pthread_barrier_wait(client->startBarrier);
+
+    uint64_t interval = options->loadRate > 0 ? 1000000000ull / options->loadRate : 0;
+    uint64_t start = nowNs();
+
+    for (int i = 0; ready && i < options->samples; i++)
+    {
+        bool seek = options->seekEvery > 0 && i > 0 && i % options->seekEvery == 0;
+        int seekOffset = seek ? i % (options->lineSize - 1) : -1;
+
+        // Open loop: the latency counts from when the packet was due, so a slow
+        // reply also charges the packets queued behind it
+        uint64_t due = start + i * interval;
+        if (interval > 0 && nowNs() < due)
+        {
+            struct timespec wake = { .tv_sec = due / 1000000000ull, .tv_nsec = due % 1000000000ull };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+        }
+        else if (interval == 0)
+        {
+            due = nowNs();
+        }
+
+        bool received;
+        if (seek)
+        {
+            if (options->frames)
+            {
+                unsigned char payload[2 * sizeof(uint32_t)];
+                aesd_frame_put_u32(payload, 0);
+                aesd_frame_put_u32(payload + sizeof(uint32_t), seekOffset);
+                received = sendFrame(fd, AESD_FRAME_SEEK, payload, sizeof(payload)) &&
+                           waitForFrame(fd, &buffer, &packed, AESD_FRAME_SEEK, &client->bytesWire);
+            }
+            else
+            {
+                // The reply runs to the end of the store, our last line when
+                // nobody else writes
+                int length = snprintf(seekCommand, sizeof(seekCommand), seekCommandFormat, seekOffset);
+                received = sendAll(fd, seekCommand, length) &&
+                           waitForReply(fd, &buffer, &packed, lastLine, options, &client->bytesWire);
+                client->bytesOut += length;
+            }
+        }
+        else
+        {
+            buildLine(line, options->lineSize, (unsigned long)client->id * 1000000ul + i);
+            received = options->frames ? sendFrame(fd, AESD_FRAME_WRITE, line, options->lineSize) &&
+                                         waitForFrame(fd, &buffer, &packed, AESD_FRAME_WRITE, &client->bytesWire)
+                                       : sendAll(fd, line, options->lineSize) &&
+                                         waitForReply(fd, &buffer, &packed, line, options, &client->bytesWire);
+            client->bytesOut += options->lineSize;
+        }
+        if (received == false)
+        {
+            fprintf(stderr, "client %d %s failed: %s\n", client->id, seek ? "seek" : "round trip", strerror(errno));
+            break;
+        }
+
+        uint64_t latency = nowNs() - due;
+        client->bytesIn += buffer.size;
+        if (checkLoadReply(&buffer, line, options->lineSize, seekOffset) == false)
+        {
+            if (client->badReplies++ == 0)
+            {
+                fprintf(stderr, "client %d got a bad %s reply of %zu bytes\n", client->id, seek ? "seek" : "write",
+                        buffer.size);
+            }
+        }
+        if (seek)
+        {
+            client->seekLatencies[client->seeks++] = latency;
+        }
+        else
+        {
+            client->writeLatencies[client->writes++] = latency;
+            memcpy(lastLine, line, options->lineSize);
+        }
+    }
+
+    close(fd);
+    free(packed.data);
+    free(buffer.data);
+    free(lastLine);
+    free(line);
+    return NULL;
+}
+
+struct flood
+{
+    const struct benchOptions *options;
+    bool stop;
+    uint64_t opened;                // connections established
+    uint64_t closed;                // of them closed by the server, refused or timed out
+    uint64_t failed;                // connect() attempts that failed
+};
+
+/**
+ * Holds floodConnections connections open from floodSource, each with the
+ * start of a packet it never finishes, like a crowd of slow or half-open
+ * clients. Whatever the server closes is opened again at once.
+ */
+static void* floodRun(void *arg)
+{
+    struct flood *flood = arg;
+    const struct benchOptions *options = flood->options;
+    int count = options->floodConnections;
+    struct pollfd *fds = calloc(count, sizeof(struct pollfd));
+
+    for (int i = 0; fds != NULL && i < count; i++)
+    {
+        fds[i].fd = -1;
+    }
+
+    while (fds != NULL && __atomic_load_n(&flood->stop, __ATOMIC_RELAXED) == false)
+    {
+        for (int i = 0; i < count && __atomic_load_n(&flood->stop, __ATOMIC_RELAXED) == false; i++)
+        {
+            if (fds[i].fd >= 0)
+            {
+                continue;
+            }
+            int fd = connectFrom(options, options->floodSource, 100);
+            if (fd < 0)
+            {
+                flood->failed++;
+                continue;
+            }
+            send(fd, "flood", 5, MSG_NOSIGNAL);
+            fds[i].fd = fd;
+            fds[i].events = POLLIN;
+            flood->opened++;
+        }
+
+        if (poll(fds, count, 10) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (fds[i].fd >= 0 && fds[i].revents != 0)
+            {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                flood->closed++;
+            }
+        }
+    }
+
+    for (int i = 0; fds != NULL && i < count; i++)
+    {
+        if (fds[i].fd >= 0)
+        {
+            close(fds[i].fd);
+        }
+    }
+    free(fds);
+    return NULL;
+}
+
+/**
+ * Fills the store with @param lines lines of our size from one connection, so
+ * the char device, which keeps only its last ten writes, holds nothing from an
+ * earlier run with another line size.
+ */
+static bool primeStore(const struct benchOptions *options, int lines)
+{
+    char *line = malloc(options->lineSize + 1);
+    struct recvBuffer buffer = {0};
+    int fd = connectToServer(options);
+    bool primed = line != NULL && fd >= 0;
+
+    for (int i = 0; primed && i < lines; i++)
+    {
+        buildLine(line, options->lineSize, 999000000ul + i);
+        primed = sendAll(fd, line, options->lineSize) && waitForLine(fd, &buffer, line, options->lineSize);
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(buffer.data);
+    free(line);
+    return primed;
+}
+
+/**
+ * Load generator: clients connections each send samples packets, back to back
+ * or at a fixed rate, with every seekEvery-th packet a seek command, and check
+ * every reply. Reports the throughput and the latency percentiles of writes
+ * and seeks apart, and fails on any bad reply, so two server versions can be
+ * compared on the same numbers. With floodConnections the run happens while a
+ * flood of idle connections presses on the server, and a client that waits
+ * more than FLOOD_REPLY_TIMEOUT_MS for a reply gives up.
+ */
+static int runLoad(const struct benchOptions *options)
+{
+    int clients = options->loadClients;
+    pthread_t *threads = calloc(clients, sizeof(pthread_t));
+    struct loadClient *state = calloc(clients, sizeof(struct loadClient));
+    uint64_t *writeLatencies = calloc((size_t)clients * options->samples, sizeof(uint64_t));
+    uint64_t *seekLatencies = calloc((size_t)clients * options->samples, sizeof(uint64_t));
+    int writes = 0;
+    int seeks = 0;
+    int badReplies = 0;
+    uint64_t bytesOut = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesWire = 0;
+    pthread_barrier_t startBarrier;
+    struct flood flood = { .options = options };
+    pthread_t floodThread;
+
+    if (threads == NULL || state == NULL || writeLatencies == NULL || seekLatencies == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if (primeStore(options, 10) == false)
+    {
+        fprintf(stderr, "priming the store failed: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (options->floodConnections > 0)
+    {
+        if (pthread_create(&floodThread, NULL, floodRun, &flood) != 0)
+        {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+        // Let the flood build up before the measured clients arrive
+        usleep(FLOOD_RAMP_US);
+    }
+
+    // Connect everybody first so the timing does not include the accept backlog
+    for (int i = 0; i < clients; i++)
+    {
+        state[i].fd = connectToServer(options);
+        if (state[i].fd < 0)
+        {
+            fprintf(stderr, "connect failed after %d clients: %s\n", i, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (options->floodConnections > 0)
+        {
+            struct timeval timeout = { .tv_sec = FLOOD_REPLY_TIMEOUT_MS / 1000,
+                                       .tv_usec = (FLOOD_REPLY_TIMEOUT_MS % 1000) * 1000 };
+            setsockopt(state[i].fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        }
+    }
+
+    pthread_barrier_init(&startBarrier, NULL, clients + 1);
+    for (int i = 0; i < clients; i++)
+    {
+        state[i].options = options;
+        state[i].startBarrier = &startBarrier;
+        state[i].id = i;
+        state[i].writeLatencies = calloc(options->samples, sizeof(uint64_t));
+        state[i].seekLatencies = calloc(options->samples, sizeof(uint64_t));
+        if (state[i].writeLatencies == NULL || state[i].seekLatencies == NULL ||
+            pthread_create(&threads[i], NULL, loadClientRun, &state[i]) != 0)
+        {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+    uint64_t segmentsBefore = tcpOutSegments();
+    double serverCpuBefore = options->serverPid > 0 ? readServerCpu(options->serverPid) : -1;
+    pthread_barrier_wait(&startBarrier);
+    uint64_t start = nowNs();
+
+    for (int i = 0; i < clients; i++)
+    {
+        pthread_join(threads[i], NULL);
+        memcpy(writeLatencies + writes, state[i].writeLatencies, state[i].writes * sizeof(uint64_t));
+        memcpy(seekLatencies + seeks, state[i].seekLatencies, state[i].seeks * sizeof(uint64_t));
+        writes += state[i].writes;
+        seeks += state[i].seeks;
+        badReplies += state[i].badReplies;
+        bytesOut += state[i].bytesOut;
+        bytesIn += state[i].bytesIn;
+        bytesWire += state[i].bytesWire;
+        free(state[i].writeLatencies);
+        free(state[i].seekLatencies);
+    }
+    double elapsed = (nowNs() - start) / 1e9;
+    uint64_t segments = tcpOutSegments() - segmentsBefore;
+    double serverCpu = serverCpuBefore >= 0 ? readServerCpu(options->serverPid) - serverCpuBefore : -1;
+    pthread_barrier_destroy(&startBarrier);
+    if (options->floodConnections > 0)
+    {
+        __atomic_store_n(&flood.stop, true, __ATOMIC_RELAXED);
+        pthread_join(floodThread, NULL);
+    }
+
+    printf("%d clients, %d packets each of %d bytes, %s, %s protocol%s%s\n", clients, options->samples,
+           options->lineSize, options->loadRate > 0 ? "rate limited" : "back to back",
+           options->frames ? "framed" : "line", options->delta ? ", delta replies" : "",
+           options->compress ? ", compressed replies" : "");
+    if (options->loadRate > 0)
+    {
+        printf("target rate: %d packets/s per client, %d packets/s in total\n", options->loadRate,
+               options->loadRate * clients);
+    }
+    printf("throughput: %.0f replies/s, %.1f MB/s sent, %.1f MB/s received\n", (writes + seeks) / elapsed,
+           bytesOut / elapsed / 1e6, bytesWire / elapsed / 1e6);
+    if (writes > 0)
+    {
+        printLatencies("write:", writeLatencies, writes);
+    }
+    if (seeks > 0)
+    {
+        printLatencies("seek:", seekLatencies, seeks);
+    }
+    printf("replies checked: %d, bad: %d\n", writes + seeks, badReplies);
+    if (writes + seeks > 0)
+    {
+        printf("reply bytes: %.0f per reply on the wire, %.0f of history\n", (double)bytesWire / (writes + seeks),
+               (double)bytesIn / (writes + seeks));
+    }
+    if (serverCpu >= 0 && writes + seeks > 0)
+    {
+        printf("server CPU: %.3f s, %.1f us per reply\n", serverCpu, serverCpu * 1e6 / (writes + seeks));
+    }
+    if (options->unixPath == NULL && segmentsBefore > 0 && writes + seeks > 0)
+    {
+        printf("wire: %llu TCP segments, %.2f per reply\n", (unsigned long long)segments,
+               (double)segments / (writes + seeks));
+    }
+    if (options->floodConnections > 0)
+    {
+        printf("flood: %d connections from %s, %llu opened, %llu closed by the server, %llu connects failed\n",
+               options->floodConnections, options->floodSource, (unsigned long long)flood.opened,
+               (unsigned long long)flood.closed, (unsigned long long)flood.failed);
+    }
+
+    int expected = clients * options->samples;
+    free(seekLatencies);
+    free(writeLatencies);
+    free(state);
+    free(threads);
+    return writes + seeks == expected && badReplies == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int parseList(int *values, char *list)
+{
+    int count = 0;
+    for (char *token = strtok(list, ","); token != NULL && count < MAX_STEPS; token = strtok(NULL, ","))
+    {
+        values[count++] = atoi(token);
+    }
+    return count;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-H host] [-p port | -U unix_socket] [-c conn1,conn2,...] [-n samples] [-s line_size] [-P server_pid]\n"
+                    "       %s [-H host] [-p port | -U unix_socket] -C churn_connections [-s line_size]\n"
+                    "       %s [-H host] [-p port | -U unix_socket] -T [-D] [-n samples] [-s line_size]\n"
+                    "       %s [-H host] [-p port | -U unix_socket] -I mb1,mb2,...\n"
+                    "       %s [-H host] [-p port | -U unix_socket] -L lines_per_batch [-n samples] [-s line_size]\n"
+                    "       %s [-H host] [-p port | -U unix_socket] -M clients [-S slow_clients] [-X stalled_clients] [-D] [-n samples] [-s line_size]\n"
+                    "       %s [-H host] [-p port | -U unix_socket] -R connections [-t threads] [-s line_size]\n"
+                    "       %s [-H host] [-p port | -U unix_socket] -N clients [-r packets_per_second] [-K seek_every] [-F] [-D] [-z] [-P server_pid] [-n samples] [-s line_size] [-Z flood_connections] [-B flood_source]\n",
+                    name, name, name, name, name, name, name, name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    struct benchOptions options = {
+        .host = "127.0.0.1",
+        .port = 9000,
+        .samples = 200,
+        .lineSize = 32,
+        .serverPid = -1,
+        .connectThreads = 1,
+        .floodSource = "127.0.0.2",
+    };
+    char defaultSteps[] = "1,100,1000,2000";
+    int opt;
+
+    options.stepCount = parseList(options.steps, defaultSteps);
+
+    while ((opt = getopt(argc, argv, "H:p:U:c:n:s:P:C:TDI:L:M:S:X:R:t:N:r:K:FzZ:B:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'H': options.host = optarg; break;
+        case 'p': options.port = atoi(optarg); break;
+        case 'U': options.unixPath = optarg; break;
+        case 'c': options.stepCount = parseList(options.steps, optarg); break;
+        case 'n': options.samples = atoi(optarg); break;
+        case 's': options.lineSize = atoi(optarg); break;
+        case 'P': options.serverPid = atol(optarg); break;
+        case 'C': options.churn = atoi(optarg); break;
+        case 'T': options.throughput = true; break;
+        case 'D': options.delta = true; break;
+        case 'I': options.ingestCount = parseList(options.ingestSizes, optarg); break;
+        case 'L': options.pipelineLines = atoi(optarg); break;
+        case 'M': options.concurrentClients = atoi(optarg); break;
+        case 'S': options.slowClients = atoi(optarg); break;
+        case 'X': options.stalledClients = atoi(optarg); break;
+        case 'R': options.connectRate = atoi(optarg); break;
+        case 't': options.connectThreads = atoi(optarg); break;
+        case 'N': options.loadClients = atoi(optarg); break;
+        case 'r': options.loadRate = atoi(optarg); break;
+        case 'K': options.seekEvery = atoi(optarg); break;
+        case 'F': options.frames = true; break;
+        case 'z': options.compress = true; break;
+        case 'Z': options.floodConnections = atoi(optarg); break;
+        case 'B': options.floodSource = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (options.samples < 1 || options.lineSize < 16 || options.connectThreads < 1 || options.loadRate < 0 ||
+        options.seekEvery < 0 || options.floodConnections < 0)
+    {
+        usage(argv[0]);
+    }
+
+    if (options.churn > 0)
+    {
+        return runChurn(&options);
+    }
+    if (options.throughput)
+    {
+        return runThroughput(&options);
+    }
+    if (options.ingestCount > 0)
+    {
+        return runIngest(&options);
+    }
+    if (options.pipelineLines > 0)
+    {
+        return runPipeline(&options);
+    }
+    if (options.concurrentClients > 0)
+    {
+        return runConcurrent(&options);
+    }
+    if (options.connectRate > 0)
+    {
+        return runConnectRate(&options);
+    }
+    if (options.loadClients > 0)
+    {
+        return runLoad(&options);
+    }
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int maxConnections = 0;
+    for (int i = 0; i < options.stepCount; i++)
+    {
+        if (options.steps[i] > maxConnections)
+        {
+            maxConnections = options.steps[i];
+        }
+    }
+
+    int *idleFds = calloc(maxConnections + 1, sizeof(int));
+    uint64_t *latencies = calloc(options.samples, sizeof(uint64_t));
+    char *line = malloc(options.lineSize + 1);
+    struct recvBuffer buffer = {0};
+    if (idleFds == NULL || latencies == NULL || line == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    int activeFd = connectToServer(&options);
+    if (activeFd < 0)
+    {
+        perror("connect");
+        return EXIT_FAILURE;
+    }
+
+    int openConnections = 1;
+    unsigned long sequence = 0;
+
+    printf("%12s %12s %10s %12s %12s %12s\n", "connections", "rss_kb", "threads", "p50_us", "p99_us", "max_us");
+
+    for (int step = 0; step < options.stepCount; step++)
+    {
+        while (openConnections < options.steps[step])
+        {
+            int fd = connectToServer(&options);
+            if (fd < 0)
+            {
+                fprintf(stderr, "connect failed after %d connections: %s\n", openConnections, strerror(errno));
+                goto done;
+            }
+            idleFds[openConnections++] = fd;
+        }
+        // Give the server a moment to pick up the new connections
+        usleep(200000);
+
+        for (int i = 0; i < options.samples; i++)
+        {
+            buildLine(line, options.lineSize, sequence++);
+
+            uint64_t start = nowNs();
+            if (send(activeFd, line, options.lineSize, 0) != options.lineSize ||
+                waitForLine(activeFd, &buffer, line, options.lineSize) == false)
+            {
+                fprintf(stderr, "round trip failed: %s\n", strerror(errno));
+                goto done;
+            }
+            latencies[i] = nowNs() - start;
+        }
+        qsort(latencies, options.samples, sizeof(uint64_t), compareU64);
+
+        long rss = options.serverPid > 0 ? readServerStatus(options.serverPid, "VmRSS") : -1;
+        long threads = options.serverPid > 0 ? readServerStatus(options.serverPid, "Threads") : -1;
+
+        printf("%12d %12ld %10ld %12.1f %12.1f %12.1f\n", openConnections, rss, threads,
+               percentile(latencies, options.samples, 0.50) / 1000.0,
+               percentile(latencies, options.samples, 0.99) / 1000.0,
+               latencies[options.samples - 1] / 1000.0);
+        fflush(stdout);
+    }
+
+done:
+    for (int i = 1; i < openConnections; i++)
+    {
+        close(idleFds[i]);
+    }
+    close(activeFd);
+    free(buffer.data);
+    free(line);
+    free(latencies);
+    free(idleFds);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * LD_PRELOAD shim counting heap calls of the process it is loaded into, printed
+ * to stderr at exit: LD_PRELOAD=./alloc_count.so ../aesdsocket
+ */
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void *pointer, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void  __libc_free(void *pointer);
+
+static unsigned long allocations;
+static unsigned long releases;
+
+void* malloc(size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void *pointer, size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(pointer, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_memalign(alignment, size);
+}
+
+void free(void *pointer)
+{
+    if (pointer != NULL)
+    {
+        __atomic_add_fetch(&releases, 1, __ATOMIC_RELAXED);
+    }
+    __libc_free(pointer);
+}
+
+__attribute__((destructor)) static void report(void)
+{
+    char line[128];
+    int length = snprintf(line, sizeof(line), "alloc_count: %lu allocations, %lu frees\n", allocations, releases);
+    ssize_t written = write(STDERR_FILENO, line, length);
+    (void)written;
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+# Connect-rate benchmark: THREADS client threads open CONNECTIONS connections
+# back to back (connect, one packet, reply, close) against 1, 2, 4, ... up to
+# MAX_SHARDS SO_REUSEPORT listener shards and report accepted connections/s.
+# Usage: ./bench_accept.sh [thread|epoll] [max shards] [connections] [threads] [backlog]
+
+MODE=${1:-epoll}
+MAX_SHARDS=${2:-$(nproc)}
+CONNECTIONS=${3:-20000}
+THREADS=${4:-16}
+BACKLOG=${5:-4096}
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make clean
+    CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+RESULT=0
+SHARDS=1
+while [ "$SHARDS" -le "$MAX_SHARDS" ]; do
+    ../aesdsocket -m "$MODE" -s "$SHARDS" -b "$BACKLOG" -v warning > /dev/null &
+    SERVER_PID=$!
+    sleep 1
+
+    echo "$SHARDS shard(s), $MODE mode, backlog $BACKLOG:"
+    ./aesdsocket_bench/aesdsocket_bench -R "$CONNECTIONS" -t "$THREADS" || RESULT=1
+
+    kill -TERM "$SERVER_PID"
+    wait "$SERVER_PID"
+    SHARDS=$((SHARDS * 2))
+done
+exit $RESULT
@@ -0,0 +1,48 @@
+#!/bin/bash
+# Backpressure benchmark for the /var/tmp/aesdsocketdata backend: CLIENTS
+# delta clients run round trips while STALLED clients pipeline packets and never
+# read a reply, once without the stalled clients and once per output high-water
+# mark. The fast clients' tail latency should not move.
+# Usage: ./bench_backpressure.sh [mode] [clients] [stalled] [samples] [high-water marks]
+
+MODE=${1:-epoll}
+CLIENTS=${2:-16}
+STALLED=${3:-4}
+SAMPLES=${4:-500}
+HIGH_WATER_MARKS=${5:-"0 65536 262144"}
+DATA_FILE=/var/tmp/aesdsocketdata
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make clean
+    CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+RESULT=0
+for HIGH_WATER in $HIGH_WATER_MARKS; do
+    for STALLED_CLIENTS in 0 "$STALLED"; do
+        rm -f "$DATA_FILE"
+
+        ../aesdsocket -m "$MODE" -o "$HIGH_WATER" > /dev/null &
+        SERVER_PID=$!
+        sleep 1
+
+        echo "High-water mark $HIGH_WATER bytes, $STALLED_CLIENTS stalled clients, $MODE mode:"
+        ./aesdsocket_bench/aesdsocket_bench -M "$CLIENTS" -X "$STALLED_CLIENTS" -D -n "$SAMPLES" || RESULT=1
+        echo "Server RSS: $(awk '/VmRSS/ { print $2 " " $3 }' /proc/$SERVER_PID/status)"
+
+        kill -TERM "$SERVER_PID"
+        wait "$SERVER_PID"
+    done
+done
+exit $RESULT
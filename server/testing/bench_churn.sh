@@ -0,0 +1,37 @@
+#!/bin/bash
+# Connection churn benchmark: every sample connects, sends one packet, waits for
+# the reply and disconnects. Reports connections/s and connect-to-reply latency;
+# the server logs worker queue wait statistics on shutdown.
+# Usage: ./bench_churn.sh [thread|epoll] [connections] [workers] [queue depth]
+
+MODE=${1:-thread}
+CONNECTIONS=${2:-2000}
+WORKERS=${3:-8}
+QUEUE=${4:-64}
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+../aesdsocket -m "$MODE" -w "$WORKERS" -q "$QUEUE" | grep "Worker pool" &
+sleep 1
+SERVER_PID=$(pgrep -n -x aesdsocket)
+
+echo "Running churn benchmark in $MODE mode..."
+./aesdsocket_bench/aesdsocket_bench -C "$CONNECTIONS"
+RESULT=$?
+
+kill -TERM "$SERVER_PID"
+wait
+exit $RESULT
@@ -0,0 +1,65 @@
+#!/bin/bash
+# Compressed reply benchmark for the /var/tmp/aesdsocketdata backend: bytes on
+# the wire per reply, server CPU per reply and latency of full-history and
+# delta replies, with and without compression, in every mode. Full replies
+# grow with the history, so the store is primed with LINES lines first and
+# every reply carries all of them.
+# Set SERVER to a prebuilt aesdsocket to skip the build.
+# Usage: ./bench_compress.sh [clients] [samples] [packets per second per client] [lines]
+
+CLIENTS=${1:-4}
+SAMPLES=${2:-500}
+RATE=${3:-200}
+LINES=${4:-20000}
+DATA_FILE=/var/tmp/aesdsocketdata
+LOAD_ARGS="-N $CLIENTS -n $SAMPLES -r $RATE -s 64"
+
+if [ -z "$SERVER" ]; then
+    (
+        cd .. || exit 1
+        echo "Building..."
+        make clean
+        CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+        if [ $? -ne 0 ]; then
+            echo "Build failed."
+            exit 1
+        fi
+    ) || exit 1
+    SERVER=../aesdsocket
+fi
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+# Runs the load generator with "$@" against a fresh server started with
+# $SERVER_ARGS on a data file of $LINES bench lines
+measure()
+{
+    rm -f "$DATA_FILE"
+    for i in $(seq 1 "$LINES"); do
+        printf 'bench:%057d\n' "$((i * 7919))"
+    done > "$DATA_FILE"
+    "$SERVER" $SERVER_ARGS > /dev/null &
+    local pid=$!
+    sleep 1
+    ./aesdsocket_bench/aesdsocket_bench $LOAD_ARGS -P "$pid" "$@" 2>&1 |
+        grep -E "throughput:|write:|reply bytes:|server CPU:|bad: [1-9]|failed" | head -6
+    kill -TERM "$pid"
+    wait "$pid"
+}
+
+# Framed runs leave the replies to the setup frames out of the byte counts
+for MODE in thread epoll uring; do
+    SERVER_ARGS="-m $MODE"
+    for DELTA in "" "-D"; do
+        echo "$MODE mode, $([ -n "$DELTA" ] && echo delta || echo full) replies:"
+        echo "  uncompressed:"
+        measure -F $DELTA | sed 's/^/    /'
+        echo "  compressed:"
+        measure -F $DELTA -z | sed 's/^/    /'
+        echo "  compressed, line protocol:"
+        measure $DELTA -z | sed 's/^/    /'
+    done
+done
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Concurrency benchmark for the /var/tmp/aesdsocketdata backend: CLIENTS
+# clients exchange packets at the same time while SLOW of them read their
+# replies slowly, once per reply path, on a pre-filled history of HISTORY_MB.
+# Usage: ./bench_concurrent.sh [mode] [clients] [slow] [history MB] [samples]
+
+MODE=${1:-epoll}
+CLIENTS=${2:-64}
+SLOW=${3:-8}
+HISTORY_MB=${4:-1}
+SAMPLES=${5:-20}
+DATA_FILE=/var/tmp/aesdsocketdata
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make clean
+    CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+RESULT=0
+for REPLY_PATH in copy sendfile history; do
+    yes "history line padded to a fixed width for the concurrency benchmark" | head -c $((HISTORY_MB * 1024 * 1024)) > "$DATA_FILE"
+
+    ../aesdsocket -m "$MODE" -r "$REPLY_PATH" > /dev/null &
+    SERVER_PID=$!
+    sleep 1
+
+    echo "Reply path $REPLY_PATH, $MODE mode:"
+    ./aesdsocket_bench/aesdsocket_bench -M "$CLIENTS" -S "$SLOW" -n "$SAMPLES" || RESULT=1
+
+    kill -TERM "$SERVER_PID"
+    wait "$SERVER_PID"
+done
+exit $RESULT
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Connection-count benchmark: opens growing numbers of idle connections and
+# reports server RSS, thread count and round trip latency of one active client.
+# Usage: ./bench_connections.sh [thread|epoll] [connection steps] [event loops]
+
+MODE=${1:-epoll}
+STEPS=${2:-1,100,1000,2000,4000}
+LOOPS=${3:-2}
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+ulimit -n 65536 2>/dev/null || ulimit -n "$(ulimit -Hn)"
+
+../aesdsocket -m "$MODE" -l "$LOOPS" > /dev/null &
+SERVER_PID=$!
+sleep 1
+
+echo "Running connection benchmark in $MODE mode..."
+./aesdsocket_bench/aesdsocket_bench -c "$STEPS" -P "$SERVER_PID"
+RESULT=$?
+
+kill -TERM "$SERVER_PID"
+wait "$SERVER_PID"
+exit $RESULT
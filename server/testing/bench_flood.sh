@@ -0,0 +1,58 @@
+#!/bin/bash
+# Admission control benchmark for the /var/tmp/aesdsocketdata backend: latency
+# of rate-limited well-behaved clients from 127.0.0.1 with no flood, during a
+# flood of idle connections from 127.0.0.2, and during the same flood with
+# per-source and total connection limits and an idle timeout, in every mode.
+# Set SERVER to a prebuilt aesdsocket to skip the build.
+# Usage: ./bench_flood.sh [flood connections] [per-source limit] [idle timeout ms] [samples]
+
+FLOOD=${1:-500}
+PER_SOURCE=${2:-16}
+IDLE_MS=${3:-1000}
+SAMPLES=${4:-300}
+DATA_FILE=/var/tmp/aesdsocketdata
+LOAD_ARGS="-N 4 -n $SAMPLES -r 200"
+LIMITS="-p $PER_SOURCE -i $IDLE_MS -c $((FLOOD / 2))"
+
+if [ -z "$SERVER" ]; then
+    (
+        cd .. || exit 1
+        echo "Building..."
+        make clean
+        CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+        if [ $? -ne 0 ]; then
+            echo "Build failed."
+            exit 1
+        fi
+    ) || exit 1
+    SERVER=../aesdsocket
+fi
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+# Runs the load generator with "$@" against a fresh server started with $SERVER_ARGS
+measure()
+{
+    rm -f "$DATA_FILE"
+    "$SERVER" $SERVER_ARGS > /dev/null &
+    local pid=$!
+    sleep 1
+    ./aesdsocket_bench/aesdsocket_bench $LOAD_ARGS "$@" 2>&1 | grep -E "write:|replies checked|flood:|failed" | head -4
+    kill -TERM "$pid"
+    wait "$pid"
+}
+
+for MODE in thread epoll uring; do
+    echo "$MODE mode:"
+    echo "  no flood:"
+    SERVER_ARGS="-m $MODE"
+    measure | sed 's/^/    /'
+    echo "  $FLOOD idle connections, no limits:"
+    measure -Z "$FLOOD" | sed 's/^/    /'
+    echo "  $FLOOD idle connections, $LIMITS:"
+    SERVER_ARGS="-m $MODE $LIMITS"
+    measure -Z "$FLOOD" | sed 's/^/    /'
+done
@@ -0,0 +1,47 @@
+#!/bin/bash
+# Group commit benchmark for the /var/tmp/aesdsocketdata backend written through
+# (copy reply path): CLIENTS clients send small packets with delta replies while
+# the server runs with each flush window (us) and maximum batch size given.
+# Usage: ./bench_group_commit.sh [clients] [samples] [windows] [batches]
+
+CLIENTS=${1:-64}
+SAMPLES=${2:-200}
+WINDOWS=${3:-0,200,1000}
+BATCHES=${4:-1,64}
+DATA_FILE=/var/tmp/aesdsocketdata
+SERVER_LOG=$(mktemp)
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make clean
+    CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+RESULT=0
+for BATCH in ${BATCHES//,/ }; do
+    for WINDOW in ${WINDOWS//,/ }; do
+        rm -f "$DATA_FILE"
+        ../aesdsocket -r copy -g "$WINDOW" -G "$BATCH" > "$SERVER_LOG" &
+        SERVER_PID=$!
+        sleep 1
+
+        echo "Flush window $WINDOW us, batch $BATCH:"
+        ./aesdsocket_bench/aesdsocket_bench -M "$CLIENTS" -D -n "$SAMPLES" -s 32 || RESULT=1
+
+        kill -TERM "$SERVER_PID"
+        wait "$SERVER_PID"
+        grep "Group commit" "$SERVER_LOG"
+    done
+done
+rm -f "$SERVER_LOG"
+exit $RESULT
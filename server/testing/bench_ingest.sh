@@ -0,0 +1,34 @@
+#!/bin/bash
+# Ingest benchmark: sends single-line packets of growing size (in MB) to the
+# /var/tmp/aesdsocketdata backend and reports how fast the server takes them in.
+# Usage: ./bench_ingest.sh [sizes in MB]
+
+SIZES=${1:-1,4,16,64}
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make clean
+    CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+../aesdsocket > /dev/null &
+SERVER_PID=$!
+sleep 1
+
+echo "Running ingest benchmark..."
+./aesdsocket_bench/aesdsocket_bench -I "$SIZES"
+RESULT=$?
+
+kill -TERM "$SERVER_PID"
+wait "$SERVER_PID"
+exit $RESULT
@@ -0,0 +1,68 @@
+#!/bin/bash
+# Load generator run against either backend, for comparing server versions:
+# CLIENTS connections each send SAMPLES packets at RATE packets/s (0 for back
+# to back) and every reply is checked. The file backend runs with delta
+# replies. The char device backend needs the driver loaded (aesdchar_load);
+# it runs the framed protocol, whose replies carry their length because the
+# device replies with everything it holds, and seeks every tenth packet.
+# Set SERVER to a prebuilt aesdsocket to skip the build, e.g. an older version.
+# Usage: ./bench_load.sh [file|device] [mode] [clients] [samples] [rate] [line size]
+
+BACKEND=${1:-file}
+MODE=${2:-epoll}
+CLIENTS=${3:-16}
+SAMPLES=${4:-1000}
+RATE=${5:-0}
+LINE_SIZE=${6:-64}
+DATA_FILE=/var/tmp/aesdsocketdata
+
+case "$BACKEND" in
+    file)
+        BUILD_FLAGS=-DUSE_AESD_CHAR_DEVICE=0
+        LOAD_FLAGS="-D"
+        ;;
+    device)
+        BUILD_FLAGS=-DUSE_AESD_CHAR_DEVICE=1
+        LOAD_FLAGS="-F -K 10"
+        if [ ! -c /dev/aesdchar ]; then
+            echo "/dev/aesdchar not found, load the driver first."
+            exit 1
+        fi
+        ;;
+    *)
+        echo "Unknown backend $BACKEND, use file or device."
+        exit 1
+        ;;
+esac
+
+if [ -z "$SERVER" ]; then
+    (
+        cd .. || exit 1
+        echo "Building..."
+        make clean
+        CFLAGS=$BUILD_FLAGS make
+        if [ $? -ne 0 ]; then
+            echo "Build failed."
+            exit 1
+        fi
+    ) || exit 1
+    SERVER=../aesdsocket
+fi
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+rm -f "$DATA_FILE"
+"$SERVER" -m "$MODE" > /dev/null &
+SERVER_PID=$!
+sleep 1
+
+echo "$BACKEND backend, $MODE mode, $SERVER:"
+./aesdsocket_bench/aesdsocket_bench -N "$CLIENTS" -n "$SAMPLES" -r "$RATE" -s "$LINE_SIZE" $LOAD_FLAGS
+RESULT=$?
+
+kill -TERM "$SERVER_PID"
+wait "$SERVER_PID"
+exit $RESULT
@@ -0,0 +1,76 @@
+#!/bin/bash
+# Memory benchmark for the /var/tmp/aesdsocketdata backend: resident memory of
+# the server per 1000 idle connections, and heap calls per packet counted by
+# the alloc_count.so shim, for round trips and for pipelined packets, in every
+# mode. Thread mode gets a worker per idle connection, so it shows what their
+# stacks cost. Set SERVER to a prebuilt aesdsocket to skip the build.
+# Usage: ./bench_memory.sh [reply path] [samples] [idle connections]
+
+REPLY_PATH=${1:-history}
+SAMPLES=${2:-2000}
+CONNECTIONS=${3:-2000}
+DATA_FILE=/var/tmp/aesdsocketdata
+SHIM=$(pwd)/aesdsocket_bench/alloc_count.so
+COUNT_LOG=$(mktemp)
+
+if [ -z "$SERVER" ]; then
+    (
+        cd .. || exit 1
+        echo "Building..."
+        make clean
+        CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+        if [ $? -ne 0 ]; then
+            echo "Build failed."
+            exit 1
+        fi
+    ) || exit 1
+    SERVER=../aesdsocket
+fi
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+# Runs the server under the shim while "$@" drives it, prints its allocations
+allocations()
+{
+    rm -f "$DATA_FILE"
+    LD_PRELOAD="$SHIM" "$SERVER" $SERVER_ARGS > /dev/null 2> "$COUNT_LOG" &
+    local pid=$!
+    sleep 1
+    "$@" > /dev/null || RESULT=1
+    kill -TERM "$pid"
+    wait "$pid"
+    awk '/alloc_count:/ { print $2 }' "$COUNT_LOG"
+}
+
+RESULT=0
+for MODE in thread epoll uring; do
+    SERVER_ARGS="-m $MODE -r $REPLY_PATH"
+    if [ "$MODE" = thread ]; then
+        SERVER_ARGS="$SERVER_ARGS -w $((CONNECTIONS + 16))"
+    fi
+
+    rm -f "$DATA_FILE"
+    "$SERVER" $SERVER_ARGS > /dev/null &
+    SERVER_PID=$!
+    sleep 1
+
+    echo "$MODE mode, $REPLY_PATH replies:"
+    ./aesdsocket_bench/aesdsocket_bench -c "1,$CONNECTIONS" -n 100 -P "$SERVER_PID" |
+        awk -v n="$CONNECTIONS" 'NR == 2 { base = $2 } NR == 3 { printf "RSS per 1000 idle connections: %.0f KB\n", ($2 - base) * 1000 / (n - 1) }'
+    awk '/VmSize/ { print "Virtual size: " $2 " " $3 }' /proc/$SERVER_PID/status
+
+    kill -TERM "$SERVER_PID"
+    wait "$SERVER_PID"
+
+    IDLE=$(allocations true)
+    ROUND_TRIPS=$(allocations ./aesdsocket_bench/aesdsocket_bench -N 8 -n "$SAMPLES" -D)
+    PIPELINED=$(allocations ./aesdsocket_bench/aesdsocket_bench -L 100 -n $((SAMPLES / 10)) -D)
+    awk -v idle="$IDLE" -v trips="$ROUND_TRIPS" -v piped="$PIPELINED" -v n="$SAMPLES" 'BEGIN {
+        printf "heap calls per packet: %.3f round trips, %.3f pipelined\n", (trips - idle) / (8 * n), (piped - idle) / (10 * n)
+    }'
+done
+rm -f "$COUNT_LOG"
+exit $RESULT
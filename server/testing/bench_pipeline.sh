@@ -0,0 +1,36 @@
+#!/bin/bash
+# Pipelining benchmark: sends batches of lines in a single segment to the
+# /var/tmp/aesdsocketdata backend and checks that every line gets its own reply.
+# Usage: ./bench_pipeline.sh [mode] [lines per batch] [batches]
+
+MODE=${1:-epoll}
+LINES=${2:-200}
+BATCHES=${3:-5}
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make clean
+    CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+../aesdsocket -m "$MODE" > /dev/null &
+SERVER_PID=$!
+sleep 1
+
+echo "Running pipelining benchmark in $MODE mode..."
+./aesdsocket_bench/aesdsocket_bench -L "$LINES" -n "$BATCHES"
+RESULT=$?
+
+kill -TERM "$SERVER_PID"
+wait "$SERVER_PID"
+exit $RESULT
@@ -0,0 +1,50 @@
+#!/bin/bash
+# Reply path benchmark for the /var/tmp/aesdsocketdata backend: pre-fills the
+# history with HISTORY_MB megabytes and compares the copy reply path, sendfile()
+# streaming and the versioned in-memory log, then delta replies.
+# Usage: ./bench_reply.sh [history MB] [samples]
+
+HISTORY_MB=${1:-16}
+SAMPLES=${2:-50}
+DATA_FILE=/var/tmp/aesdsocketdata
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make clean
+    CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+for REPLY_PATH in copy sendfile history; do
+    yes "history line padded to a fixed width for the reply path benchmark" | head -c $((HISTORY_MB * 1024 * 1024)) > "$DATA_FILE"
+
+    ../aesdsocket -r "$REPLY_PATH" > /dev/null &
+    SERVER_PID=$!
+    sleep 1
+
+    echo "Reply path $REPLY_PATH, ${HISTORY_MB} MB history:"
+    ./aesdsocket_bench/aesdsocket_bench -T -n "$SAMPLES"
+
+    kill -TERM "$SERVER_PID"
+    wait "$SERVER_PID"
+done
+
+yes "history line padded to a fixed width for the reply path benchmark" | head -c $((HISTORY_MB * 1024 * 1024)) > "$DATA_FILE"
+../aesdsocket > /dev/null &
+SERVER_PID=$!
+sleep 1
+
+echo "Delta replies, ${HISTORY_MB} MB history:"
+./aesdsocket_bench/aesdsocket_bench -T -D -n "$SAMPLES"
+
+kill -TERM "$SERVER_PID"
+wait "$SERVER_PID"
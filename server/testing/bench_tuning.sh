@@ -0,0 +1,58 @@
+#!/bin/bash
+# Socket tuning benchmark for the /var/tmp/aesdsocketdata backend: latency and
+# TCP segments per reply of rate-limited clients against servers started with
+# each -T profile, in every mode and on both the copy and the default reply
+# path. Full replies grow with the file, so delta replies are measured too.
+# Set SERVER to a prebuilt aesdsocket to skip the build.
+# Usage: ./bench_tuning.sh [clients] [samples] [packets per second per client]
+
+CLIENTS=${1:-4}
+SAMPLES=${2:-500}
+RATE=${3:-500}
+DATA_FILE=/var/tmp/aesdsocketdata
+LOAD_ARGS="-N $CLIENTS -n $SAMPLES -r $RATE"
+PROFILES="none nodelay cork nodelay,cork sndbuf=65536,rcvbuf=65536 defer_accept=1 busy_poll=50 latency"
+
+if [ -z "$SERVER" ]; then
+    (
+        cd .. || exit 1
+        echo "Building..."
+        make clean
+        CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+        if [ $? -ne 0 ]; then
+            echo "Build failed."
+            exit 1
+        fi
+    ) || exit 1
+    SERVER=../aesdsocket
+fi
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+# Runs the load generator with "$@" against a fresh server started with $SERVER_ARGS
+measure()
+{
+    rm -f "$DATA_FILE"
+    "$SERVER" $SERVER_ARGS > /dev/null &
+    local pid=$!
+    sleep 1
+    ./aesdsocket_bench/aesdsocket_bench $LOAD_ARGS "$@" 2>&1 | grep -E "write:|wire:|bad: [1-9]|failed" | head -4
+    kill -TERM "$pid"
+    wait "$pid"
+}
+
+for MODE in thread epoll uring; do
+    for REPLY in copy history; do
+        for PROFILE in $PROFILES; do
+            SERVER_ARGS="-m $MODE -r $REPLY -T $PROFILE"
+            echo "$MODE mode, $REPLY replies, -T $PROFILE:"
+            echo "  full replies:"
+            measure | sed 's/^/    /'
+            echo "  delta replies:"
+            measure -D | sed 's/^/    /'
+        done
+    done
+done
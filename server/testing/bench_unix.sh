@@ -0,0 +1,45 @@
+#!/bin/bash
+# Local client latency for the /var/tmp/aesdsocketdata backend: the same delta
+# round trips over loopback TCP (IPv4 and IPv6, both taken by the dual-stack
+# listener) and over the unix socket listener, first from one client and then
+# from CLIENTS clients at once.
+# Usage: ./bench_unix.sh [mode] [samples] [clients]
+
+MODE=${1:-epoll}
+SAMPLES=${2:-5000}
+CLIENTS=${3:-8}
+DATA_FILE=/var/tmp/aesdsocketdata
+UNIX_SOCKET=/tmp/aesdsocket.sock
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make clean
+    CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+RESULT=0
+for TARGET in "-H 127.0.0.1" "-H ::1" "-U $UNIX_SOCKET"; do
+    rm -f "$DATA_FILE"
+
+    ../aesdsocket -m "$MODE" -u "$UNIX_SOCKET" > /dev/null &
+    SERVER_PID=$!
+    sleep 1
+
+    echo "$TARGET, $MODE mode:"
+    ./aesdsocket_bench/aesdsocket_bench $TARGET -T -D -n "$SAMPLES" || RESULT=1
+    ./aesdsocket_bench/aesdsocket_bench $TARGET -N "$CLIENTS" -D -n "$SAMPLES" || RESULT=1
+
+    kill -TERM "$SERVER_PID"
+    wait "$SERVER_PID"
+done
+exit $RESULT
@@ -0,0 +1,62 @@
+#!/bin/bash
+# Hot upgrade benchmark for the /var/tmp/aesdsocketdata backend: connection
+# churn against a server that hands its listeners over to a freshly started
+# copy of itself (SIGUSR2) several times while the churn runs, in every mode,
+# with one and with several listener shards. A refused or failed connection
+# ends the churn early; the max latencies bound the unavailability window.
+# Set SERVER to a prebuilt aesdsocket to skip the build.
+# Usage: ./bench_upgrade.sh [churn connections] [upgrades]
+
+CHURN=${1:-5000}
+UPGRADES=${2:-5}
+DATA_FILE=/var/tmp/aesdsocketdata
+
+if [ -z "$SERVER" ]; then
+    (
+        cd .. || exit 1
+        echo "Building..."
+        make clean
+        CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+        if [ $? -ne 0 ]; then
+            echo "Build failed."
+            exit 1
+        fi
+    ) || exit 1
+    SERVER=../aesdsocket
+fi
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+# Churns against a fresh server started with $SERVER_ARGS, upgrading it meanwhile
+measure()
+{
+    rm -f "$DATA_FILE"
+    "$SERVER" $SERVER_ARGS > /dev/null &
+    sleep 1
+    ./aesdsocket_bench/aesdsocket_bench -C "$CHURN" > /tmp/bench_upgrade.$$ 2>&1 &
+    local bench=$!
+    for i in $(seq "$UPGRADES"); do
+        sleep 0.1
+        # The newest process is the one serving, older ones are draining
+        pkill -USR2 -n -r S,R,D -x aesdsocket
+    done
+    wait "$bench"
+    echo "exit status $?"
+    grep -E "connections in|connect|failed" /tmp/bench_upgrade.$$
+    rm -f /tmp/bench_upgrade.$$
+    pkill -TERM -x aesdsocket
+    while pgrep -r S,R,D -x aesdsocket > /dev/null; do
+        sleep 0.1
+    done
+}
+
+for MODE in thread epoll uring; do
+    for SHARDS in 1 4; do
+        echo "$MODE mode, $SHARDS listener shards, $UPGRADES upgrades:"
+        SERVER_ARGS="-m $MODE -s $SHARDS"
+        measure | sed 's/^/    /'
+    done
+done
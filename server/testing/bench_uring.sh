@@ -0,0 +1,45 @@
+#!/bin/bash
+# Engine comparison for the /var/tmp/aesdsocketdata backend: runs the delta
+# throughput and pipelining benchmarks against the epoll loops and then the
+# io_uring loops, and prints the syscalls per packet the io_uring loop counted.
+# Usage: ./bench_uring.sh [samples] [lines per batch]
+
+SAMPLES=${1:-2000}
+LINES=${2:-200}
+DATA_FILE=/var/tmp/aesdsocketdata
+SERVER_LOG=$(mktemp)
+
+(
+    cd .. || exit 1
+    echo "Building..."
+    make clean
+    CFLAGS=-DUSE_AESD_CHAR_DEVICE=0 make
+    if [ $? -ne 0 ]; then
+        echo "Build failed."
+        exit 1
+    fi
+)
+make -C aesdsocket_bench
+if [ $? -ne 0 ]; then
+    echo "Benchmark build failed."
+    exit 1
+fi
+
+RESULT=0
+for MODE in epoll uring; do
+    rm -f "$DATA_FILE"
+    ../aesdsocket -m "$MODE" > "$SERVER_LOG" &
+    SERVER_PID=$!
+    sleep 1
+
+    echo "Delta throughput, $MODE mode:"
+    ./aesdsocket_bench/aesdsocket_bench -T -D -n "$SAMPLES" || RESULT=1
+    echo "Pipelining, $MODE mode:"
+    ./aesdsocket_bench/aesdsocket_bench -L "$LINES" -n 5 || RESULT=1
+
+    kill -TERM "$SERVER_PID"
+    wait "$SERVER_PID"
+    grep "syscalls per packet" "$SERVER_LOG"
+done
+rm -f "$SERVER_LOG"
+exit $RESULT